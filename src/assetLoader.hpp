@@ -0,0 +1,208 @@
+#ifndef _ASSETLOADER_H
+#define _ASSETLOADER_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Headers abaixo são específicos de C++
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Headers locais
+#include "trace.hpp"
+
+// Carregamento paralelo de recursos: a parte de CPU do carregamento
+// (decodificar imagens, ler arquivos ".obj", calcular normais) roda em um
+// conjunto de threads auxiliares, enquanto a thread principal, dona do
+// contexto OpenGL, envia à GPU cada recurso pronto na ordem em que ele foi
+// pedido (veja AssetLoader_Wait()). Essa ordem é a ordem em que o OpenGL
+// precisa dos recursos: as texturas, por exemplo, ocupam unidades de textura
+// em sequência. As threads pegam os trabalhos na mesma ordem, então os
+// primeiros recursos a serem enviados são os primeiros a ficarem prontos.
+//
+// As threads continuam disponíveis depois do carregamento inicial, para
+// recursos carregados sob demanda durante o jogo: a thread principal
+// consulta AssetLoader_IsDone() a cada quadro em vez de esperar.
+//
+// Os trabalhos não podem chamar funções do OpenGL nem modificar estado
+// global da thread principal.
+
+struct AssetJob
+{
+    std::string          name;  // Para mensagens e para o trace
+    std::function<void()> work;
+    bool                 done;
+    std::exception_ptr   error; // Exceção lançada por "work", se houver
+};
+
+struct AssetLoader
+{
+    std::vector<std::thread> workers;
+    std::deque<AssetJob>     jobs;    // Todos os trabalhos pedidos (endereços estáveis)
+    size_t                   next;    // Próximo trabalho a ser executado
+    int                      num_done;
+    bool                     stopping;
+
+    std::mutex               mutex;
+    std::condition_variable  work_available;
+    std::condition_variable  job_done;
+};
+
+AssetLoader g_AssetLoader;
+
+void AssetLoader_WorkerThread(int index)
+{
+    char thread_name[32];
+    snprintf(thread_name, sizeof(thread_name), "asset loader %d", index);
+    Trace_SetThreadName(thread_name);
+
+    std::unique_lock<std::mutex> lock(g_AssetLoader.mutex);
+    while ( true )
+    {
+        g_AssetLoader.work_available.wait(lock, []{
+            return g_AssetLoader.stopping || g_AssetLoader.next < g_AssetLoader.jobs.size();
+        });
+        if ( g_AssetLoader.next >= g_AssetLoader.jobs.size() )
+            return;
+
+        AssetJob& job = g_AssetLoader.jobs[g_AssetLoader.next++];
+        lock.unlock();
+
+        {
+            TraceScope trace("AssetJob", job.name.c_str());
+            try
+            {
+                job.work();
+            }
+            catch (...)
+            {
+                job.error = std::current_exception();
+            }
+        }
+
+        lock.lock();
+        job.done = true;
+        g_AssetLoader.num_done += 1;
+        g_AssetLoader.job_done.notify_all();
+    }
+}
+
+void AssetLoader_Exit();
+
+// Cria as threads auxiliares, uma por núcleo do processador. A thread
+// principal passa o carregamento quase todo esperando, então não
+// descontamos o seu núcleo. As threads continuam vivas até
+// AssetLoader_Stop(); se o programa terminar antes com std::exit() (por
+// exemplo, por um erro ou pelas teclas de correção automatizada em
+// KeyCallback()), AssetLoader_Exit() as termina.
+void AssetLoader_Start()
+{
+    static bool registered = false;
+    if ( !registered )
+        std::atexit(AssetLoader_Exit);
+    registered = true;
+
+    int num_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+
+    g_AssetLoader.next = 0;
+    g_AssetLoader.num_done = 0;
+    g_AssetLoader.stopping = false;
+    for (int i = 0; i < num_threads; ++i)
+        g_AssetLoader.workers.push_back(std::thread(AssetLoader_WorkerThread, i));
+}
+
+// Pede a execução de "work" em uma thread auxiliar. Retorna o índice do
+// trabalho, usado em AssetLoader_Wait().
+int AssetLoader_Submit(const std::string& name, const std::function<void()>& work)
+{
+    std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+
+    AssetJob job;
+    job.name = name;
+    job.work = work;
+    job.done = false;
+    g_AssetLoader.jobs.push_back(job);
+    g_AssetLoader.work_available.notify_one();
+
+    return (int)g_AssetLoader.jobs.size() - 1;
+}
+
+// Número de trabalhos pedidos e já terminados, para a tela de carregamento
+int AssetLoader_NumJobs()
+{
+    std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+    return (int)g_AssetLoader.jobs.size();
+}
+
+int AssetLoader_NumDone()
+{
+    std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+    return g_AssetLoader.num_done;
+}
+
+// Se o trabalho "job" já terminou, sem esperar. Depois disso,
+// AssetLoader_Wait() retorna (ou lança a exceção do trabalho) imediatamente.
+bool AssetLoader_IsDone(int job)
+{
+    std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+    return g_AssetLoader.jobs[job].done;
+}
+
+// Espera o trabalho "job" terminar, chamando "while_waiting" (que desenha a
+// tela de carregamento) a cada ~16 ms de espera. Se o trabalho lançou uma
+// exceção, ela é lançada de novo aqui, na thread principal.
+void AssetLoader_Wait(int job, const std::function<void()>& while_waiting)
+{
+    std::unique_lock<std::mutex> lock(g_AssetLoader.mutex);
+    while ( !g_AssetLoader.jobs[job].done )
+    {
+        if ( g_AssetLoader.job_done.wait_for(lock, std::chrono::milliseconds(16)) == std::cv_status::timeout )
+        {
+            lock.unlock();
+            while_waiting();
+            lock.lock();
+        }
+    }
+
+    if ( g_AssetLoader.jobs[job].error )
+        std::rethrow_exception(g_AssetLoader.jobs[job].error);
+}
+
+// Termina as threads auxiliares, depois que os trabalhos pendentes acabarem
+void AssetLoader_Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+        g_AssetLoader.stopping = true;
+        g_AssetLoader.work_available.notify_all();
+    }
+
+    for (size_t i = 0; i < g_AssetLoader.workers.size(); ++i)
+        g_AssetLoader.workers[i].join();
+    g_AssetLoader.workers.clear();
+    g_AssetLoader.jobs.clear();
+}
+
+// Chamada por std::exit(): descarta os trabalhos que ainda não começaram e
+// espera só os que estão em andamento. Sem isso, as threads ainda ligadas a
+// std::thread no fim do programa o abortariam (std::terminate()). Não faz
+// nada se AssetLoader_Stop() já foi chamada.
+void AssetLoader_Exit()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_AssetLoader.mutex);
+        g_AssetLoader.next = g_AssetLoader.jobs.size();
+    }
+    AssetLoader_Stop();
+}
+
+#endif // _ASSETLOADER_H
+// vim: set spell spelllang=pt_br :
@@ -0,0 +1,329 @@
+#ifndef _BAKEDTEXTURE_H
+#define _BAKEDTEXTURE_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Headers do sistema operacional
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <stb_image.h>
+
+// Texturas "pré-assadas": na primeira vez que uma imagem é carregada, ela é
+// decodificada (stb_image), invertida verticalmente e reduzida em todos os
+// níveis de mipmap, e o resultado é gravado ao lado da imagem, em
+// "<imagem>.ftex". Nas próximas vezes, o arquivo .ftex é mapeado em memória
+// (mmap) e cada nível vai direto para glTexImage2D(), sem decodificação nem
+// glGenerateMipmap(). O arquivo é refeito se a imagem for mais nova que ele.
+//
+// Formato (little-endian): BakedTextureHeader, seguido de num_levels
+// BakedTextureLevel e dos texels RGB8 de cada nível, a partir de "offset"
+// (contado do início do arquivo, alinhado em 16 bytes).
+
+const char     BAKED_TEXTURE_MAGIC[8] = { 'F', 'C', 'G', 'T', 'E', 'X', '0', '1' };
+const uint32_t BAKED_TEXTURE_MAX_LEVELS = 32;
+
+struct BakedTextureHeader
+{
+    char     magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;   // Sempre 3 (RGB8, em sRGB)
+    uint32_t num_levels; // Nível 0 e todos os mipmaps, até 1x1
+};
+
+struct BakedTextureLevel
+{
+    uint64_t offset;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Arquivo mapeado em memória (somente leitura). No Windows, onde não usamos
+// mmap, o arquivo é lido inteiro para a memória.
+struct MappedFile
+{
+    const unsigned char* data;
+    size_t               size;
+    std::vector<unsigned char> buffer; // Só no Windows
+};
+
+bool MappedFile_Open(const char* filename, MappedFile* file)
+{
+    file->data = NULL;
+    file->size = 0;
+
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if ( fd < 0 )
+        return false;
+
+    struct stat info;
+    if ( fstat(fd, &info) != 0 || info.st_size == 0 )
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( data == MAP_FAILED )
+        return false;
+
+    file->data = (const unsigned char*)data;
+    file->size = (size_t)info.st_size;
+#else
+    FILE* f = fopen(filename, "rb");
+    if ( f == NULL )
+        return false;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file->buffer.resize(size > 0 ? (size_t)size : 0);
+    bool ok = size > 0 && fread(file->buffer.data(), 1, file->buffer.size(), f) == file->buffer.size();
+    fclose(f);
+    if ( !ok )
+        return false;
+
+    file->data = file->buffer.data();
+    file->size = file->buffer.size();
+#endif
+    return true;
+}
+
+void MappedFile_Close(MappedFile* file)
+{
+#ifndef _WIN32
+    if ( file->data != NULL )
+        munmap((void*)file->data, file->size);
+#else
+    std::vector<unsigned char>().swap(file->buffer);
+#endif
+    file->data = NULL;
+    file->size = 0;
+}
+
+// Conversões entre sRGB (8 bits) e intensidade linear, para que os mipmaps
+// sejam médias de intensidades, como faz glGenerateMipmap() em GL_SRGB8.
+struct SRGBToLinearTable
+{
+    float values[256];
+
+    SRGBToLinearTable()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            float c = i / 255.0f;
+            values[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+    }
+};
+
+float SRGBToLinear(unsigned char value)
+{
+    // Inicializada uma única vez, mesmo com várias threads assando texturas
+    static const SRGBToLinearTable table;
+    return table.values[value];
+}
+
+unsigned char LinearToSRGB(float value)
+{
+    float c = (value <= 0.0031308f) ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char)std::min(std::max(c * 255.0f + 0.5f, 0.0f), 255.0f);
+}
+
+// Reduz a imagem RGB8 "src" (width x height) à metade em cada eixo (no
+// mínimo 1), com a média de blocos de 2x2 texels. Em dimensões ímpares, o
+// último texel é repetido.
+void DownsampleRGB8(const unsigned char* src, int width, int height, std::vector<unsigned char>* dst)
+{
+    int dst_width = std::max(width / 2, 1);
+    int dst_height = std::max(height / 2, 1);
+    dst->resize(3 * (size_t)dst_width * dst_height);
+
+    for (int y = 0; y < dst_height; ++y)
+    {
+        int y0 = std::min(2*y, height - 1), y1 = std::min(2*y + 1, height - 1);
+        for (int x = 0; x < dst_width; ++x)
+        {
+            int x0 = std::min(2*x, width - 1), x1 = std::min(2*x + 1, width - 1);
+            for (int c = 0; c < 3; ++c)
+            {
+                float sum = SRGBToLinear(src[3*((size_t)y0*width + x0) + c])
+                          + SRGBToLinear(src[3*((size_t)y0*width + x1) + c])
+                          + SRGBToLinear(src[3*((size_t)y1*width + x0) + c])
+                          + SRGBToLinear(src[3*((size_t)y1*width + x1) + c]);
+                (*dst)[3*((size_t)y*dst_width + x) + c] = LinearToSRGB(0.25f * sum);
+            }
+        }
+    }
+}
+
+// Decodifica "image_filename" e grava a textura pré-assada em
+// "baked_filename". Retorna false se a imagem não puder ser lida ou o
+// arquivo não puder ser escrito. A imagem é invertida verticalmente por
+// stb_image, configurada uma única vez em main(), já que a configuração é
+// global e esta função pode rodar em várias threads ao mesmo tempo.
+bool BakeTexture(const char* image_filename, const char* baked_filename)
+{
+    int width, height, channels;
+    unsigned char* data = stbi_load(image_filename, &width, &height, &channels, 3);
+    if ( data == NULL )
+        return false;
+
+    // Níveis de mipmap, do original até 1x1
+    std::vector<std::vector<unsigned char> > levels(1);
+    std::vector<BakedTextureLevel> level_info(1);
+    levels[0].assign(data, data + 3 * (size_t)width * height);
+    level_info[0].width = width;
+    level_info[0].height = height;
+    stbi_image_free(data);
+
+    while ( level_info.back().width > 1 || level_info.back().height > 1 )
+    {
+        const BakedTextureLevel& last = level_info.back();
+        levels.push_back(std::vector<unsigned char>());
+        DownsampleRGB8(levels[levels.size() - 2].data(), last.width, last.height, &levels.back());
+
+        BakedTextureLevel level;
+        level.width = std::max(last.width / 2, (uint32_t)1);
+        level.height = std::max(last.height / 2, (uint32_t)1);
+        level_info.push_back(level);
+    }
+
+    BakedTextureHeader header;
+    std::memcpy(header.magic, BAKED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.width = width;
+    header.height = height;
+    header.channels = 3;
+    header.num_levels = (uint32_t)levels.size();
+
+    uint64_t offset = sizeof(BakedTextureHeader) + levels.size() * sizeof(BakedTextureLevel);
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+        offset = (offset + 15) & ~(uint64_t)15;
+        level_info[i].offset = offset;
+        offset += levels[i].size();
+    }
+
+    // Escrevemos em um arquivo temporário e o renomeamos no fim, para que
+    // uma execução interrompida não deixe um .ftex incompleto
+    std::string temporary = std::string(baked_filename) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if ( file == NULL )
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(level_info.data(), sizeof(BakedTextureLevel), level_info.size(), file) == level_info.size();
+    for (size_t i = 0; i < levels.size() && ok; ++i)
+    {
+        static const unsigned char padding[16] = {};
+        long position = ftell(file);
+        ok = fwrite(padding, 1, (size_t)(level_info[i].offset - position), file) == (size_t)(level_info[i].offset - position)
+          && fwrite(levels[i].data(), 1, levels[i].size(), file) == levels[i].size();
+    }
+    ok = (fclose(file) == 0) && ok;
+
+    std::remove(baked_filename);
+    if ( !ok || std::rename(temporary.c_str(), baked_filename) != 0 )
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Textura pré-assada aberta para leitura
+struct BakedTexture
+{
+    MappedFile               file;
+    const BakedTextureHeader* header;
+    const BakedTextureLevel*  levels;
+};
+
+// Ponteiro para os texels do nível "level"
+const unsigned char* BakedTexture_LevelData(const BakedTexture& texture, uint32_t level)
+{
+    return texture.file.data + texture.levels[level].offset;
+}
+
+// Abre a textura pré-assada "baked_filename", verificando se o arquivo está
+// completo e é consistente.
+bool BakedTexture_Open(const char* baked_filename, BakedTexture* texture)
+{
+    if ( !MappedFile_Open(baked_filename, &texture->file) )
+        return false;
+
+    const MappedFile& file = texture->file;
+    texture->header = (const BakedTextureHeader*)file.data;
+    texture->levels = (const BakedTextureLevel*)(file.data + sizeof(BakedTextureHeader));
+
+    bool ok = file.size >= sizeof(BakedTextureHeader)
+           && std::memcmp(texture->header->magic, BAKED_TEXTURE_MAGIC, sizeof(BAKED_TEXTURE_MAGIC)) == 0
+           && texture->header->channels == 3
+           && texture->header->num_levels >= 1 && texture->header->num_levels <= BAKED_TEXTURE_MAX_LEVELS
+           && file.size >= sizeof(BakedTextureHeader) + texture->header->num_levels * sizeof(BakedTextureLevel);
+    for (uint32_t i = 0; ok && i < texture->header->num_levels; ++i)
+    {
+        const BakedTextureLevel& level = texture->levels[i];
+        ok = level.offset + 3 * (uint64_t)level.width * level.height <= file.size;
+    }
+
+    if ( !ok )
+        MappedFile_Close(&texture->file);
+    return ok;
+}
+
+void BakedTexture_Close(BakedTexture* texture)
+{
+    MappedFile_Close(&texture->file);
+}
+
+// Instante da última modificação de um arquivo, ou -1 se ele não existe
+double FileModificationTime(const char* filename)
+{
+    struct stat info;
+    if ( stat(filename, &info) != 0 )
+        return -1.0;
+    return (double)info.st_mtime;
+}
+
+// Abre a versão pré-assada de "image_filename", assando-a antes se ela não
+// existe, está desatualizada ou corrompida. Se não for possível gravar o
+// .ftex (diretório somente leitura, por exemplo), retorna false e a imagem
+// deve ser carregada da forma tradicional.
+bool LoadBakedTexture(const char* image_filename, BakedTexture* texture)
+{
+    std::string baked_filename = std::string(image_filename) + ".ftex";
+
+    bool fresh = FileModificationTime(baked_filename.c_str()) >= FileModificationTime(image_filename);
+    if ( fresh && BakedTexture_Open(baked_filename.c_str(), texture) )
+        return true;
+
+    printf("Assando textura \"%s\"... ", baked_filename.c_str());
+    if ( !BakeTexture(image_filename, baked_filename.c_str()) )
+    {
+        printf("falhou.\n");
+        return false;
+    }
+    printf("OK.\n");
+
+    return BakedTexture_Open(baked_filename.c_str(), texture);
+}
+
+#endif // _BAKEDTEXTURE_H
+// vim: set spell spelllang=pt_br :
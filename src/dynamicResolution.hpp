@@ -0,0 +1,159 @@
+#ifndef _DYNAMICRESOLUTION_H
+#define _DYNAMICRESOLUTION_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Headers abaixo são específicos de C++
+#include <algorithm>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+#include <GLFW/glfw3.h>  // Criação de janelas do sistema operacional
+
+// Headers locais
+#include "profiling.hpp"
+
+// Resolução dinâmica: a cena 3D é desenhada em um framebuffer fora da tela,
+// com uma fração ("scale") da resolução da janela em cada eixo, e depois
+// ampliada para a janela com filtro bilinear (glBlitFramebuffer()). O texto
+// é desenhado depois, direto na janela, na resolução nativa.
+//
+// A cada DYNAMIC_RESOLUTION_INTERVAL quadros comparamos o tempo de GPU da
+// cena (veja GpuTimers em "profiling.hpp") com o tempo alvo ("--target-frame-ms",
+// veja main()) e ajustamos a escala. Quando o custo é dominado pelo
+// preenchimento de pixels (como em OpenGL por software), ele é proporcional
+// a scale², então uma única correção já chega perto do alvo.
+
+const int   DYNAMIC_RESOLUTION_INTERVAL = 8;
+const float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+const float DYNAMIC_RESOLUTION_MAX_SCALE = 1.0f;
+
+struct DynamicResolution
+{
+    GLuint framebuffer;
+    GLuint color_renderbuffer;
+    GLuint depth_renderbuffer;
+    int    width, height;   // Tamanho alocado: o da janela
+    float  scale;           // Fração da janela usada pela cena, em cada eixo
+    float  target_ms;       // Tempo alvo; 0 mantém a escala fixa
+    int    frames_since_update;
+};
+
+DynamicResolution g_DynamicResolution = { 0, 0, 0, 0, 0, 1.0f, 1000.0f / 60.0f, 0 };
+
+int DynamicResolution_RenderWidth()
+{
+    return std::max(1, (int)(g_DynamicResolution.width * g_DynamicResolution.scale));
+}
+
+int DynamicResolution_RenderHeight()
+{
+    return std::max(1, (int)(g_DynamicResolution.height * g_DynamicResolution.scale));
+}
+
+// Passa a desenhar a cena no framebuffer fora da tela, (re)alocado se a
+// janela mudou de tamanho, e o limpa. Chamada a cada quadro antes de
+// desenhar a cena, e não em FramebufferSizeCallback(), que pode ser chamada
+// no meio de um quadro (durante glfwPollEvents()).
+void DynamicResolution_BeginScene(GLFWwindow* window)
+{
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+
+    if ( g_DynamicResolution.framebuffer == 0 )
+    {
+        glGenFramebuffers(1, &g_DynamicResolution.framebuffer);
+        glGenRenderbuffers(1, &g_DynamicResolution.color_renderbuffer);
+        glGenRenderbuffers(1, &g_DynamicResolution.depth_renderbuffer);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_DynamicResolution.framebuffer);
+
+    if ( width != g_DynamicResolution.width || height != g_DynamicResolution.height )
+    {
+        // Alocamos a resolução máxima; escalas menores usam só um canto
+        glBindRenderbuffer(GL_RENDERBUFFER, g_DynamicResolution.color_renderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, g_DynamicResolution.depth_renderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, g_DynamicResolution.color_renderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_DynamicResolution.depth_renderbuffer);
+
+        if ( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE )
+        {
+            fprintf(stderr, "ERROR: Cannot create the scene framebuffer (%dx%d).\n", width, height);
+            std::exit(EXIT_FAILURE);
+        }
+
+        g_DynamicResolution.width = width;
+        g_DynamicResolution.height = height;
+    }
+
+    glViewport(0, 0, DynamicResolution_RenderWidth(), DynamicResolution_RenderHeight());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+// Amplia a cena para a janela e volta a desenhar na janela, em toda a sua área
+void DynamicResolution_EndScene()
+{
+    int render_width = DynamicResolution_RenderWidth();
+    int render_height = DynamicResolution_RenderHeight();
+    bool same_size = (render_width == g_DynamicResolution.width && render_height == g_DynamicResolution.height);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_DynamicResolution.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, render_width, render_height,
+                      0, 0, g_DynamicResolution.width, g_DynamicResolution.height,
+                      GL_COLOR_BUFFER_BIT, same_size ? GL_NEAREST : GL_LINEAR);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, g_DynamicResolution.width, g_DynamicResolution.height);
+}
+
+// Ajusta a escala, a cada DYNAMIC_RESOLUTION_INTERVAL quadros, a partir da
+// média do tempo de GPU da cena nesses quadros (ou do tempo de quadro, se o
+// driver ainda não entregou nenhuma medida de GPU).
+void DynamicResolution_Update()
+{
+    if ( g_DynamicResolution.target_ms <= 0.0f )
+        return;
+
+    g_DynamicResolution.frames_since_update += 1;
+    if ( g_DynamicResolution.frames_since_update < DYNAMIC_RESOLUTION_INTERVAL )
+        return;
+    g_DynamicResolution.frames_since_update = 0;
+
+    const SampleHistory& scene = g_GpuPassHistory[GPU_PASS_SCENE];
+    const SampleHistory& spheres = g_GpuPassHistory[GPU_PASS_SPHERES];
+    float cost_ms = 0.0f;
+    if ( scene.count >= DYNAMIC_RESOLUTION_INTERVAL && spheres.count >= DYNAMIC_RESOLUTION_INTERVAL )
+    {
+        for (int i = 0; i < DYNAMIC_RESOLUTION_INTERVAL; ++i)
+            cost_ms += scene.recent(i) + spheres.recent(i);
+    }
+    else
+    {
+        for (int i = 0; i < DYNAMIC_RESOLUTION_INTERVAL && i < g_FrameTimeHistory.count; ++i)
+            cost_ms += g_FrameTimeHistory.recent(i);
+    }
+    cost_ms /= DYNAMIC_RESOLUTION_INTERVAL;
+    if ( cost_ms <= 0.0f )
+        return;
+
+    // Acima do alvo, reduzimos a escala de uma vez (o custo cai com a área);
+    // bem abaixo dele, aumentamos aos poucos, para não oscilar
+    float scale = g_DynamicResolution.scale;
+    if ( cost_ms > g_DynamicResolution.target_ms )
+        scale *= std::max(std::sqrt(g_DynamicResolution.target_ms / cost_ms), 0.8f);
+    else if ( cost_ms < 0.7f * g_DynamicResolution.target_ms )
+        scale += 0.05f;
+
+    g_DynamicResolution.scale = std::min(std::max(scale, DYNAMIC_RESOLUTION_MIN_SCALE), DYNAMIC_RESOLUTION_MAX_SCALE);
+}
+
+#endif // _DYNAMICRESOLUTION_H
+// vim: set spell spelllang=pt_br :
@@ -0,0 +1,144 @@
+#ifndef _FLIGHTRECORDER_H
+#define _FLIGHTRECORDER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headers locais
+#include "glState.hpp"
+#include "inputQueue.hpp"
+#include "profiling.hpp"
+
+// "Caixa-preta" dos últimos quadros: a cada quadro guardamos os tempos de
+// cada fase, os contadores da física e os do OpenGL (veja "glState.hpp") em
+// um buffer circular em memória, o que custa só uma cópia de ~100 bytes.
+// Quando um quadro passa do orçamento (opção "--hitch-budget MS", veja
+// main()), esperamos mais FLIGHT_RECORDER_FRAMES_AFTER quadros e escrevemos
+// todo o buffer em "hitch_NNNNNN.csv", com os quadros antes e depois do
+// engasgo, para analisar travadas intermitentes depois do ocorrido.
+
+const int FLIGHT_RECORDER_FRAMES       = 300;
+const int FLIGHT_RECORDER_FRAMES_AFTER = 30;
+
+struct FlightFrame
+{
+    int    frame_number;
+    double time;          // glfwGetTime() no fim do quadro
+    float  frame_ms;
+    float  phase_ms[NUM_PROFILE_PHASES];
+
+    // Contadores da física, incrementados pelo laço principal
+    int    substeps;      // Passos de integração da física
+    int    pairs_tested;  // Pares de bolas testados
+    int    contacts;      // Colisões entre bolas
+    int    shots;         // Tiros (raycasts)
+
+    int    input_dropped; // Eventos de entrada descartados com a fila cheia
+
+    GLStateCounters gl;
+};
+
+struct FlightRecorder
+{
+    FlightFrame frames[FLIGHT_RECORDER_FRAMES];
+    int         next;  // Posição do próximo quadro
+    int         count; // Número de quadros válidos
+    FlightFrame current;
+
+    float budget_ms;   // 0: desativado
+    int   hitch_frame; // Quadro que passou do orçamento, ou -1
+    int   dump_frame;  // Quadro em que o buffer será escrito, ou -1
+
+    size_t input_dropped; // g_InputQueue.dropped no fim do quadro anterior
+};
+
+FlightRecorder g_FlightRecorder = { {}, 0, 0, {}, 0.0f, -1, -1, 0 };
+
+// Contadores do quadro atual, preenchidos pelo laço principal
+FlightFrame& FlightRecorder_Current()
+{
+    return g_FlightRecorder.current;
+}
+
+// Escreve os quadros guardados em "filename", do mais antigo ao mais recente
+void FlightRecorder_Dump(const char* filename)
+{
+    FILE* file = fopen(filename, "w");
+    if ( file == NULL )
+    {
+        fprintf(stderr, "ERROR: Cannot create flight recorder file \"%s\".\n", filename);
+        return;
+    }
+
+    fprintf(file, "frame,time_s,hitch,frame_ms");
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+        fprintf(file, ",%s_ms", g_ProfilePhaseNames[i]);
+    fprintf(file, ",substeps,pairs_tested,contacts,shots,input_dropped");
+    fprintf(file, ",draw_calls,binds,state_changes,uploads,uploaded_bytes,skipped_calls\n");
+
+    int first = (g_FlightRecorder.next - g_FlightRecorder.count + FLIGHT_RECORDER_FRAMES) % FLIGHT_RECORDER_FRAMES;
+    for (int n = 0; n < g_FlightRecorder.count; ++n)
+    {
+        const FlightFrame& f = g_FlightRecorder.frames[(first + n) % FLIGHT_RECORDER_FRAMES];
+
+        fprintf(file, "%d,%.6f,%d,%.3f", f.frame_number, f.time,
+                f.frame_number == g_FlightRecorder.hitch_frame ? 1 : 0, f.frame_ms);
+        for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+            fprintf(file, ",%.3f", f.phase_ms[i]);
+        fprintf(file, ",%d,%d,%d,%d,%d", f.substeps, f.pairs_tested, f.contacts, f.shots, f.input_dropped);
+        fprintf(file, ",%d,%d,%d,%d,%d,%d\n", f.gl.draw_calls, f.gl.binds, f.gl.state_changes,
+                f.gl.uploads, (int)f.gl.uploaded_bytes, f.gl.skipped_calls);
+    }
+
+    fclose(file);
+}
+
+// Guarda o quadro que acabou de terminar (chamada depois de
+// Profiler_EndFrame(), antes de GLState_BeginFrame() do próximo quadro) e
+// escreve o buffer se houve um engasgo FLIGHT_RECORDER_FRAMES_AFTER quadros
+// atrás.
+void FlightRecorder_EndFrame(int frame_number, double time)
+{
+    FlightFrame& f = g_FlightRecorder.current;
+    f.frame_number = frame_number;
+    f.time = time;
+    f.frame_ms = g_FrameTimeHistory.recent(0);
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+        f.phase_ms[i] = g_PhaseHistory[i].recent(0);
+    f.gl = g_GLStateCounters;
+    f.input_dropped = (int)(g_InputQueue.dropped - g_FlightRecorder.input_dropped);
+    g_FlightRecorder.input_dropped = g_InputQueue.dropped;
+
+    g_FlightRecorder.frames[g_FlightRecorder.next] = f;
+    g_FlightRecorder.next = (g_FlightRecorder.next + 1) % FLIGHT_RECORDER_FRAMES;
+    if ( g_FlightRecorder.count < FLIGHT_RECORDER_FRAMES )
+        g_FlightRecorder.count += 1;
+
+    // Engasgos enquanto um registro já está pendente não disparam outro; eles
+    // aparecem no registro pendente
+    bool hitch = (f.frame_ms > g_FlightRecorder.budget_ms);
+    std::memset(&f, 0, sizeof(f));
+
+    if ( g_FlightRecorder.budget_ms <= 0.0f )
+        return;
+
+    if ( hitch && g_FlightRecorder.dump_frame < 0 )
+    {
+        g_FlightRecorder.hitch_frame = frame_number;
+        g_FlightRecorder.dump_frame = frame_number + FLIGHT_RECORDER_FRAMES_AFTER;
+    }
+
+    if ( frame_number == g_FlightRecorder.dump_frame )
+    {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "hitch_%06d.csv", g_FlightRecorder.hitch_frame);
+        FlightRecorder_Dump(filename);
+        printf("Quadro %d levou mais de %.1f ms: últimos %d quadros escritos em \"%s\".\n",
+               g_FlightRecorder.hitch_frame, g_FlightRecorder.budget_ms, g_FlightRecorder.count, filename);
+        g_FlightRecorder.dump_frame = -1;
+    }
+}
+
+#endif // _FLIGHTRECORDER_H
+// vim: set spell spelllang=pt_br :
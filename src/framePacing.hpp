@@ -0,0 +1,110 @@
+#ifndef _FRAMEPACING_H
+#define _FRAMEPACING_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <chrono>
+#include <algorithm>
+#include <thread>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+#include <GLFW/glfw3.h>  // Criação de janelas do sistema operacional
+
+// Ritmo dos quadros: intervalo de troca de buffers (vsync) e limitador de
+// quadros por segundo, configurados pela linha de comando (veja main()).
+//
+// Para que a entrada chegue à tela o quanto antes, o laço principal espera
+// pelo limitador, lê a entrada (glfwPollEvents()) e só então simula e
+// desenha. A orientação da câmera ainda é lida de novo logo antes de enviar
+// os desenhos à GPU (veja o "late latch" no laço de main()).
+
+// Intervalo de troca de buffers: 0 (sem vsync), 1 (vsync) ou adaptativo
+// (vsync, exceto quando o quadro atrasa; requer a extensão
+// "swap_control_tear" do driver, senão equivale a 1).
+const int SWAP_INTERVAL_ADAPTIVE = -1;
+
+struct FramePacing
+{
+    int    swap_interval;   // 0, 1 ou SWAP_INTERVAL_ADAPTIVE
+    double fps_limit;       // 0: sem limite
+    double next_frame_time; // Instante (glfwGetTime()) do início do próximo quadro
+    bool   late_latch;      // Ler a câmera de novo antes de enviar os desenhos
+};
+
+FramePacing g_FramePacing = { 1, 0.0, 0.0, true };
+
+// Com o late latch, a câmera ainda pode girar depois que os objetos da cena
+// foram descartados pelo frustum. Eles são então testados contra um frustum
+// alargado por esta margem (em radianos) de cada lado; giros maiores entre o
+// início do quadro e o late latch podem deixar de fora, por um quadro,
+// objetos que entram pela borda.
+const float LATE_LATCH_CULL_MARGIN = 0.15f;
+
+// Lê o argumento de "--swap-interval": "0", "1" ou "adaptive". Retorna false
+// se o valor não for válido.
+bool FramePacing_ParseSwapInterval(const char* value)
+{
+    if ( std::strcmp(value, "0") == 0 )
+        g_FramePacing.swap_interval = 0;
+    else if ( std::strcmp(value, "1") == 0 )
+        g_FramePacing.swap_interval = 1;
+    else if ( std::strcmp(value, "adaptive") == 0 )
+        g_FramePacing.swap_interval = SWAP_INTERVAL_ADAPTIVE;
+    else
+        return false;
+    return true;
+}
+
+// Aplica o intervalo de troca de buffers ao contexto OpenGL atual
+void FramePacing_ApplySwapInterval()
+{
+    int interval = g_FramePacing.swap_interval;
+    if ( interval == SWAP_INTERVAL_ADAPTIVE
+         && !glfwExtensionSupported("WGL_EXT_swap_control_tear")
+         && !glfwExtensionSupported("GLX_EXT_swap_control_tear") )
+    {
+        fprintf(stderr, "WARNING: adaptive vsync not supported, using --swap-interval 1.\n");
+        interval = 1;
+    }
+    glfwSwapInterval(interval);
+}
+
+// Espera até o início do próximo quadro, se há um limite de quadros por
+// segundo. O sleep do sistema operacional pode acordar alguns milissegundos
+// depois do pedido, então dormimos só até perto do instante desejado e
+// esperamos o restante em espera ativa. Enquanto dormimos, lemos a entrada
+// a cada milissegundo, para que os eventos recebam instantes mais precisos
+// do que o início do quadro (veja "inputQueue.hpp").
+void FramePacing_WaitForNextFrame()
+{
+    if ( g_FramePacing.fps_limit <= 0.0 )
+        return;
+
+    const double spin_time = 0.002; // Segundos finais em espera ativa
+    double frame_time = 1.0 / g_FramePacing.fps_limit;
+    double now = glfwGetTime();
+
+    // Se o quadro anterior atrasou mais de um quadro inteiro, não tentamos
+    // recuperar o tempo perdido com quadros mais curtos
+    if ( g_FramePacing.next_frame_time < now - frame_time )
+        g_FramePacing.next_frame_time = now;
+
+    double remaining = g_FramePacing.next_frame_time - now;
+    while ( remaining > spin_time )
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(remaining - spin_time, 0.001)));
+        glfwPollEvents();
+        remaining = g_FramePacing.next_frame_time - glfwGetTime();
+    }
+    while ( glfwGetTime() < g_FramePacing.next_frame_time )
+        ;
+
+    g_FramePacing.next_frame_time += frame_time;
+}
+
+#endif // _FRAMEPACING_H
+// vim: set spell spelllang=pt_br :
@@ -0,0 +1,183 @@
+#ifndef _FRUSTUMCULLING_H
+#define _FRUSTUMCULLING_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Headers abaixo são específicos de C++
+#include <vector>
+
+// Headers da biblioteca GLM: criação de matrizes e vetores.
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+// O teste em lote usa SSE quando disponível (sempre, em x86-64) e um laço
+// escalar equivalente nas demais arquiteturas.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+// Os seis planos do frustum da câmera (left, right, bottom, top, near, far),
+// em coordenadas globais. Cada plano (a,b,c,d) tem a normal apontando para
+// dentro do frustum: um ponto p está do lado de dentro se a*px+b*py+c*pz+d >= 0.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+// Lote de AABBs em formato SoA ("structure of arrays"), descritas por centro e
+// meia-extensão, para que CullAABBBatch() teste quatro caixas por vez.
+struct AABBBatch
+{
+    std::vector<float> center_x, center_y, center_z;
+    std::vector<float> extent_x, extent_y, extent_z;
+
+    size_t size() const { return center_x.size(); }
+
+    void clear()
+    {
+        center_x.clear(); center_y.clear(); center_z.clear();
+        extent_x.clear(); extent_y.clear(); extent_z.clear();
+    }
+
+    void push(const glm::vec3& center, const glm::vec3& extent)
+    {
+        center_x.push_back(center.x); center_y.push_back(center.y); center_z.push_back(center.z);
+        extent_x.push_back(extent.x); extent_y.push_back(extent.y); extent_z.push_back(extent.z);
+    }
+};
+
+// Extrai os planos do frustum da matriz "clip" = projection * view (método de
+// Gribb e Hartmann). Um ponto está dentro do frustum se, em coordenadas de
+// recorte, -w <= x,y,z <= w; cada desigualdade é um dos planos.
+Frustum ExtractFrustum(const glm::mat4& clip)
+{
+    // Linhas da matriz (GLM guarda as matrizes por colunas)
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0]; // left
+    frustum.planes[1] = row[3] - row[0]; // right
+    frustum.planes[2] = row[3] + row[1]; // bottom
+    frustum.planes[3] = row[3] - row[1]; // top
+    frustum.planes[4] = row[3] + row[2]; // near
+    frustum.planes[5] = row[3] - row[2]; // far
+
+    for (int i = 0; i < 6; ++i)
+    {
+        glm::vec4& p = frustum.planes[i];
+        float length = std::sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+        p = p / length;
+    }
+
+    return frustum;
+}
+
+// Computa a AABB, em coordenadas globais, da AABB (bbox_min, bbox_max) em
+// coordenadas do modelo transformada pela matriz "model". O centro é
+// transformado normalmente; a meia-extensão é transformada pelo valor
+// absoluto da parte linear da matriz.
+void TransformAABB(const glm::mat4& model, const glm::vec3& bbox_min, const glm::vec3& bbox_max,
+                   glm::vec3* center, glm::vec3* extent)
+{
+    glm::vec3 local_center = (bbox_min + bbox_max) * 0.5f;
+    glm::vec3 local_extent = (bbox_max - bbox_min) * 0.5f;
+
+    *center = glm::vec3(model * glm::vec4(local_center, 1.0f));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        (*extent)[i] = std::fabs(model[0][i]) * local_extent.x
+                     + std::fabs(model[1][i]) * local_extent.y
+                     + std::fabs(model[2][i]) * local_extent.z;
+    }
+}
+
+// Testa uma caixa contra os seis planos. A caixa está fora do frustum se,
+// para algum plano, até o seu vértice mais "para dentro" fica do lado de fora.
+bool AABBInsideFrustum(const Frustum& frustum, float cx, float cy, float cz, float ex, float ey, float ez)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        const glm::vec4& p = frustum.planes[i];
+        float distance = p.x*cx + p.y*cy + p.z*cz + p.w;
+        float radius   = std::fabs(p.x)*ex + std::fabs(p.y)*ey + std::fabs(p.z)*ez;
+        if ( distance + radius < 0.0f )
+            return false;
+    }
+    return true;
+}
+
+// Testa todas as caixas do lote contra o frustum. Ao final, (*visible)[i] é 1
+// se a caixa i intersecta o frustum e 0 caso contrário. Retorna o número de
+// caixas visíveis.
+int CullAABBBatch(const Frustum& frustum, const AABBBatch& batch, std::vector<unsigned char>* visible)
+{
+    size_t count = batch.size();
+    visible->resize(count);
+
+    int num_visible = 0;
+    size_t i = 0;
+
+#ifdef FRUSTUM_CULLING_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&batch.center_x[i]);
+        __m128 cy = _mm_loadu_ps(&batch.center_y[i]);
+        __m128 cz = _mm_loadu_ps(&batch.center_z[i]);
+        __m128 ex = _mm_loadu_ps(&batch.extent_x[i]);
+        __m128 ey = _mm_loadu_ps(&batch.extent_y[i]);
+        __m128 ez = _mm_loadu_ps(&batch.extent_z[i]);
+
+        __m128 outside = _mm_setzero_ps();
+
+        for (int plane = 0; plane < 6; ++plane)
+        {
+            const glm::vec4& p = frustum.planes[plane];
+            __m128 px = _mm_set1_ps(p.x);
+            __m128 py = _mm_set1_ps(p.y);
+            __m128 pz = _mm_set1_ps(p.z);
+
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                _mm_add_ps(_mm_mul_ps(pz, cz), _mm_set1_ps(p.w)));
+
+            __m128 radius = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), ex), _mm_mul_ps(_mm_andnot_ps(sign, py), ey)),
+                _mm_mul_ps(_mm_andnot_ps(sign, pz), ez));
+
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        int outside_mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            unsigned char inside = (outside_mask & (1 << lane)) ? 0 : 1;
+            (*visible)[i + lane] = inside;
+            num_visible += inside;
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        unsigned char inside = AABBInsideFrustum(frustum,
+            batch.center_x[i], batch.center_y[i], batch.center_z[i],
+            batch.extent_x[i], batch.extent_y[i], batch.extent_z[i]) ? 1 : 0;
+        (*visible)[i] = inside;
+        num_visible += inside;
+    }
+
+    return num_visible;
+}
+
+#endif // _FRUSTUMCULLING_H
+// vim: set spell spelllang=pt_br :
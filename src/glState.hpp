@@ -0,0 +1,271 @@
+#ifndef _GLSTATE_H
+#define _GLSTATE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <map>
+#include <vector>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Camada fina sobre as chamadas OpenGL usadas durante a renderização. Cada
+// função GLState_*() lembra o último valor enviado ao driver e não repete
+// chamadas que não mudariam nada (um glBindVertexArray() do VAO que já está
+// ligado, por exemplo). Todo código que desenha deve passar por aqui, caso
+// contrário o estado guardado deixa de corresponder ao do OpenGL; depois de
+// chamadas diretas, use GLState_Invalidate().
+//
+// As funções também contam, a cada quadro, quantas chamadas de desenho,
+// trocas de estado e envios de dados foram feitos (veja GLStateCounters).
+//
+// "textrendering.cpp" declara e usa estas mesmas funções.
+
+// Contadores de um quadro
+struct GLStateCounters
+{
+    int    draw_calls;     // glDraw*()
+    int    binds;          // Programas, VAOs e buffers efetivamente ligados
+    int    state_changes;  // glEnable(), glDepthFunc(), glBlendFunc(), ...
+    int    uploads;        // glBufferData(), glBufferSubData() e glUniform*()
+    size_t uploaded_bytes;
+    int    skipped_calls;  // Chamadas evitadas por não mudarem o estado
+};
+
+GLStateCounters g_GLStateCounters;          // Quadro atual
+GLStateCounters g_GLStateLastFrameCounters; // Último quadro completo
+
+// Estado conhecido do OpenGL. Valores "desconhecidos" ((GLuint)-1 para ids,
+// -1 para glEnable() e GL_NONE para os enums) forçam a próxima chamada.
+struct GLStateCache
+{
+    GLuint program;
+    GLuint vertex_array;
+    GLuint array_buffer;
+    GLuint uniform_buffer;
+    int    blend;       // -1: desconhecido
+    int    depth_test;
+    int    cull_face;
+    GLenum depth_func;
+    GLenum blend_src, blend_dst;
+    GLenum polygon_mode;
+};
+
+GLStateCache g_GLState;
+
+// Últimos dados enviados a cada buffer de uniforms, e a cada uniform
+// (programa, location), para descartar envios repetidos.
+std::map<GLuint, std::vector<unsigned char> >           g_GLStateUniformBuffers;
+std::map<std::pair<GLuint, GLint>, std::vector<float> > g_GLStateUniforms;
+
+// Esquece todo o estado guardado. As próximas chamadas vão sempre ao driver.
+void GLState_Invalidate()
+{
+    g_GLState.program        = (GLuint)-1;
+    g_GLState.vertex_array   = (GLuint)-1;
+    g_GLState.array_buffer   = (GLuint)-1;
+    g_GLState.uniform_buffer = (GLuint)-1;
+    g_GLState.blend          = -1;
+    g_GLState.depth_test     = -1;
+    g_GLState.cull_face      = -1;
+    g_GLState.depth_func     = GL_NONE;
+    g_GLState.blend_src      = GL_NONE;
+    g_GLState.blend_dst      = GL_NONE;
+    g_GLState.polygon_mode   = GL_NONE;
+    g_GLStateUniformBuffers.clear();
+    g_GLStateUniforms.clear();
+}
+
+// Inicia os contadores de um novo quadro, guardando os do quadro anterior
+void GLState_BeginFrame()
+{
+    g_GLStateLastFrameCounters = g_GLStateCounters;
+    std::memset(&g_GLStateCounters, 0, sizeof(g_GLStateCounters));
+}
+
+void GLState_UseProgram(GLuint program)
+{
+    if ( program == g_GLState.program )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glUseProgram(program);
+    g_GLState.program = program;
+    g_GLStateCounters.binds += 1;
+}
+
+void GLState_BindVertexArray(GLuint vertex_array)
+{
+    if ( vertex_array == g_GLState.vertex_array )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glBindVertexArray(vertex_array);
+    g_GLState.vertex_array = vertex_array;
+    g_GLStateCounters.binds += 1;
+}
+
+// Só GL_ARRAY_BUFFER e GL_UNIFORM_BUFFER são guardados. O buffer de
+// GL_ELEMENT_ARRAY_BUFFER faz parte do VAO e vai sempre ao driver.
+void GLState_BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint* current = NULL;
+    if ( target == GL_ARRAY_BUFFER )
+        current = &g_GLState.array_buffer;
+    else if ( target == GL_UNIFORM_BUFFER )
+        current = &g_GLState.uniform_buffer;
+
+    if ( current != NULL && *current == buffer )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glBindBuffer(target, buffer);
+    if ( current != NULL )
+        *current = buffer;
+    g_GLStateCounters.binds += 1;
+}
+
+// glEnable()/glDisable() de GL_BLEND, GL_DEPTH_TEST ou GL_CULL_FACE
+void GLState_SetEnabled(GLenum capability, bool enabled)
+{
+    int* current = NULL;
+    if ( capability == GL_BLEND )
+        current = &g_GLState.blend;
+    else if ( capability == GL_DEPTH_TEST )
+        current = &g_GLState.depth_test;
+    else if ( capability == GL_CULL_FACE )
+        current = &g_GLState.cull_face;
+
+    if ( current != NULL && *current == (int)enabled )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    if ( enabled )
+        glEnable(capability);
+    else
+        glDisable(capability);
+    if ( current != NULL )
+        *current = (int)enabled;
+    g_GLStateCounters.state_changes += 1;
+}
+
+void GLState_DepthFunc(GLenum func)
+{
+    if ( func == g_GLState.depth_func )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glDepthFunc(func);
+    g_GLState.depth_func = func;
+    g_GLStateCounters.state_changes += 1;
+}
+
+void GLState_BlendFunc(GLenum src, GLenum dst)
+{
+    if ( src == g_GLState.blend_src && dst == g_GLState.blend_dst )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glBlendFunc(src, dst);
+    g_GLState.blend_src = src;
+    g_GLState.blend_dst = dst;
+    g_GLStateCounters.state_changes += 1;
+}
+
+// glPolygonMode() sempre com GL_FRONT_AND_BACK, o único aceito no perfil core
+void GLState_PolygonMode(GLenum mode)
+{
+    if ( mode == g_GLState.polygon_mode )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    g_GLState.polygon_mode = mode;
+    g_GLStateCounters.state_changes += 1;
+}
+
+void GLState_BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+    g_GLStateCounters.uploads += 1;
+    if ( data != NULL )
+        g_GLStateCounters.uploaded_bytes += size;
+}
+
+void GLState_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+    glBufferSubData(target, offset, size, data);
+    g_GLStateCounters.uploads += 1;
+    g_GLStateCounters.uploaded_bytes += size;
+}
+
+// Substitui todo o conteúdo do buffer de uniforms "buffer", a menos que os
+// dados sejam iguais aos do último envio.
+void GLState_UniformBufferData(GLuint buffer, const void* data, size_t size)
+{
+    std::vector<unsigned char>& shadow = g_GLStateUniformBuffers[buffer];
+    if ( shadow.size() == size && std::memcmp(shadow.data(), data, size) == 0 )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    shadow.assign((const unsigned char*)data, (const unsigned char*)data + size);
+
+    GLState_BindBuffer(GL_UNIFORM_BUFFER, buffer);
+    GLState_BufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+}
+
+// glUniform2f() no programa atual, a menos que o valor não tenha mudado
+void GLState_Uniform2f(GLint location, float x, float y)
+{
+    std::vector<float>& shadow = g_GLStateUniforms[std::make_pair(g_GLState.program, location)];
+    if ( shadow.size() == 2 && shadow[0] == x && shadow[1] == y )
+    {
+        g_GLStateCounters.skipped_calls += 1;
+        return;
+    }
+    shadow.resize(2);
+    shadow[0] = x;
+    shadow[1] = y;
+
+    glUniform2f(location, x, y);
+    g_GLStateCounters.uploads += 1;
+    g_GLStateCounters.uploaded_bytes += 2 * sizeof(float);
+}
+
+void GLState_DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    glDrawArrays(mode, first, count);
+    g_GLStateCounters.draw_calls += 1;
+}
+
+void GLState_DrawElements(GLenum mode, GLsizei count, GLenum type, const void* offset)
+{
+    glDrawElements(mode, count, type, offset);
+    g_GLStateCounters.draw_calls += 1;
+}
+
+void GLState_MultiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* offsets, GLsizei draw_count)
+{
+    glMultiDrawElements(mode, counts, type, offsets, draw_count);
+    g_GLStateCounters.draw_calls += 1;
+}
+
+void GLState_DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* offset, GLsizei instance_count)
+{
+    glDrawElementsInstanced(mode, count, type, offset, instance_count);
+    g_GLStateCounters.draw_calls += 1;
+}
+
+#endif // _GLSTATE_H
+// vim: set spell spelllang=pt_br :
@@ -0,0 +1,90 @@
+#ifndef _INPUTQUEUE_H
+#define _INPUTQUEUE_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Headers abaixo são específicos de C++
+#include <atomic>
+
+// Fila de eventos de entrada com o instante (glfwGetTime()) em que cada um
+// aconteceu. As funções de callback da GLFW (veja KeyCallback(),
+// MouseButtonCallback() e CursorPosCallback() em main.cpp) só colocam
+// eventos na fila; o laço principal os consome em ordem, no início de cada
+// quadro (veja ProcessInputEvents()). Assim, cliques rápidos entre dois
+// quadros não se perdem e teclas seguradas durante só parte de um quadro
+// movem a câmera só por essa parte.
+//
+// A fila é um buffer circular sem travas para um produtor e um consumidor:
+// só as callbacks escrevem em "head" e só o consumidor escreve em "tail".
+
+enum InputEventType
+{
+    INPUT_EVENT_KEY,          // code: tecla GLFW_KEY_*, action: GLFW_PRESS/GLFW_RELEASE
+    INPUT_EVENT_MOUSE_BUTTON, // code: botão GLFW_MOUSE_BUTTON_*, action: idem
+    INPUT_EVENT_CURSOR_POS    // x, y: nova posição do cursor
+};
+
+struct InputEvent
+{
+    double         time;
+    InputEventType type;
+    int            code;
+    int            action;
+    double         x, y;
+};
+
+const int INPUT_QUEUE_SIZE = 1024;
+
+struct InputQueue
+{
+    InputEvent          events[INPUT_QUEUE_SIZE];
+    std::atomic<size_t> head;    // Eventos colocados na fila
+    std::atomic<size_t> tail;    // Eventos consumidos
+    size_t              dropped; // Eventos descartados com a fila cheia
+};
+
+InputQueue g_InputQueue;
+
+// Coloca um evento na fila. Retorna false (e descarta o evento) se a fila
+// estiver cheia, o que só acontece se o laço principal parar de consumi-la.
+bool InputQueue_Push(const InputEvent& event)
+{
+    size_t head = g_InputQueue.head.load(std::memory_order_relaxed);
+    if ( head - g_InputQueue.tail.load(std::memory_order_acquire) >= (size_t)INPUT_QUEUE_SIZE )
+    {
+        g_InputQueue.dropped += 1;
+        return false;
+    }
+
+    g_InputQueue.events[head % INPUT_QUEUE_SIZE] = event;
+    g_InputQueue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Copia o evento mais antigo da fila sem retirá-lo. Retorna false se ela
+// estiver vazia.
+bool InputQueue_Peek(InputEvent* event)
+{
+    size_t tail = g_InputQueue.tail.load(std::memory_order_relaxed);
+    if ( tail == g_InputQueue.head.load(std::memory_order_acquire) )
+        return false;
+
+    *event = g_InputQueue.events[tail % INPUT_QUEUE_SIZE];
+    return true;
+}
+
+// Retira o evento mais antigo da fila. Retorna false se ela estiver vazia.
+bool InputQueue_Pop(InputEvent* event)
+{
+    size_t tail = g_InputQueue.tail.load(std::memory_order_relaxed);
+    if ( tail == g_InputQueue.head.load(std::memory_order_acquire) )
+        return false;
+
+    *event = g_InputQueue.events[tail % INPUT_QUEUE_SIZE];
+    g_InputQueue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+#endif // _INPUTQUEUE_H
+// vim: set spell spelllang=pt_br :
@@ -9,6 +9,9 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 
 // Headers abaixo são específicos de C++
 #include <map>
@@ -33,6 +36,7 @@
 #include <glm/mat4x4.hpp>
 #include <glm/vec4.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 
 // Headers da biblioteca para carregar modelos obj
 #include <tiny_obj_loader.h>
@@ -47,10 +51,25 @@
 #include "utils.h"
 #include "matrices.h"
 #include "collisions.hpp"
+#include "frustumCulling.hpp"
+#include "meshSimplification.hpp"
+#include "meshOptimization.hpp"
+#include "glState.hpp"
+#include "trace.hpp"
+#include "profiling.hpp"
+#include "flightRecorder.hpp"
+#include "framePacing.hpp"
+#include "inputQueue.hpp"
+#include "dynamicResolution.hpp"
+#include "bakedTexture.hpp"
+#include "assetLoader.hpp"
+#include "meshCache.hpp"
+#include "resourceManager.hpp"
 // Estrutura que representa um modelo geométrico carregado a partir de um
 // arquivo ".obj". Veja https://en.wikipedia.org/wiki/Wavefront_.obj_file .
 struct ObjModel
 {
+    std::string                       filename; // Arquivo de origem, para mensagens
     tinyobj::attrib_t                 attrib;
     std::vector<tinyobj::shape_t>     shapes;
     std::vector<tinyobj::material_t>  materials;
@@ -59,7 +78,10 @@ struct ObjModel
     // Veja: https://github.com/syoyo/tinyobjloader
     ObjModel(const char* filename, const char* basepath = NULL, bool triangulate = true)
     {
+        TraceScope trace("ObjModel", filename);
+
         printf("Carregando objetos do arquivo \"%s\"...\n", filename);
+        this->filename = filename;
 
         // Se basepath == NULL, então setamos basepath como o dirname do
         // filename, para que os arquivos MTL sejam corretamente carregados caso
@@ -105,6 +127,20 @@ struct ObjModel
     }
 };
 
+// Imagem de textura lida do disco pela função DecodeTextureImage(), ainda na
+// memória da CPU. Pode ser lida em uma thread auxiliar (veja
+// "assetLoader.hpp") e depois enviada à GPU por LoadTextureImage().
+struct TextureImage
+{
+    std::string    filename;
+    uint64_t       content_hash; // Hash do arquivo, para o gerenciador de recursos
+    bool           is_baked;  // Versão pré-assada (veja "bakedTexture.hpp"), com mipmaps...
+    BakedTexture   baked;
+    unsigned char* data;      // ... ou decodificada por stb_image, só o nível 0
+    int            width;
+    int            height;
+};
+
 
 // Declaração de funções utilizadas para pilha de matrizes de modelagem.
 void PushMatrix(glm::mat4 M);
@@ -112,14 +148,28 @@ void PopMatrix(glm::mat4& M);
 
 // Declaração de várias funções utilizadas em main().  Essas estão definidas
 // logo após a definição de main() neste arquivo.
-void BuildTrianglesAndAddToVirtualScene(ObjModel*); // Constrói representação de um ObjModel como malha de triângulos para renderização
+int BuildTrianglesAndAddToVirtualScene(ObjModel*, const char* filename); // Constrói representação de um ObjModel como malha de triângulos para renderização
+void BuildMeshData(ObjModel* model, MeshData* mesh, bool planar_texcoords = false); // Processa os triângulos de um ObjModel, sem usar OpenGL
+void LoadMesh(const char* filename, MeshData* mesh, bool planar_texcoords = false); // Lê um modelo do cache (veja "meshCache.hpp") ou do ".obj", sem usar OpenGL
+int AddMeshToVirtualScene(const MeshData& mesh); // Envia um modelo processado para a GPU, retornando o handle do recurso
+void RemoveVertexArrayFromVirtualScene(GLuint vertex_array_object_id); // Esvazia os objetos de um modelo descarregado
+void AddMergedObjectToVirtualScene(const char* merged_name, const char* const* object_names, int count); // Combina vários objetos de um mesmo modelo em um só
+void RebuildMergedObjects(GLuint vertex_array_object_id); // Refaz os objetos combinados de um modelo carregado de novo
 void ComputeNormals(ObjModel* model); // Computa normais de um ObjModel, caso não existam.
 void LoadShadersFromFiles(); // Carrega os shaders de vértice e fragmento, criando um programa de GPU
-void LoadTextureImage(const char* filename); // Função que carrega imagens de textura
-void DrawVirtualObject(const char* object_name); // Desenha um objeto armazenado em g_VirtualScene
-GLuint LoadShader_Vertex(const char* filename);   // Carrega um vertex shader
-GLuint LoadShader_Fragment(const char* filename); // Carrega um fragment shader
-void LoadShader(const char* filename, GLuint shader_id); // Função utilizada pelas duas acima
+void DecodeTextureImage(const char* filename, TextureImage* image); // Lê uma imagem de textura do disco, sem usar OpenGL
+int LoadTextureImage(TextureImage* image); // Função que carrega imagens de textura
+int LoadTextureImageArray(TextureImage* images, int count); // Carrega várias imagens como camadas de uma única textura
+int SubmitTextureImage(const char* filename, TextureImage* image); // Pede a leitura de uma imagem em uma thread auxiliar
+int SubmitMesh(const char* filename, MeshData* mesh, bool planar_texcoords = false); // Pede a leitura de um modelo (LoadMesh()) em uma thread auxiliar
+void DrawLoadingScreen(GLFWwindow* window); // Desenha a tela de carregamento
+int GetVirtualObjectHandle(const char* object_name); // Busca o handle de um objeto pelo nome
+void DrawVirtualObject(int object, glm::mat4 model, int object_id); // Coloca um objeto de g_VirtualScene na fila de renderização
+void DrawVirtualObject(const char* object_name, glm::mat4 model, int object_id); // Idem, buscando o objeto pelo nome
+GLuint LoadShader_Vertex(const char* filename, const char* defines = "");   // Carrega um vertex shader
+GLuint LoadShader_Fragment(const char* filename, const char* defines = ""); // Carrega um fragment shader
+void LoadShader(const char* filename, GLuint shader_id, const char* defines); // Função utilizada pelas duas acima
+GLuint LoadGpuProgram(const char* vertex_filename, const char* fragment_filename, const char* defines); // Carrega (ou reaproveita) um programa de GPU
 GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id); // Cria um programa de GPU
 void PrintObjModelInfo(ObjModel*); // Função para debugging
 
@@ -129,6 +179,8 @@ void TextRendering_Init();
 float TextRendering_LineHeight(GLFWwindow* window);
 float TextRendering_CharWidth(GLFWwindow* window);
 void TextRendering_PrintString(GLFWwindow* window, const std::string &str, float x, float y, float scale = 1.0f);
+void TextRendering_Flush(GLFWwindow* window);
+void TextRendering_PrintBarGraph(GLFWwindow* window, const float* values, int count, float x, float y, float width, float height, float max_value);
 void TextRendering_PrintMatrix(GLFWwindow* window, glm::mat4 M, float x, float y, float scale = 1.0f);
 void TextRendering_PrintVector(GLFWwindow* window, glm::vec4 v, float x, float y, float scale = 1.0f);
 void TextRendering_PrintMatrixVectorProduct(GLFWwindow* window, glm::mat4 M, glm::vec4 v, float x, float y, float scale = 1.0f);
@@ -140,6 +192,10 @@ void TextRendering_PrintMatrixVectorProductDivW(GLFWwindow* window, glm::mat4 M,
 void TextRendering_ShowModelViewProjection(GLFWwindow* window, glm::mat4 projection, glm::mat4 view, glm::mat4 model, glm::vec4 p_model);
 void TextRendering_ShowProjection(GLFWwindow* window);
 void TextRendering_ShowFramesPerSecond(GLFWwindow* window);
+void TextRendering_ShowCullingStats(GLFWwindow* window);
+void TextRendering_ShowRenderStats(GLFWwindow* window);
+void TextRendering_ShowFrameTimes(GLFWwindow* window);
+void TextRendering_ShowWeaponLoading(GLFWwindow* window);
 
 // Funções callback para comunicação com o sistema operacional e interação do
 // usuário. Veja mais comentários nas definições das mesmas, abaixo.
@@ -149,6 +205,24 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void CursorPosCallback(GLFWwindow* window, double xpos, double ypos);
 void ScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
+void ProcessInputEvents(double until); // Consome, em ordem, os eventos de entrada até o instante "until"
+void ProcessCursorEvents(double until); // Idem, só os movimentos do cursor no início da fila
+
+// Número de níveis de detalhe (LODs) de cada objeto. O nível 0 é a malha
+// original; cada nível seguinte tem cerca de metade dos triângulos do
+// anterior. Veja BuildTrianglesAndAddToVirtualScene() e SelectLevelOfDetail().
+#define NUM_LODS 4
+
+// Parte de um objeto da cena virtual: uma faixa contígua do vetor indices[]
+// por nível de detalhe, com a sua própria AABB, testada individualmente
+// contra o frustum da câmera.
+struct SceneObjectPart
+{
+    size_t       first_index[NUM_LODS];
+    size_t       num_indices[NUM_LODS];
+    glm::vec3    bbox_min;
+    glm::vec3    bbox_max;
+};
 
 // Definimos uma estrutura que armazenará dados necessários para renderizar
 // cada objeto da cena virtual.
@@ -159,17 +233,41 @@ struct SceneObject
     size_t       num_indices; // Número de índices do objeto dentro do vetor indices[] definido em BuildTrianglesAndAddToVirtualScene()
     GLenum       rendering_mode; // Modo de rasterização (GL_TRIANGLES, GL_TRIANGLE_STRIP, etc.)
     GLuint       vertex_array_object_id; // ID do VAO onde estão armazenados os atributos do modelo
+    GLenum       index_type; // GL_UNSIGNED_SHORT ou GL_UNSIGNED_INT, conforme o número de vértices do modelo
     glm::vec3    bbox_min; // Axis-Aligned Bounding Box do objeto
     glm::vec3    bbox_max;
+    int          material_id; // Material (tinyobj) da primeira face do objeto, -1 se não houver
+
+    // Partes do objeto, ordenadas por first_index[0]. Objetos construídos por
+    // BuildTrianglesAndAddToVirtualScene() têm uma única parte; objetos
+    // combinados (veja AddMergedObjectToVirtualScene()) têm uma por objeto
+    // original.
+    std::vector<SceneObjectPart> parts;
 };
 
 // Abaixo definimos variáveis globais utilizadas em várias funções do código.
 
-// A cena virtual é uma lista de objetos nomeados, guardados em um dicionário
-// (map).  Veja dentro da função BuildTrianglesAndAddToVirtualScene() como que são incluídos
-// objetos dentro da variável g_VirtualScene, e veja na função main() como
-// estes são acessados.
-std::map<std::string, SceneObject> g_VirtualScene;
+// A cena virtual é uma lista de objetos, acessados por um handle (índice no
+// vetor g_VirtualScene). O dicionário (map) g_VirtualSceneHandles traduz o
+// nome de um objeto para o seu handle; ele só é consultado durante o
+// carregamento, e não a cada quadro. Veja dentro da função
+// AddObjectToVirtualScene() como que são incluídos objetos dentro da variável
+// g_VirtualScene, e veja na função main() como estes são acessados.
+std::vector<SceneObject>   g_VirtualScene;
+std::map<std::string, int> g_VirtualSceneHandles;
+
+// Objetos combinados já criados por AddMergedObjectToVirtualScene(), com os
+// nomes das suas partes, para que sejam refeitos quando o modelo deles for
+// descarregado e carregado de novo (veja RebuildMergedObjects()).
+struct MergedObject
+{
+    std::string              name;
+    std::vector<std::string> object_names;
+};
+std::vector<MergedObject> g_MergedObjects;
+
+int AddObjectToVirtualScene(const SceneObject& object); // Registra um objeto na cena virtual e retorna seu handle
+void UpdateObjectUniforms(const glm::mat4& model, int object_id, const SceneObject& object); // Envia os dados do objeto desenhado
 
 // Pilha que guardará as matrizes de modelagem.
 std::stack<glm::mat4>  g_MatrixStack;
@@ -196,17 +294,88 @@ bool g_UsePerspectiveProjection = true;
 // Variável que controla se o texto informativo será mostrado na tela.
 bool g_ShowInfoText = true;
 
-// Variáveis que definem um programa de GPU (shaders). Veja função LoadShadersFromFiles().
-GLuint g_GpuProgramID = 0;
-GLint g_model_uniform;
-GLint g_view_uniform;
-GLint g_projection_uniform;
-GLint g_object_id_uniform;
-GLint g_bbox_min_uniform;
-GLint g_bbox_max_uniform;
+// Materiais: cada um é desenhado por uma variante própria do programa de GPU,
+// compilada a partir de "shader_vertex.glsl" e "shader_fragment.glsl" com o
+// #define correspondente. Veja função LoadShadersFromFiles().
+enum Material
+{
+    MATERIAL_SPHERE,
+    MATERIAL_BALL,
+    MATERIAL_GUN,
+    MATERIAL_TABLE_TOP,
+    MATERIAL_BRICK_ROOM,
+    MATERIAL_AK47,
+    MATERIAL_UNKNOWN,
+    NUM_MATERIALS
+};
+
+// Programas de GPU já compilados, indexados pelos arquivos GLSL e #defines
+// usados na compilação. Veja função LoadGpuProgram().
+std::map<std::string, GLuint> g_GpuProgramCache;
+
+// Variáveis que definem os programas de GPU (shaders) de cada material.
+GLuint g_MaterialPrograms[NUM_MATERIALS];
+
+Material MaterialFromObjectId(int object_id); // Material usado para desenhar um object_id
+void UseMaterial(Material material); // Ativa o programa de GPU do material
 
-// Número de texturas carregadas pela função LoadTextureImage()
-GLuint g_NumLoadedTextures = 0;
+// Frustum da câmera no quadro atual, usado para descartar objetos que não
+// aparecem na tela antes de enviá-los para a GPU. Veja DrawVirtualObject().
+// Com o late latch, é alargado enquanto a fila de renderização é montada e
+// extraído de novo, da câmera final, antes de desenhar as esferas.
+Frustum g_ViewFrustum;
+
+// Número de objetos (ou partes de objetos, ou esferas) desenhados e
+// descartados pelo teste de frustum no quadro atual.
+int g_NumDrawnObjects = 0;
+int g_NumCulledObjects = 0;
+
+// Fator de escala da projeção no quadro atual (elemento [1][1] da matriz),
+// usado para estimar o tamanho na tela dos objetos. Veja SelectLevelOfDetail().
+float g_ProjectionScale = 1.0f;
+
+// Tamanho mínimo na tela (raio projetado, como fração de metade da altura da
+// janela) para que cada nível de detalhe seja usado.
+const float g_LodScreenSizes[NUM_LODS - 1] = { 0.15f, 0.06f, 0.02f };
+
+int SelectLevelOfDetail(const glm::vec3& center, float radius); // Escolhe o nível de detalhe pelo tamanho na tela
+
+// Blocos "FrameUniforms" e "ObjectUniforms" de "shader_vertex.glsl" e
+// "shader_fragment.glsl". As structs abaixo seguem o layout std140: só
+// contêm mat4, vec4 e ivec4, então não há preenchimento entre os campos.
+struct FrameUniforms
+{
+    glm::mat4  view;
+    glm::mat4  projection;
+    glm::vec4  camera_position;
+    glm::vec4  light_direction;         // Luz do modelo de Phong (fragment shader)
+    glm::vec4  gouraud_light_direction; // Luz do modelo de Gouraud (vertex shader)
+};
+
+struct ObjectUniforms
+{
+    glm::mat4  model;
+    glm::mat4  normal_matrix; // inverse(transpose(model))
+    glm::vec4  bbox_min;
+    glm::vec4  bbox_max;
+    glm::ivec4 material;      // x = object_id
+};
+
+#define FRAME_UNIFORMS_BINDING  0
+#define OBJECT_UNIFORMS_BINDING 1
+
+GLuint g_FrameUniformBufferId = 0;
+GLuint g_ObjectUniformBufferId = 0;
+
+void CreateUniformBuffers(); // Cria os buffers dos blocos de uniforms
+void UpdateFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec4& camera_position); // Envia os dados do quadro
+
+// Textura de cada material: handle no gerenciador de recursos (veja
+// "resourceManager.hpp"), ou -1 se o material ainda não tem textura. Cada
+// handle guardado aqui conta como uma referência à textura.
+int g_MaterialTextures[NUM_MATERIALS] = { -1, -1, -1, -1, -1, -1, -1 };
+
+void UpdateMaterialTextureUnits(); // Aponta o sampler de cada material para a unidade da sua textura
 
 // New classes
 class PhysicsObject;
@@ -220,7 +389,6 @@ int global_Text_Line;
 float g_encacapada_anim_speed = 1.0f;
 float collision_t;
 
-bool g_TapFlag = false;
 bool g_FreeCamera = true;
 
 glm::vec4 g_LookAt_Coords;
@@ -259,7 +427,35 @@ glm::vec4 player_dim =      glm::vec4(0.1f, 1.75f, 0.1f, 0.0f);
 glm::vec4 table_coords =    glm::vec4((xPlusBound + xMinusBound)/2, 0.0f, (zPlusBound + zMinusBound)/2, 1.0f);
 glm::vec4 table_dim =       glm::vec4(xPlusBound, 1.0f, zPlusBound + 0.0f, 0.0f);
 
-bool w_held, a_held, s_held, d_held, shift_held, ctrl_held = false;
+// Teclas de movimento da câmera livre. g_MoveKeyHeld diz se cada tecla está
+// pressionada e g_MoveKeyTime por quantos segundos ela ficou pressionada
+// desde que o movimento foi aplicado pela última vez. Veja ProcessInputEvents().
+enum MoveKey
+{
+    MOVE_FORWARD,  // W
+    MOVE_BACKWARD, // S
+    MOVE_LEFT,     // A
+    MOVE_RIGHT,    // D
+    MOVE_UP,       // Shift
+    MOVE_DOWN,     // Ctrl
+    NUM_MOVE_KEYS
+};
+bool   g_MoveKeyHeld[NUM_MOVE_KEYS] = {};
+float  g_MoveKeyTime[NUM_MOVE_KEYS] = {};
+double g_InputTime = 0.0; // Instante até o qual a entrada já foi processada
+
+// Tiros pedidos e ainda não disparados, cada um com a posição e a direção da
+// câmera no instante do pedido (o clique, para a pistola). Vários cliques
+// entre dois quadros geram vários tiros.
+struct ShotRequest
+{
+    glm::vec4 origin;
+    glm::vec4 direction;
+};
+std::vector<ShotRequest> g_PendingShots;
+bool g_LeftMouseClicked = false; // Clique desde o último quadro (para o fuzil)
+
+void QueueShot(); // Pede um tiro na direção atual da câmera
 
 float walk_speed = 2.0f;
 bool opening_shot = true;
@@ -267,11 +463,163 @@ float opening_multiplier = 5.0f;
 
 int gunType = 0;
 
+// Armas carregadas sob demanda: o modelo e a textura de uma arma só são
+// lidos, em uma thread auxiliar (veja "assetLoader.hpp"), quando ela é
+// escolhida pela primeira vez, ou logo após o carregamento inicial com
+// "--prefetch-weapons". Enquanto isso, o jogador continua com a arma
+// anterior. Veja SelectGun() e UpdateWeaponLoading().
+enum WeaponLoadState
+{
+    WEAPON_UNLOADED,
+    WEAPON_LOADING,
+    WEAPON_READY,
+    WEAPON_FAILED
+};
+
+struct LazyWeapon
+{
+    int                gun_type;         // Valor de gunType que seleciona a arma
+    const char*        model_filename;
+    const char*        texture_filename;
+    const char*        object_name;      // Objeto combinado das partes (veja AddMergedObjectToVirtualScene())
+    const char* const* part_names;
+    int                num_parts;
+    Material           material;
+    bool               planar_texcoords; // Veja BuildMeshData()
+
+    WeaponLoadState    state;
+    int                model_job;
+    int                texture_job;
+    bool               texture_uploaded;
+    double             request_time;     // Para a mensagem de tempo de carregamento
+    TextureImage       image;
+    MeshData           mesh;
+    int                mesh_resource;    // Handle no gerenciador de recursos, quando WEAPON_READY
+    int                object;           // Handle em g_VirtualScene, quando WEAPON_READY
+};
+
+// Partes da AK-47 que são sempre desenhadas juntas (e com o mesmo material)
+const char* const AK47_PARTS[] = {
+    "magazine_low_0",
+    "stock_low_0",
+    "rear_sight_low_0",
+    "pistolstock_low_0",
+    "upperreceiver_low_0",
+    "barrel_element_low_0",
+    "front_sight_big_cylinder_low_0",
+    "rear_sight_screw_low_0",
+    "safetyswitchscrew_low_0",
+    "safetyswitch_low_0",
+    "rear_sight_element_b_low_0",
+    "rear_sight_element_a_low_0",
+    "swivel_low_0",
+    "bolt_carrier_low_0",
+    "receiver_low_0",
+    "rear_sight_leaf_low_0",
+    "trigger_low_0",
+    "spring_low_0",
+    "rear_sight_switch_knob_low_0",
+    "rear_sight_switch_low_0",
+    "sylinder_low_0",
+    "barrel_cylinder_low_0",
+    "front_sight_needle_low_0",
+    "stock_element_low_0",
+    "front_sight_cylinder_low_0",
+    "rear_sight_element_screw_low_0",
+    "receiver_screws_low_0",
+    "rear_sight_cylinder_low_0",
+    "triggerguard_screws_low_0",
+    "triggerguard_low_0",
+    "magazine_catch_low_0",
+    "muzzlebreak_low_0",
+    "stock_screws_low_0",
+    "barrel_low_0",
+    "triggerguard_upper_low_0",
+    "gas_block_low_0",
+    "gas_cylinder_low_0",
+    "handguard_low_0",
+    "element_rear_sight_low_0",
+    "handguard_upper_low_0",
+    "handguardmetal_low_0",
+    "front_sight_low_0",
+    "polySurface228_0",
+    "polySurface229_0",
+};
+
+LazyWeapon g_LazyWeapons[] = {
+    { 1, "../../data/ak-47/ak-47.obj", "../../data/ak-47/mat0_c.jpeg", "ak47", AK47_PARTS, 44, MATERIAL_AK47, true, WEAPON_UNLOADED },
+};
+const int NUM_LAZY_WEAPONS = sizeof(g_LazyWeapons) / sizeof(g_LazyWeapons[0]);
+
+// Arma escolhida pelo jogador que ainda está sendo carregada, ou -1
+int g_PendingGunType = -1;
+
+LazyWeapon* FindLazyWeapon(int gun_type); // Arma carregada sob demanda com esse gunType, ou NULL
+void RequestWeapon(LazyWeapon* weapon); // Pede a leitura do modelo e da textura de uma arma, se ainda não pedida
+void SelectGun(int gun_type); // Troca de arma, carregando-a antes se preciso
+void UpdateWeaponLoading(); // Envia à GPU, a cada quadro, o que as threads auxiliares já leram
+void UnloadWeapons(); // Solta os recursos das armas carregadas sob demanda
+
+// Modo "--benchmark N": janela invisível, passo de tempo fixo e câmera e
+// tiros seguindo um roteiro (veja BenchmarkScript()) por N quadros, ao fim
+// dos quais é impresso um relatório (veja "profiling.hpp").
+int g_BenchmarkFrames = 0; // 0 fora do modo benchmark
+const float g_BenchmarkTimestep = 1.0f / 60.0f;
+
+void BenchmarkScript(int frame); // Posiciona a câmera e dispara os tiros do quadro "frame" do benchmark
+
+void UpdateCameraCoords(); // Calcula a posição e o ponto de mira da câmera a partir dos ângulos atuais
+glm::mat4 GunModelMatrix(); // Matriz de modelagem da arma atual, presa à câmera
+
 //New functions
 
 //DRAWING SPHERES
 void DrawSphere(glm::vec4 position, float radius, int index);
 void DrawSphereCoords(int x, int y, int z, float radius);
+
+// Instanced spheres: every sphere drawn in a frame (balls, crosshair, markers)
+// is queued as one instance. The whole queue is uploaded once and drawn with
+// one glDrawElementsInstanced() call per material and LOD. See DrawSphereInstances().
+struct SphereInstance
+{
+    glm::mat4 model;     // "instance_model" em "shader_vertex.glsl"
+    GLint     object_id; // "instance_object_id" em "shader_vertex.glsl"
+};
+std::vector<SphereInstance> g_SphereInstances;
+GLuint g_SphereInstanceBufferId = 0;
+int    g_SphereInstanceObject = -1; // Handle do objeto desenhado por DrawSphereInstances()
+
+void CreateSphereInstanceBuffer(int object); // Adiciona os atributos por instância ao VAO do objeto
+void SetSphereInstanceAttributes(GLintptr first_byte); // Aponta os atributos por instância para uma posição do buffer
+void QueueSphereInstance(glm::mat4 model, int object_id); // Adiciona uma esfera ao lote do quadro atual
+void DrawSphereInstances(); // Envia o lote de esferas do quadro em uma única chamada
+
+// Fila de renderização do quadro. DrawVirtualObject() apenas descarta as
+// partes fora do frustum, escolhe o nível de detalhe e registra o desenho;
+// SubmitRenderQueue() ordena os registros pela chave (veja RenderSortKey())
+// e só então chama a GPU, com os desenhos de um mesmo programa e VAO juntos.
+struct RenderItem
+{
+    glm::mat4  model;
+    int        object;      // Handle do objeto em g_VirtualScene
+    int        object_id;
+    size_t     first_range; // Faixas de índices em g_RenderQueueCounts e g_RenderQueueOffsets
+    size_t     num_ranges;
+};
+struct RenderQueueEntry
+{
+    uint64_t   sort_key;
+    size_t     item;        // Índice em g_RenderQueueItems
+
+    bool operator<(const RenderQueueEntry& other) const { return sort_key < other.sort_key; }
+};
+std::vector<RenderItem>       g_RenderQueueItems;
+std::vector<RenderQueueEntry> g_RenderQueue;
+std::vector<GLsizei>          g_RenderQueueCounts;
+std::vector<const GLvoid*>    g_RenderQueueOffsets;
+
+uint64_t RenderSortKey(GLuint program_id, GLuint vertex_array_object_id, float depth); // Chave de ordenação de um desenho
+void SubmitRenderQueue(); // Desenha, em ordem, tudo o que foi colocado na fila do quadro
 // Time
 float ellapsed_time();
 
@@ -324,14 +672,12 @@ class PhysicsObject {
         movement_vector = glm::vec4(x, y, z, 0.0f);
     }
 
+    // Only queues the ball; the actual draw happens in DrawSphereInstances()
     void draw(){
             glm::mat4 model = Matrix_Translate(position.x, position.y, position.z) 
                 * Matrix_Scale(radius, radius, radius)
                 * rotation_matrix;
-            glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-            glUniform1i(g_object_id_uniform, (index % 15) + 10);
-            DrawVirtualObject("the_sphere");
-            
+            QueueSphereInstance(model, (index % 15) + 10);
     }
 
     void advance_time(float dt){
@@ -492,6 +838,133 @@ class PhysicsObject {
 
 int main(int argc, char* argv[])
 {
+    // "./main [--benchmark N] [--trace arquivo.json] [--hitch-budget MS]
+    //        [--swap-interval 0|1|adaptive] [--fps-limit N] [--no-late-latch]
+    //        [--target-frame-ms MS] [--resource-budget-mb MB]
+    //        [--prefetch-weapons] [modelo.obj]"
+    bool prefetch_weapons = false;
+    const char* trace_filename = NULL;
+    int model_argument = 1;
+    while ( argc > model_argument && std::strncmp(argv[model_argument], "--", 2) == 0 )
+    {
+        const char* option = argv[model_argument];
+        const char* value  = (argc > model_argument + 1) ? argv[model_argument + 1] : NULL;
+        model_argument += 1;
+
+        if ( std::strcmp(option, "--no-late-latch") == 0 )
+        {
+            g_FramePacing.late_latch = false;
+            continue;
+        }
+        if ( std::strcmp(option, "--prefetch-weapons") == 0 )
+        {
+            // Lê as armas em segundo plano logo após o carregamento inicial,
+            // em vez de na primeira vez em que são escolhidas
+            prefetch_weapons = true;
+            continue;
+        }
+
+        // As demais opções têm um argumento
+        if ( value == NULL )
+        {
+            fprintf(stderr, "ERROR: Option \"%s\" needs an argument.\n", option);
+            std::exit(EXIT_FAILURE);
+        }
+        model_argument += 1;
+
+        if ( std::strcmp(option, "--benchmark") == 0 )
+        {
+            g_BenchmarkFrames = std::atoi(value);
+            if ( g_BenchmarkFrames <= 0 )
+            {
+                fprintf(stderr, "ERROR: --benchmark needs a positive number of frames.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if ( std::strcmp(option, "--trace") == 0 )
+        {
+            // Inicialização e quadros gravados em formato Chrome Trace (veja "trace.hpp")
+            trace_filename = value;
+        }
+        else if ( std::strcmp(option, "--hitch-budget") == 0 )
+        {
+            // Quadros mais lentos que MS milissegundos geram um registro dos
+            // quadros em volta (veja "flightRecorder.hpp")
+            g_FlightRecorder.budget_ms = (float)std::atof(value);
+            if ( g_FlightRecorder.budget_ms <= 0.0f )
+            {
+                fprintf(stderr, "ERROR: --hitch-budget needs a positive number of milliseconds.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if ( std::strcmp(option, "--swap-interval") == 0 )
+        {
+            if ( !FramePacing_ParseSwapInterval(value) )
+            {
+                fprintf(stderr, "ERROR: --swap-interval must be 0, 1 or adaptive.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if ( std::strcmp(option, "--target-frame-ms") == 0 )
+        {
+            // Tempo alvo da resolução dinâmica; 0 desliga (veja "dynamicResolution.hpp")
+            g_DynamicResolution.target_ms = (float)std::atof(value);
+            if ( g_DynamicResolution.target_ms < 0.0f )
+            {
+                fprintf(stderr, "ERROR: --target-frame-ms needs a non-negative number of milliseconds.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else if ( std::strcmp(option, "--resource-budget-mb") == 0 )
+        {
+            // Memória de GPU a partir da qual texturas e modelos sem uso são
+            // descarregados; 0 desliga (veja "resourceManager.hpp")
+            double budget_mb = std::atof(value);
+            if ( budget_mb < 0.0 )
+            {
+                fprintf(stderr, "ERROR: --resource-budget-mb needs a non-negative number of megabytes.\n");
+                std::exit(EXIT_FAILURE);
+            }
+            g_Resources.budget_bytes = (size_t)(budget_mb * 1048576.0);
+        }
+        else if ( std::strcmp(option, "--fps-limit") == 0 )
+        {
+            g_FramePacing.fps_limit = std::atof(value);
+            if ( g_FramePacing.fps_limit <= 0.0 )
+            {
+                fprintf(stderr, "ERROR: --fps-limit needs a positive number of frames per second.\n");
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option \"%s\".\n", option);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // O benchmark não fica preso ao vsync, e a sua câmera vem só do roteiro.
+    // A resolução também é fixa, para que toda execução desenhe o mesmo.
+    if ( g_BenchmarkFrames > 0 )
+    {
+        g_FramePacing.swap_interval = 0;
+        g_FramePacing.late_latch = false;
+        g_DynamicResolution.target_ms = 0.0f;
+    }
+
+    // O trace só começa depois de lidas todas as opções, para que um erro
+    // nelas não deixe um arquivo incompleto
+    if ( trace_filename != NULL )
+    {
+        if ( !Trace_Start(trace_filename) )
+        {
+            fprintf(stderr, "ERROR: Cannot create trace file \"%s\".\n", trace_filename);
+            std::exit(EXIT_FAILURE);
+        }
+        Trace_SetThreadName("main");
+    }
+    Trace_Begin("startup");
+
     // Inicializamos a biblioteca GLFW, utilizada para criar uma janela do
     // sistema operacional, onde poderemos renderizar com OpenGL.
     int success = glfwInit();
@@ -516,6 +989,10 @@ int main(int argc, char* argv[])
     // funções modernas de OpenGL.
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    // O benchmark roda sem mostrar a janela (funciona também com Xvfb)
+    if ( g_BenchmarkFrames > 0 )
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
     // Criamos uma janela do sistema operacional, com 800 colunas e 600 linhas
     // de pixels, e com título "INF01047 ...".
     GLFWwindow* window;
@@ -540,10 +1017,16 @@ int main(int argc, char* argv[])
     // Indicamos que as chamadas OpenGL deverão renderizar nesta janela
     glfwMakeContextCurrent(window);
 
+    // Vsync conforme "--swap-interval" (veja "framePacing.hpp")
+    FramePacing_ApplySwapInterval();
+
     // Carregamento de todas funções definidas por OpenGL 3.3, utilizando a
     // biblioteca GLAD.
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
 
+    // Nenhum estado do OpenGL é conhecido ainda. Veja "glState.hpp".
+    GLState_Invalidate();
+
 
     // Hides cursor -> doesnt work for some reason
     glfwSetInputMode(window, GLFW_CURSOR , GLFW_CURSOR_DISABLED);
@@ -562,73 +1045,167 @@ int main(int argc, char* argv[])
 
     printf("GPU: %s, %s, OpenGL %s, GLSL %s\n", vendor, renderer, glversion, glslversion);
 
-    // Carregamos os shaders de vértices e de fragmentos que serão utilizados
-    // para renderização. Veja slides 180-200 do documento Aula_03_Rendering_Pipeline_Grafico.pdf.
-    //
-    LoadShadersFromFiles();
-
-    // Carregamos duas imagens para serem utilizadas como textura
-    LoadTextureImage("../../data/textures/P88_gloss.jpg"); // TextureTableTop:
-    LoadTextureImage("../../data/textures/pool table low_POOL TABLE_BaseColor.png"); // TexturePoolTable:
-    LoadTextureImage("../../data/textures/P88_gloss.jpg"); // TextureObjUnkown:
-
-    LoadTextureImage("../../data/textures/balls/BallCue.jpg"); // TextureCueBall:
-    LoadTextureImage("../../data/textures/balls/Ball1.jpg"); // TextureBall1:
-    LoadTextureImage("../../data/textures/balls/Ball2.jpg"); // TextureBall2:
-    LoadTextureImage("../../data/textures/balls/Ball3.jpg"); // TextureBall3:
-    LoadTextureImage("../../data/textures/balls/Ball4.jpg"); // TextureBall4:
-    LoadTextureImage("../../data/textures/balls/Ball5.jpg"); // TextureBall5:
-    LoadTextureImage("../../data/textures/balls/Ball6.jpg"); // TextureBall6:
-    LoadTextureImage("../../data/textures/balls/Ball7.jpg"); // TextureBall7:
-    LoadTextureImage("../../data/textures/balls/Ball8.jpg"); // TextureBall8:
-    LoadTextureImage("../../data/textures/balls/Ball9.jpg"); // TextureBall9:
-    LoadTextureImage("../../data/textures/balls/Ball10.jpg"); // TextureBall10:
-    LoadTextureImage("../../data/textures/balls/Ball11.jpg"); // TextureBall11:
-    LoadTextureImage("../../data/textures/balls/Ball12.jpg"); // TextureBall12:
-    LoadTextureImage("../../data/textures/balls/Ball13.jpg"); // TextureBall13:
-    LoadTextureImage("../../data/textures/balls/Ball14.jpg"); // TextureBall14:
-    LoadTextureImage("../../data/textures/balls/Ball15.jpg"); // TextureBall15:
-
-    LoadTextureImage("../../data/brick_room/material_diffuse.jpeg"); // BrickRoom:
-    LoadTextureImage("../../data/ak-47/mat0_c.jpeg"); // ak47:
-
-
-    // Construímos a representação de objetos geométricos através de malhas de triângulos
-    ObjModel spheremodel("../../data/sphere.obj");
-    ComputeNormals(&spheremodel);
-    BuildTrianglesAndAddToVirtualScene(&spheremodel);
-
-    ObjModel gunmodel("../../data/Gun.obj");
-    ComputeNormals(&gunmodel);
-    BuildTrianglesAndAddToVirtualScene(&gunmodel);
-
-    ObjModel tabletopmodel("../../data/POOL TABLE.obj");
-    ComputeNormals(&tabletopmodel);
-    BuildTrianglesAndAddToVirtualScene(&tabletopmodel);
-
-    ObjModel brickroommodel("../../data/brick_room/basement.obj");
-    ComputeNormals(&brickroommodel);
-    BuildTrianglesAndAddToVirtualScene(&brickroommodel);    
-
-    ObjModel ak47model("../../data/ak-47/ak-47.obj");
-    ComputeNormals(&ak47model);
-    BuildTrianglesAndAddToVirtualScene(&ak47model);  
+    // Inicializamos o código para renderização de texto, usado também pela
+    // tela de carregamento.
+    Trace_Begin("TextRendering_Init");
+    TextRendering_Init();
+    Trace_End("TextRendering_Init");
 
-    
-    if ( argc > 1 )
+    // As imagens e os modelos são lidos do disco em paralelo, por threads
+    // auxiliares (veja "assetLoader.hpp"), e enviados à GPU aqui, na ordem
+    // abaixo, conforme ficam prontos. Enquanto isso mostramos a tela de
+    // carregamento. A inversão das imagens é global em stb_image, então é
+    // configurada uma única vez, antes de as threads começarem.
+    stbi_set_flip_vertically_on_load(true);
+    AssetLoader_Start();
+    std::function<void()> draw_loading_screen = [window]() { DrawLoadingScreen(window); };
+
+    TextureImage table_top_image;
+    TextureImage pool_table_image;
+    TextureImage brick_room_image;
+    int table_top_texture_job  = SubmitTextureImage("../../data/textures/P88_gloss.jpg", &table_top_image);
+    int pool_table_texture_job = SubmitTextureImage("../../data/textures/pool table low_POOL TABLE_BaseColor.png", &pool_table_image);
+
+    // As 16 bolas ficam em uma única textura "array", indexada pelo número da
+    // bola (camada 0 = bola branca). Veja "TextureBalls" em shader_fragment.glsl.
+    const char* ball_textures[] = {
+        "../../data/textures/balls/BallCue.jpg",
+        "../../data/textures/balls/Ball1.jpg",
+        "../../data/textures/balls/Ball2.jpg",
+        "../../data/textures/balls/Ball3.jpg",
+        "../../data/textures/balls/Ball4.jpg",
+        "../../data/textures/balls/Ball5.jpg",
+        "../../data/textures/balls/Ball6.jpg",
+        "../../data/textures/balls/Ball7.jpg",
+        "../../data/textures/balls/Ball8.jpg",
+        "../../data/textures/balls/Ball9.jpg",
+        "../../data/textures/balls/Ball10.jpg",
+        "../../data/textures/balls/Ball11.jpg",
+        "../../data/textures/balls/Ball12.jpg",
+        "../../data/textures/balls/Ball13.jpg",
+        "../../data/textures/balls/Ball14.jpg",
+        "../../data/textures/balls/Ball15.jpg",
+    };
+    TextureImage ball_images[16];
+    int ball_jobs[16];
+    for (int i = 0; i < 16; ++i)
+        ball_jobs[i] = SubmitTextureImage(ball_textures[i], &ball_images[i]);
+
+    int brick_room_texture_job = SubmitTextureImage("../../data/brick_room/material_diffuse.jpeg", &brick_room_image);
+
+    MeshData spheremodel;
+    MeshData gunmodel;
+    MeshData tabletopmodel;
+    MeshData brickroommodel;
+    int sphere_model_job     = SubmitMesh("../../data/sphere.obj", &spheremodel);
+    int gun_model_job        = SubmitMesh("../../data/Gun.obj", &gunmodel);
+    int table_top_model_job  = SubmitMesh("../../data/POOL TABLE.obj", &tabletopmodel);
+    int brick_room_model_job = SubmitMesh("../../data/brick_room/basement.obj", &brickroommodel);
+
+    // Enquanto as threads trabalham, carregamos os shaders de vértices e de
+    // fragmentos que serão utilizados para renderização. Veja slides 180-200
+    // do documento Aula_03_Rendering_Pipeline_Grafico.pdf.
+    LoadShadersFromFiles();
+    CreateUniformBuffers();
+
+    // Texturas de cada material. Materiais com a mesma imagem compartilham a
+    // textura (e a unidade de textura), com uma referência cada.
+    AssetLoader_Wait(table_top_texture_job, draw_loading_screen);
+    g_MaterialTextures[MATERIAL_GUN] = LoadTextureImage(&table_top_image);
+    g_MaterialTextures[MATERIAL_UNKNOWN] = Resources_AddRef(g_MaterialTextures[MATERIAL_GUN]);
+    AssetLoader_Wait(pool_table_texture_job, draw_loading_screen);
+    g_MaterialTextures[MATERIAL_TABLE_TOP] = LoadTextureImage(&pool_table_image);
+
+    for (int i = 0; i < 16; ++i)
+        AssetLoader_Wait(ball_jobs[i], draw_loading_screen);
+    g_MaterialTextures[MATERIAL_BALL] = LoadTextureImageArray(ball_images, 16);
+
+    AssetLoader_Wait(brick_room_texture_job, draw_loading_screen);
+    g_MaterialTextures[MATERIAL_BRICK_ROOM] = LoadTextureImage(&brick_room_image);
+    g_MaterialTextures[MATERIAL_SPHERE] = Resources_AddRef(g_MaterialTextures[MATERIAL_BRICK_ROOM]);
+
+    UpdateMaterialTextureUnits();
+
+    // Construímos a representação de objetos geométricos através de malhas
+    // de triângulos. Guardamos uma referência a cada modelo até o fim.
+    g_Resources.on_mesh_evicted = RemoveVertexArrayFromVirtualScene;
+    std::vector<int> mesh_resources;
+
+    AssetLoader_Wait(sphere_model_job, draw_loading_screen);
+    mesh_resources.push_back(AddMeshToVirtualScene(spheremodel));
+    CreateSphereInstanceBuffer(GetVirtualObjectHandle("the_sphere"));
+    MeshData_Free(&spheremodel);
+
+    AssetLoader_Wait(gun_model_job, draw_loading_screen);
+    mesh_resources.push_back(AddMeshToVirtualScene(gunmodel));
+    MeshData_Free(&gunmodel);
+
+    AssetLoader_Wait(table_top_model_job, draw_loading_screen);
+    mesh_resources.push_back(AddMeshToVirtualScene(tabletopmodel));
+    MeshData_Free(&tabletopmodel);
+
+    AssetLoader_Wait(brick_room_model_job, draw_loading_screen);
+    mesh_resources.push_back(AddMeshToVirtualScene(brickroommodel));
+    MeshData_Free(&brickroommodel);
+
+    // As threads auxiliares continuam disponíveis para as armas carregadas
+    // sob demanda (veja SelectGun()), e são terminadas no fim do programa
+    if ( prefetch_weapons )
+        for (int i = 0; i < NUM_LAZY_WEAPONS; ++i)
+            RequestWeapon(&g_LazyWeapons[i]);
+
+    // Eventos de entrada recebidos durante o carregamento (pela tela de
+    // carregamento) são descartados; o jogo começa do estado inicial
+    InputEvent ignored_event;
+    while ( InputQueue_Pop(&ignored_event) )
+        ;
+
+    // Combinamos as partes da mesa e da sala que são sempre desenhadas
+    // juntas (e com o mesmo material) em um objeto por modelo, de forma que
+    // cada modelo custe uma única chamada de desenho por quadro. A AK-47 é
+    // combinada da mesma forma quando for carregada (veja UpdateWeaponLoading()).
+    const char* pool_table_parts[] = {
+        "Base_low_Mesh.024",
+        "Box14_low_Mesh.022",
+        "feet_low_Mesh.020",
+        "legs_low_Mesh.019",
+        "rubber_low_Mesh.018",
+        "tabletop_low_Mesh.013",
+    };
+    AddMergedObjectToVirtualScene("pool_table", pool_table_parts, 6);
+
+    const char* brick_room_parts[] = {
+        "group_3_ID27",
+        "group_4_ID64",
+        "group_5_ID71",
+        "group_6_ID78",
+        "group_7_ID91",
+        "group_8_ID104",
+    };
+    AddMergedObjectToVirtualScene("brick_room", brick_room_parts, 6);
+
+    if ( argc > model_argument )
     {
-        ObjModel model(argv[1]);
-        BuildTrianglesAndAddToVirtualScene(&model);
+        ObjModel model(argv[model_argument]);
+        mesh_resources.push_back(BuildTrianglesAndAddToVirtualScene(&model, argv[model_argument]));
     }
 
-    // Inicializamos o código para renderização de texto.
-    TextRendering_Init();
+    // Cada imagem e cada modelo está na GPU uma única vez
+    Resources_PrintSummary();
+
+    // Buscamos os handles dos objetos desenhados a cada quadro uma única vez
+    int pool_table_object = GetVirtualObjectHandle("pool_table");
+    int brick_room_object = GetVirtualObjectHandle("brick_room");
+    int p88_object        = GetVirtualObjectHandle("P88");
+
+    // E as "timer queries" que medem o tempo de GPU (veja "profiling.hpp")
+    GpuTimers_Init();
 
     // Habilitamos o Z-buffer. Veja slides 104-116 do documento Aula_09_Projecoes.pdf.
-    glEnable(GL_DEPTH_TEST);
+    GLState_SetEnabled(GL_DEPTH_TEST, true);
 
     // Habilitamos o Backface Culling. Veja slides 8-13 do documento Aula_02_Fundamentos_Matematicos.pdf, slides 23-34 do documento Aula_13_Clipping_and_Culling.pdf e slides 112-123 do documento Aula_14_Laboratorio_3_Revisao.pdf.
-    glEnable(GL_CULL_FACE);
+    GLState_SetEnabled(GL_CULL_FACE, true);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
 
@@ -639,6 +1216,7 @@ int main(int argc, char* argv[])
 //||                                                                 +snd   ||
 //==========================================================================||
 
+    Trace_Begin("sounds");
     ma_result result;
     ma_engine engine;
 
@@ -667,6 +1245,7 @@ int main(int argc, char* argv[])
 
     result = ma_sound_init_from_file(&engine, "../../sounds/clack.mp3", 0, NULL, NULL, &clack_sound);
     ma_sound_set_volume(&clack_sound, 0.2f);
+    Trace_End("sounds");
 
 //==========================================================================||
 //||                                                                        ||
@@ -706,13 +1285,50 @@ int main(int argc, char* argv[])
         x = x - diameter * sqrt(3) / 2;
     }
 
+    Trace_End("startup");
+
+    // Medimos o tempo de cada fase do quadro; as amostras só são guardadas
+    // no modo benchmark
+    g_Profiler.recording = (g_BenchmarkFrames > 0);
+    int frame_number = 0;
+    uint64_t benchmark_frame_hash = 0;
+    g_InputTime = glfwGetTime();
+
     // Ficamos em um loop infinito, renderizando, até que o usuário feche a janela
     while (!glfwWindowShouldClose(window))
     {
+        // Esperamos pelo limitador de quadros antes de ler a entrada, e não
+        // depois, para que ela seja a mais recente possível
+        FramePacing_WaitForNextFrame();
+
+        Profiler_BeginFrame();
+        GpuTimers_BeginFrame();
+        Profiler_BeginPhase(PHASE_CAMERA);
+
+        // Verificamos com o sistema operacional se houve alguma interação do
+        // usuário (teclado, mouse, ...). Caso positivo, as funções de callback
+        // definidas anteriormente usando glfwSet*Callback() serão chamadas
+        // pela biblioteca GLFW. Isso é feito antes da simulação e da câmera,
+        // e não depois de desenhar, que atrasaria toda entrada em um quadro.
+        // As callbacks só enfileiram os eventos, que são aplicados aqui, em
+        // ordem (veja "inputQueue.hpp").
+        glfwPollEvents();
+        ProcessInputEvents(glfwGetTime());
+
+        // Armas pedidas por SelectGun() que já foram lidas do disco
+        UpdateWeaponLoading();
 
         float delta_t = (float)glfwGetTime() - run_time;
         run_time = (float)glfwGetTime();
 
+        // No benchmark, o passo de tempo é fixo e a entrada vem do roteiro,
+        // para que toda execução simule e desenhe exatamente o mesmo
+        if ( g_BenchmarkFrames > 0 )
+        {
+            delta_t = g_BenchmarkTimestep;
+            BenchmarkScript(frame_number);
+        }
+
         
 
         global_Text_Line = 2;
@@ -726,15 +1342,16 @@ int main(int argc, char* argv[])
         //           R     G     B     A
         glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
-       
+        // O framebuffer é limpo ("pintado" com a cor acima, e o Z-buffer
+        // resetado) em DynamicResolution_BeginScene(), logo antes de
+        // desenhar a cena.
 
-        // "Pintamos" todos os pixels do framebuffer com a cor definida acima,
-        // e também resetamos todos os pixels do Z-buffer (depth buffer).
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Contadores de desenhos, binds e envios de dados do quadro. Veja
+        // "glState.hpp" e TextRendering_ShowRenderStats().
+        GLState_BeginFrame();
 
-        // Pedimos para a GPU utilizar o programa de GPU criado acima (contendo
-        // os shaders de vértice e fragmentos).
-        glUseProgram(g_GpuProgramID);
+        g_NumDrawnObjects = 0;
+        g_NumCulledObjects = 0;
 
  //==========================================================================||
 //||                                                                        ||
@@ -773,18 +1390,7 @@ int main(int argc, char* argv[])
         
         g_Camera_LookAt = PhysicsObjects.front().position; 
 
-        float r = g_CameraDistance;
-        float y = g_Camera_LookAt.y + r*sin(g_CameraPhi);
-        float z = g_Camera_LookAt.z + r*cos(g_CameraPhi)*cos(g_CameraTheta);
-        float x = g_Camera_LookAt.x + r*cos(g_CameraPhi)*sin(g_CameraTheta);
-
-        g_LookAt_Coords = glm::vec4(x,y,z,1.0f);
-
-        g_POV_LookAt = g_POV_Coords + glm::vec4(cos(-g_free_CameraTheta)*cos(g_free_CameraPhi), -sin(g_free_CameraPhi), sin(-g_free_CameraTheta)*cos(g_free_CameraPhi),0.0f);
-        
-
-        g_FinalCameraCoords = Bezier(g_POV_Coords, g_POV_Coords + glm::vec4(0.0f,1.0f,0.0f,0.0f), g_LookAt_Coords +  glm::vec4(0.0f,1.0f,0.0f,0.0f), g_LookAt_Coords ,cameraBezierT);
-        g_FinalCameraLookAtCoords = Bezier(g_POV_LookAt, g_POV_LookAt, g_Camera_LookAt, g_Camera_LookAt, cameraBezierT);
+        UpdateCameraCoords();
 
         // Abaixo definimos as varáveis que efetivamente definem a câmera virtual.
         // Veja slides 195-227 e 229-234 do documento Aula_08_Sistemas_de_Coordenadas.pdf.
@@ -806,24 +1412,15 @@ int main(int argc, char* argv[])
 
         float zoom_slowdown = Bezier(1, 1, 0.3, 0.3, g_zoomAnim);
 
-        if(w_held){
-            g_POV_Coords = g_POV_Coords + camera_horizontal_normalized * walk_speed * zoom_slowdown * delta_t;
-            }
-        if(s_held){
-            g_POV_Coords = g_POV_Coords - camera_horizontal_normalized * walk_speed * zoom_slowdown * delta_t;
-            }
-        if(a_held){
-            g_POV_Coords = g_POV_Coords - camera_side_vector_normalized * walk_speed * zoom_slowdown * delta_t;
-            }
-        if(d_held){
-            g_POV_Coords = g_POV_Coords + camera_side_vector_normalized * walk_speed * zoom_slowdown * delta_t;
-            }
-        if(shift_held){
-            g_POV_Coords = g_POV_Coords + camera_up_vector * 1.5f * delta_t;
-            }
-        if(ctrl_held){
-            g_POV_Coords = g_POV_Coords - camera_up_vector * 1.5f * delta_t;
-            }
+        // Cada tecla move a câmera só pelo tempo em que ficou pressionada
+        // desde o último quadro, e não pelo quadro inteiro
+        glm::vec4 walk_movement = walk_speed * zoom_slowdown
+            * ( camera_horizontal_normalized * (g_MoveKeyTime[MOVE_FORWARD] - g_MoveKeyTime[MOVE_BACKWARD])
+              + camera_side_vector_normalized * (g_MoveKeyTime[MOVE_RIGHT] - g_MoveKeyTime[MOVE_LEFT]) );
+        g_POV_Coords = g_POV_Coords + walk_movement
+            + camera_up_vector * 1.5f * (g_MoveKeyTime[MOVE_UP] - g_MoveKeyTime[MOVE_DOWN]);
+        for (int i = 0; i < NUM_MOVE_KEYS; ++i)
+            g_MoveKeyTime[i] = 0.0f;
 
 
         bool isCollidingWithTable = collision_box_box(g_POV_Coords, table_coords, player_dim, table_dim);
@@ -831,18 +1428,7 @@ int main(int argc, char* argv[])
         
         // top 10 worst code ever
         if(isCollidingWithTable){
-            if(w_held){
-                g_POV_Coords = g_POV_Coords - camera_horizontal_normalized * walk_speed * zoom_slowdown * delta_t;
-                }
-            if(s_held){
-                g_POV_Coords = g_POV_Coords + camera_horizontal_normalized * walk_speed * zoom_slowdown * delta_t;
-                }
-            if(a_held){
-                g_POV_Coords = g_POV_Coords + camera_side_vector_normalized * walk_speed * zoom_slowdown * delta_t;
-                }
-            if(d_held){
-                g_POV_Coords = g_POV_Coords - camera_side_vector_normalized * walk_speed * zoom_slowdown * delta_t;
-                }
+            g_POV_Coords = g_POV_Coords - walk_movement;
         }
 
 
@@ -870,6 +1456,7 @@ int main(int argc, char* argv[])
 
         // Agora computamos a matriz de Projeção.
         glm::mat4 projection;
+        glm::mat4 culling_projection; // Alargada com o late latch (veja LATE_LATCH_CULL_MARGIN)
 
         // Note que, no sistema de coordenadas da câmera, os planos near e far
         // estão no sentido negativo! Veja slides 176-204 do documento Aula_09_Projecoes.pdf.
@@ -883,6 +1470,11 @@ int main(int argc, char* argv[])
             float field_of_view = (3.141592 / 3.0f) * Bezier(1, 1 , 0.3,  0.3, g_zoomAnim); 
 
             projection = Matrix_Perspective(field_of_view, g_ScreenRatio, nearplane, farplane);
+
+            float culling_field_of_view = field_of_view;
+            if ( g_FramePacing.late_latch )
+                culling_field_of_view = std::min(field_of_view + 2.0f * LATE_LATCH_CULL_MARGIN, 3.0f);
+            culling_projection = Matrix_Perspective(culling_field_of_view, g_ScreenRatio, nearplane, farplane);
         }
         else
         {
@@ -896,15 +1488,23 @@ int main(int argc, char* argv[])
             float r = t*g_ScreenRatio;
             float l = -r;
             projection = Matrix_Orthographic(l, r, b, t, nearplane, farplane);
+
+            float widen = g_FramePacing.late_latch ? 1.0f + 2.0f * LATE_LATCH_CULL_MARGIN : 1.0f;
+            culling_projection = Matrix_Orthographic(widen * l, widen * r, widen * b, widen * t, nearplane, farplane);
         }
 
         glm::mat4 model = Matrix_Identity(); // Transformação identidade de modelagem
 
-        // Enviamos as matrizes "view" e "projection" para a placa de vídeo
-        // (GPU). Veja o arquivo "shader_vertex.glsl", onde estas são
-        // efetivamente aplicadas em todos os pontos.
-        glUniformMatrix4fv(g_view_uniform       , 1 , GL_FALSE , glm::value_ptr(view));
-        glUniformMatrix4fv(g_projection_uniform , 1 , GL_FALSE , glm::value_ptr(projection));
+        // Enviamos as matrizes "view" e "projection", e a posição da câmera,
+        // para a placa de vídeo (GPU) uma única vez por quadro. Veja o
+        // arquivo "shader_vertex.glsl", onde estas são efetivamente
+        // aplicadas em todos os pontos.
+        UpdateFrameUniforms(view, projection, camera_position_c);
+
+        g_ViewFrustum = ExtractFrustum(culling_projection * view);
+        g_ProjectionScale = projection[1][1];
+
+        Profiler_BeginPhase(PHASE_SCENE);
 
         
         #define SPHERE 0
@@ -916,100 +1516,22 @@ int main(int argc, char* argv[])
 
         // Desenhamos A mesa
         model = Matrix_Translate(0.0f,0.0f,0.0f) * Matrix_Scale(1.0f, 1.0f, 1.0f);
-        glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-        glUniform1i(g_object_id_uniform, TABLE_TOP);
-        DrawVirtualObject("Base_low_Mesh.024");
-        DrawVirtualObject("Box14_low_Mesh.022");
-        DrawVirtualObject("feet_low_Mesh.020");
-        DrawVirtualObject("legs_low_Mesh.019");
-        DrawVirtualObject("rubber_low_Mesh.018");
-        DrawVirtualObject("tabletop_low_Mesh.013");
+        DrawVirtualObject(pool_table_object, model, TABLE_TOP);
 
 
         model = Matrix_Translate(0.0f,0.0f,0.0f) * Matrix_Scale(1.0f, 1.0f, 1.0f);
-        glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-        glUniform1i(g_object_id_uniform, BRICK_ROOM);
-        DrawVirtualObject("group_3_ID27");
-        DrawVirtualObject("group_4_ID64");
-        DrawVirtualObject("group_5_ID71");
-        DrawVirtualObject("group_6_ID78");
-        DrawVirtualObject("group_7_ID91");
-        DrawVirtualObject("group_8_ID104");
+        DrawVirtualObject(brick_room_object, model, BRICK_ROOM);
 
         // Desenhamos o plano da arma
 
+        // Guardamos a posição da arma na fila, para reposicioná-la junto com
+        // a câmera no "late latch" abaixo
+        size_t gun_item = g_RenderQueueItems.size();
         if(gunType == 0){
-            model = Matrix_Translate(g_POV_Coords.x, g_POV_Coords.y, g_POV_Coords.z)
-            * Matrix_Rotate_X(0.0f)
-            * Matrix_Rotate_Y(g_free_CameraTheta + (3.14))
-            * Matrix_Rotate_Z(g_free_CameraPhi + -LERP(0, (3.14 / LERP(5, 20, g_zoomAnim)) ,g_recoilAnim))
-            * Matrix_Translate(
-            LERP(-0.15f, -0.3f, g_zoomAnim),
-            LERP(-0.2f, -0.18f, g_zoomAnim),
-            LERP(-0.1f, 0.0f, g_zoomAnim))
-            
-            * Matrix_Scale(0.01f, 0.01f, 0.01f);
-            glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-            glUniform1i(g_object_id_uniform, GUN);
-            DrawVirtualObject("P88");
+            DrawVirtualObject(p88_object, GunModelMatrix(), GUN);
         } else if(gunType == 1){
             // ak 47
-            model = Matrix_Translate(g_POV_Coords.x, g_POV_Coords.y, g_POV_Coords.z)
-            * Matrix_Rotate_X(0.0f)
-            * Matrix_Rotate_Y(g_free_CameraTheta + (3.14))
-            * Matrix_Rotate_Z(g_free_CameraPhi + -LERP(0, (3.14 / LERP(30, 50, g_zoomAnim)) ,g_recoilAnim))
-            * Matrix_Translate(
-            LERP(-0.25f, -0.35f, g_zoomAnim),
-            LERP(-0.25f, -0.20f, g_zoomAnim),
-            LERP(-0.1f, 0.0f, g_zoomAnim))
-            * Matrix_Rotate_Y(3.141f)
-            * Matrix_Scale(0.05f, 0.05f, 0.05f);
-            glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-            glUniform1i(g_object_id_uniform, AK47);
-            DrawVirtualObject("magazine_low_0");
-            DrawVirtualObject("stock_low_0");
-            DrawVirtualObject("rear_sight_low_0");
-            DrawVirtualObject("pistolstock_low_0");
-            DrawVirtualObject("upperreceiver_low_0");
-            DrawVirtualObject("barrel_element_low_0");
-            DrawVirtualObject("front_sight_big_cylinder_low_0");
-            DrawVirtualObject("rear_sight_screw_low_0");
-            DrawVirtualObject("safetyswitchscrew_low_0");
-            DrawVirtualObject("safetyswitch_low_0");
-            DrawVirtualObject("rear_sight_element_b_low_0");
-            DrawVirtualObject("rear_sight_element_a_low_0");
-            DrawVirtualObject("swivel_low_0");
-            DrawVirtualObject("bolt_carrier_low_0");
-            DrawVirtualObject("receiver_low_0");
-            DrawVirtualObject("rear_sight_leaf_low_0");
-            DrawVirtualObject("trigger_low_0");
-            DrawVirtualObject("spring_low_0");
-            DrawVirtualObject("rear_sight_switch_knob_low_0");
-            DrawVirtualObject("rear_sight_switch_low_0");
-            DrawVirtualObject("sylinder_low_0");
-            DrawVirtualObject("barrel_cylinder_low_0");
-            DrawVirtualObject("front_sight_needle_low_0");
-            DrawVirtualObject("stock_element_low_0");
-            DrawVirtualObject("front_sight_cylinder_low_0");
-            DrawVirtualObject("rear_sight_element_screw_low_0");
-            DrawVirtualObject("receiver_screws_low_0");
-            DrawVirtualObject("rear_sight_cylinder_low_0");
-            DrawVirtualObject("triggerguard_screws_low_0");
-            DrawVirtualObject("triggerguard_low_0");
-            DrawVirtualObject("magazine_catch_low_0");
-            DrawVirtualObject("muzzlebreak_low_0");
-            DrawVirtualObject("stock_screws_low_0");
-            DrawVirtualObject("barrel_low_0");
-            DrawVirtualObject("triggerguard_upper_low_0");
-            DrawVirtualObject("gas_block_low_0");
-            DrawVirtualObject("gas_cylinder_low_0");
-            DrawVirtualObject("handguard_low_0");
-            DrawVirtualObject("element_rear_sight_low_0");
-            DrawVirtualObject("handguard_upper_low_0");
-            DrawVirtualObject("handguardmetal_low_0");
-            DrawVirtualObject("front_sight_low_0");
-            DrawVirtualObject("polySurface228_0");
-            DrawVirtualObject("polySurface229_0");
+            DrawVirtualObject(FindLazyWeapon(1)->object, GunModelMatrix(), AK47);
         }
 
 //==========================================================================||
@@ -1020,6 +1542,8 @@ int main(int argc, char* argv[])
 
 
 
+        Profiler_BeginPhase(PHASE_PHYSICS);
+
         glm::vec4 rayCastPoint;
         float rayCastDist;
 
@@ -1029,6 +1553,7 @@ int main(int argc, char* argv[])
         DrawSphereCoords(xMinusBound,yMinusBound,zPlusBound,0.02f);
         DrawSphereCoords(xMinusBound,yMinusBound,zMinusBound,0.02f);
 
+        FlightRecorder_Current().substeps += 1;
         for(PhysicsObject &object : PhysicsObjects){
             object.draw();
 
@@ -1051,10 +1576,13 @@ int main(int argc, char* argv[])
         }
 
         //for each pair of objects
+        Profiler_BeginPhase(PHASE_COLLISIONS);
         for(PhysicsObject &o1 : PhysicsObjects){
             for(PhysicsObject &o2 : PhysicsObjects){
                 if(&o1 != &o2 && &o1 < &o2){
+                    FlightRecorder_Current().pairs_tested += 1;
                     if(collideSpheres(&o1, &o2)){
+                        FlightRecorder_Current().contacts += 1;
                         ma_sound_stop(&clack_sound);
                         ma_sound_seek_to_pcm_frame(&clack_sound, 0);
                         ma_sound_start(&clack_sound);
@@ -1067,6 +1595,7 @@ int main(int argc, char* argv[])
             }
         }
        
+        Profiler_BeginPhase(PHASE_PHYSICS);
 
         if(g_recoilAnim > 0){
             g_recoilAnim = g_recoilAnim - 3 * delta_t;
@@ -1081,28 +1610,24 @@ int main(int argc, char* argv[])
         }
 
 
-        // Makeshift crosshair
-        DrawSphere(camera_position_c + camera_view_vector * 0.2f, 0.001f, 0);
-
-
-        bool is_shooting = false;
+        Profiler_BeginPhase(PHASE_RAYCAST);
 
-        if(g_LeftMouseButtonPressed && (gunType == 1)){
+        // O fuzil atira enquanto o botão estiver pressionado, ou se houve um
+        // clique desde o último quadro, na cadência de g_ak_downtime_const.
+        // Os tiros da pistola já foram pedidos no instante de cada clique.
+        if((g_LeftMouseButtonPressed || g_LeftMouseClicked) && (gunType == 1)){
             if(g_ak_downtime <= 0){
                 g_ak_downtime = g_ak_downtime_const;
-                g_recoilAnim = 1;
-                is_shooting = true;
+                g_PendingShots.push_back(ShotRequest());
+                g_PendingShots.back().origin = camera_position_c;
+                g_PendingShots.back().direction = camera_view_vector;
             }
         }
+        g_LeftMouseClicked = false;
 
-
-        if(g_TapFlag && gunType == 0){
-            g_TapFlag = false;
+        for(const ShotRequest& shot : g_PendingShots){
             g_recoilAnim = 1;
-            is_shooting = true;
-        }
-
-        if(is_shooting){
+            FlightRecorder_Current().shots += 1;
             ma_sound_stop(&gunshot_sound);
             ma_sound_seek_to_pcm_frame(&gunshot_sound, 0);
             ma_sound_start(&gunshot_sound);
@@ -1112,7 +1637,7 @@ int main(int argc, char* argv[])
             glm::vec4 rayCastPointClosest;
             PhysicsObject * rayCastSelectedObjectPointer;
             for(PhysicsObject &object : PhysicsObjects){
-                rayCastPoint = p_collision_sphere_ray(object.position, object.radius, camera_position_c, camera_view_vector, &rayCastDist);
+                rayCastPoint = p_collision_sphere_ray(object.position, object.radius, shot.origin, shot.direction, &rayCastDist);
 
                 if(((rayCastDist < min_dist) && (rayCastDist >= 0)) ||( min_dist > -1.1f && min_dist < -0.9f )){
                     min_dist = rayCastDist;       
@@ -1136,7 +1661,7 @@ int main(int argc, char* argv[])
 
                 rayCastSelectedObjectPointer->movement_vector = (0.5f * rayCastSelectedObjectPointer->movement_vector
                                                                          + 0.6f * impactVector
-                                                                          + 0.4f * planarize(camera_view_vector) * multiplier);
+                                                                          + 0.4f * planarize(shot.direction) * multiplier);
 
 
                 ma_sound_stop(&clack_sound);
@@ -1144,6 +1669,65 @@ int main(int argc, char* argv[])
                 ma_sound_start(&clack_sound);   
             }
         } 
+        g_PendingShots.clear();
+
+        // "Late latch": lemos a entrada mais uma vez e reorientamos a câmera,
+        // junto com a arma e a mira presas a ela, logo antes de enviar os
+        // desenhos. A simulação e o tiro usaram a orientação do início do
+        // quadro. Os objetos da fila de renderização já foram descartados
+        // com o frustum alargado (veja LATE_LATCH_CULL_MARGIN); o frustum é
+        // extraído de novo da câmera final para as esferas (bolas e mira),
+        // testadas só em DrawSphereInstances().
+        // Só os movimentos do cursor são aplicados aqui: teclas e cliques
+        // (troca de arma, de câmera, tiros) ficam na fila para o próximo
+        // quadro, pois a fila de renderização já foi montada sem eles.
+        if ( g_FramePacing.late_latch )
+        {
+            glfwPollEvents();
+            ProcessCursorEvents(glfwGetTime());
+            UpdateCameraCoords();
+
+            camera_position_c  = g_FinalCameraCoords;
+            camera_view_vector = g_FinalCameraLookAtCoords - camera_position_c;
+            view = Matrix_Camera_View(camera_position_c, camera_view_vector, camera_up_vector);
+            UpdateFrameUniforms(view, projection, camera_position_c);
+            g_ViewFrustum = ExtractFrustum(projection * view);
+
+            if ( gun_item < g_RenderQueueItems.size() )
+                g_RenderQueueItems[gun_item].model = GunModelMatrix();
+        }
+
+        // Makeshift crosshair
+        DrawSphere(camera_position_c + camera_view_vector * 0.2f, 0.001f, 0);
+
+        // Os objetos colocados na fila acima por DrawVirtualObject(), já
+        // ordenados, e depois todas as esferas do quadro (bolas, mira,
+        // marcadores) em uma chamada só
+        // A cena é desenhada com resolução reduzida, se necessário, e
+        // ampliada para a janela (veja "dynamicResolution.hpp")
+        Profiler_BeginPhase(PHASE_SUBMIT);
+        GpuTimers_Begin(GPU_PASS_SCENE);
+        DynamicResolution_BeginScene(window);
+        SubmitRenderQueue();
+        GpuTimers_End();
+        GpuTimers_Begin(GPU_PASS_SPHERES);
+        DrawSphereInstances();
+        GpuTimers_End();
+
+        // O hash do último quadro do benchmark é tirado do framebuffer da
+        // cena, antes do texto, que mostra tempos e contadores que variam de
+        // uma execução para outra. O conteúdo do framebuffer da janela, que é
+        // invisível no benchmark, não é garantido pelo OpenGL ("pixel
+        // ownership"); o da cena é nosso. No benchmark a resolução é fixa, então
+        // a cena ocupa o framebuffer inteiro.
+        if ( g_BenchmarkFrames > 0 && frame_number == g_BenchmarkFrames - 1 )
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, g_DynamicResolution.framebuffer);
+            benchmark_frame_hash = HashFramebuffer(DynamicResolution_RenderWidth(), DynamicResolution_RenderHeight());
+        }
+        DynamicResolution_EndScene();
+
+        Profiler_BeginPhase(PHASE_OVERLAY);
 
         // Imprimimos na informação sobre a matriz de projeção sendo utilizada.
         TextRendering_ShowProjection(window);
@@ -1152,24 +1736,70 @@ int main(int argc, char* argv[])
         // por segundo (frames per second).
         TextRendering_ShowFramesPerSecond(window);
 
+        // Imprimimos quantos objetos foram desenhados e quantos foram
+        // descartados pelo teste de frustum.
+        TextRendering_ShowCullingStats(window);
+
+        // E quantas chamadas de desenho, binds e envios de dados foram feitos
+        // no quadro anterior (veja "glState.hpp")
+        TextRendering_ShowRenderStats(window);
+
+        // Percentis do tempo de quadro, tempos de CPU e GPU de cada fase e o
+        // gráfico dos últimos quadros
+        TextRendering_ShowFrameTimes(window);
+
+        // Aviso enquanto a arma escolhida é carregada (veja SelectGun())
+        TextRendering_ShowWeaponLoading(window);
+
+        // Todo o texto impresso acima é desenhado de uma só vez
+        GpuTimers_Begin(GPU_PASS_TEXT);
+        TextRendering_Flush(window);
+        GpuTimers_End();
+
         // O framebuffer onde OpenGL executa as operações de renderização não
         // é o mesmo que está sendo mostrado para o usuário, caso contrário
         // seria possível ver artefatos conhecidos como "screen tearing". A
         // chamada abaixo faz a troca dos buffers, mostrando para o usuário
         // tudo que foi renderizado pelas funções acima.
         // Veja o link: https://en.wikipedia.org/w/index.php?title=Multiple_buffering&oldid=793452829#Double_buffering_in_computer_graphics
+        Profiler_BeginPhase(PHASE_SWAP);
         glfwSwapBuffers(window);
 
-        // Verificamos com o sistema operacional se houve alguma interação do
-        // usuário (teclado, mouse, ...). Caso positivo, as funções de callback
-        // definidas anteriormente usando glfwSet*Callback() serão chamadas
-        // pela biblioteca GLFW.
-        glfwPollEvents();
+        Profiler_EndFrame();
+        FlightRecorder_EndFrame(frame_number, glfwGetTime());
+        DynamicResolution_Update();
+        frame_number += 1;
+
+        if ( g_BenchmarkFrames > 0 && frame_number == g_BenchmarkFrames )
+        {
+            Profiler_PrintReport(benchmark_frame_hash);
+            break;
+        }
     }
 
     //encerra engine de som
     ma_engine_uninit(&engine);
 
+    // Esperamos as armas que ainda estejam sendo lidas e terminamos as
+    // threads auxiliares
+    AssetLoader_Stop();
+    UnloadWeapons();
+
+    // Soltamos as texturas e os modelos e os descarregamos; o gerenciador
+    // avisa sobre qualquer recurso que ainda tenha referências
+    for (int material = 0; material < NUM_MATERIALS; ++material)
+        if ( g_MaterialTextures[material] >= 0 )
+            Resources_Release(g_MaterialTextures[material]);
+    for (size_t i = 0; i < mesh_resources.size(); ++i)
+        Resources_Release(mesh_resources[i]);
+    Resources_Shutdown();
+
+    // Escrevemos o restante do trace, se ativado
+    Trace_Stop();
+
+    if ( g_InputQueue.dropped > 0 )
+        fprintf(stderr, "WARNING: input queue full, %d events dropped.\n", (int)g_InputQueue.dropped);
+
     // Finalizamos o uso dos recursos do sistema operacional
     glfwTerminate();
 
@@ -1177,25 +1807,127 @@ int main(int argc, char* argv[])
     return 0;
 }
 
-// Função que carrega uma imagem para ser utilizada como textura
-void LoadTextureImage(const char* filename)
+// Função que lê uma imagem de textura do disco. Não usa OpenGL, então pode
+// ser chamada em uma thread auxiliar. Se a imagem não puder ser lida,
+// image->data fica NULL e o erro é tratado por LoadTextureImage().
+void DecodeTextureImage(const char* filename, TextureImage* image)
 {
-    printf("Carregando imagem \"%s\"... ", filename);
+    TraceScope trace("DecodeTextureImage", filename);
+
+    image->filename = filename;
+    image->data = NULL;
+    image->width = 0;
+    image->height = 0;
+
+    // Texturas de mesmo conteúdo são enviadas à GPU uma vez só (veja
+    // LoadTextureImage()). Sem a imagem original, usamos a pré-assada.
+    image->content_hash = 0;
+    if ( !HashFile(filename, &image->content_hash) )
+        HashFile((std::string(filename) + ".ftex").c_str(), &image->content_hash);
+
+    // Preferimos a versão pré-assada da imagem (veja "bakedTexture.hpp"):
+    // os texels e todos os mipmaps vão direto do arquivo mapeado em memória
+    // para a GPU, sem decodificar a imagem
+    image->is_baked = LoadBakedTexture(filename, &image->baked);
+    if ( image->is_baked )
+    {
+        image->width = image->baked.header->width;
+        image->height = image->baked.header->height;
+        return;
+    }
 
-    // Primeiro fazemos a leitura da imagem do disco
-    stbi_set_flip_vertically_on_load(true);
-    int width;
-    int height;
+    // Senão, fazemos a leitura da imagem do disco. As imagens são invertidas
+    // verticalmente (veja stbi_set_flip_vertically_on_load() em main()).
     int channels;
-    unsigned char *data = stbi_load(filename, &width, &height, &channels, 3);
+    image->data = stbi_load(filename, &image->width, &image->height, &channels, 3);
+}
+
+// Libera a memória de uma imagem já enviada à GPU
+void FreeTextureImage(TextureImage* image)
+{
+    if ( image->is_baked )
+        BakedTexture_Close(&image->baked);
+    if ( image->data != NULL )
+        stbi_image_free(image->data);
+    image->is_baked = false;
+    image->data = NULL;
+}
+
+// Pede a leitura de "filename" para "image" em uma thread auxiliar (veja
+// "assetLoader.hpp"). A imagem só pode ser usada depois de AssetLoader_Wait().
+int SubmitTextureImage(const char* filename, TextureImage* image)
+{
+    std::string name(filename);
+    return AssetLoader_Submit(name, [name, image]() { DecodeTextureImage(name.c_str(), image); });
+}
+
+// Pede a leitura do modelo "filename" para "mesh" em uma thread auxiliar
+// (veja LoadMesh()). O modelo só pode ser usado depois de AssetLoader_Wait().
+int SubmitMesh(const char* filename, MeshData* mesh, bool planar_texcoords)
+{
+    std::string name(filename);
+    return AssetLoader_Submit(name, [name, mesh, planar_texcoords]() { LoadMesh(name.c_str(), mesh, planar_texcoords); });
+}
+
+// Memória de GPU aproximada de uma textura RGB com todos os mipmaps, para o
+// orçamento do gerenciador de recursos. Os drivers costumam guardar texels
+// RGB8 em 4 bytes.
+size_t TextureBytes(int width, int height, int layers)
+{
+    size_t bytes = 4 * (size_t)width * height * layers;
+    while ( width > 1 || height > 1 )
+    {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        bytes += 4 * (size_t)width * height * layers;
+    }
+    return bytes;
+}
 
-    if ( data == NULL )
+// Procura no gerenciador de recursos uma textura já carregada pelo caminho
+// "path" ou com o mesmo conteúdo, acrescentando uma referência a ela.
+// Retorna -1 se a textura precisa ser enviada à GPU.
+int FindLoadedTexture(const std::string& path, uint64_t content_hash)
+{
+    int texture = Resources_Find(path.c_str());
+    if ( texture >= 0 )
     {
-        fprintf(stderr, "ERROR: Cannot open image file \"%s\".\n", filename);
-        std::exit(EXIT_FAILURE);
+        printf("OK (já carregada).\n");
+        return Resources_AddRef(texture);
+    }
+
+    texture = Resources_FindByHash(RESOURCE_TEXTURE, content_hash);
+    if ( texture >= 0 )
+    {
+        printf("OK (mesmo conteúdo de \"%s\").\n", g_Resources.items[texture].path.c_str());
+        return Resources_AddAlias(path.c_str(), texture);
+    }
+    return -1;
+}
+
+// Função que envia uma imagem lida por DecodeTextureImage() para a GPU e
+// libera a imagem da memória. Retorna o handle da textura no gerenciador de
+// recursos (veja "resourceManager.hpp"), que escolhe a sua unidade de
+// textura, com uma referência. Uma imagem já carregada, pelo mesmo arquivo ou
+// por outro de mesmo conteúdo, não é enviada de novo.
+int LoadTextureImage(TextureImage* image)
+{
+    TraceScope trace("LoadTextureImage", image->filename.c_str());
+
+    printf("Carregando imagem \"%s\"... ", image->filename.c_str());
+
+    int texture = FindLoadedTexture(image->filename, image->content_hash);
+    if ( texture >= 0 )
+    {
+        FreeTextureImage(image);
+        return texture;
     }
 
-    printf("OK (%dx%d).\n", width, height);
+    if ( !image->is_baked && image->data == NULL )
+    {
+        fprintf(stderr, "ERROR: Cannot open image file \"%s\".\n", image->filename.c_str());
+        std::exit(EXIT_FAILURE);
+    }
 
     // Agora criamos objetos na GPU com OpenGL para armazenar a textura
     GLuint texture_id;
@@ -1211,63 +1943,350 @@ void LoadTextureImage(const char* filename)
     glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Agora enviamos a imagem lida do disco para a GPU
+    GLint textureunit = Resources_AllocateTextureUnit(image->filename.c_str());
+    glActiveTexture(GL_TEXTURE0 + textureunit);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 
-    GLuint textureunit = g_NumLoadedTextures;
-    glActiveTexture(GL_TEXTURE0 + textureunit);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    if ( image->is_baked )
+    {
+        const BakedTexture& baked = image->baked;
+        for (uint32_t level = 0; level < baked.header->num_levels; ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_SRGB8, baked.levels[level].width, baked.levels[level].height,
+                         0, GL_RGB, GL_UNSIGNED_BYTE, BakedTexture_LevelData(baked, level));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, baked.header->num_levels - 1);
+    }
+    else
+    {
+        // Agora enviamos a imagem lida do disco para a GPU
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, image->width, image->height, 0, GL_RGB, GL_UNSIGNED_BYTE, image->data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
     glBindSampler(textureunit, sampler_id);
 
-    stbi_image_free(data);
-
-    g_NumLoadedTextures += 1;
-}
-
-// Função que desenha um objeto armazenado em g_VirtualScene. Veja definição
-// dos objetos na função BuildTrianglesAndAddToVirtualScene().
-void DrawVirtualObject(const char* object_name)
-{
-    // "Ligamos" o VAO. Informamos que queremos utilizar os atributos de
-    // vértices apontados pelo VAO criado pela função BuildTrianglesAndAddToVirtualScene(). Veja
-    // comentários detalhados dentro da definição de BuildTrianglesAndAddToVirtualScene().
-    glBindVertexArray(g_VirtualScene[object_name].vertex_array_object_id);
-
-    // Setamos as variáveis "bbox_min" e "bbox_max" do fragment shader
-    // com os parâmetros da axis-aligned bounding box (AABB) do modelo.
-    glm::vec3 bbox_min = g_VirtualScene[object_name].bbox_min;
-    glm::vec3 bbox_max = g_VirtualScene[object_name].bbox_max;
-    glUniform4f(g_bbox_min_uniform, bbox_min.x, bbox_min.y, bbox_min.z, 1.0f);
-    glUniform4f(g_bbox_max_uniform, bbox_max.x, bbox_max.y, bbox_max.z, 1.0f);
-
-    // Pedimos para a GPU rasterizar os vértices dos eixos XYZ
-    // apontados pelo VAO como linhas. Veja a definição de
-    // g_VirtualScene[""] dentro da função BuildTrianglesAndAddToVirtualScene(), e veja
-    // a documentação da função glDrawElements() em
-    // http://docs.gl/gl3/glDrawElements.
-    glDrawElements(
-        g_VirtualScene[object_name].rendering_mode,
-        g_VirtualScene[object_name].num_indices,
-        GL_UNSIGNED_INT,
-        (void*)(g_VirtualScene[object_name].first_index * sizeof(GLuint))
-    );
+    printf("OK (%dx%d).\n", image->width, image->height);
 
-    // "Desligamos" o VAO, evitando assim que operações posteriores venham a
-    // alterar o mesmo. Isso evita bugs.
-    glBindVertexArray(0);
+    texture = Resources_AddTexture(image->filename.c_str(), image->content_hash, GL_TEXTURE_2D, texture_id, sampler_id,
+                                   textureunit, TextureBytes(image->width, image->height, 1));
+
+    FreeTextureImage(image);
+    return texture;
 }
 
-// Função que carrega os shaders de vértices e de fragmentos que serão
-// utilizados para renderização. Veja slides 180-200 do documento Aula_03_Rendering_Pipeline_Grafico.pdf.
-//
-void LoadShadersFromFiles()
+// Função que envia várias imagens, todas do mesmo tamanho, como camadas de
+// uma única textura GL_TEXTURE_2D_ARRAY. A textura ocupa uma só unidade de
+// textura, e a camada é escolhida no shader pela terceira coordenada.
+// Retorna o handle da textura no gerenciador de recursos, como
+// LoadTextureImage(); o caminho da textura junta os de todas as camadas.
+int LoadTextureImageArray(TextureImage* images, int count)
 {
-    // Note que o caminho para os arquivos "shader_vertex.glsl" e
+    TraceScope trace("LoadTextureImageArray", images[0].filename.c_str());
+
+    std::string path;
+    std::vector<uint64_t> layer_hashes(count);
+    for (int layer = 0; layer < count; ++layer)
+    {
+        path += (layer > 0 ? "|" : "") + images[layer].filename;
+        layer_hashes[layer] = images[layer].content_hash;
+    }
+    uint64_t content_hash = HashBytes((const unsigned char*)layer_hashes.data(), count * sizeof(uint64_t));
+
+    printf("Carregando textura com %d camadas, de \"%s\"... ", count, images[0].filename.c_str());
+    int texture = FindLoadedTexture(path, content_hash);
+    if ( texture >= 0 )
+    {
+        for (int layer = 0; layer < count; ++layer)
+            FreeTextureImage(&images[layer]);
+        return texture;
+    }
+    printf("\n");
+
+    GLuint texture_id;
+    GLuint sampler_id;
+    glGenTextures(1, &texture_id);
+    glGenSamplers(1, &sampler_id);
+
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+    GLint textureunit = Resources_AllocateTextureUnit(path.c_str());
+    glActiveTexture(GL_TEXTURE0 + textureunit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+
+    int array_width = 0;
+    int array_height = 0;
+
+    // Se alguma camada não puder ser pré-assada (veja "bakedTexture.hpp"),
+    // geramos os mipmaps de todas as camadas na GPU no fim
+    bool generate_mipmaps = false;
+
+    for (int layer = 0; layer < count; ++layer)
+    {
+        TextureImage& image = images[layer];
+
+        printf("Carregando imagem \"%s\" (camada %d)... ", image.filename.c_str(), layer);
+
+        if ( !image.is_baked && image.data == NULL )
+        {
+            fprintf(stderr, "ERROR: Cannot open image file \"%s\".\n", image.filename.c_str());
+            std::exit(EXIT_FAILURE);
+        }
+
+        // O tamanho da textura é definido pela primeira imagem; todas as
+        // camadas precisam ter exatamente as mesmas dimensões.
+        if ( layer == 0 )
+        {
+            array_width = image.width;
+            array_height = image.height;
+
+            // Alocamos todos os níveis de mipmap de uma vez, até 1x1
+            int levels = 1;
+            while ( (array_width >> levels) > 0 || (array_height >> levels) > 0 )
+                levels += 1;
+            for (int level = 0; level < levels; ++level)
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_SRGB8, std::max(array_width >> level, 1), std::max(array_height >> level, 1),
+                             count, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+        else if ( image.width != array_width || image.height != array_height )
+        {
+            fprintf(stderr, "ERROR: Image \"%s\" is %dx%d, expected %dx%d for texture array.\n",
+                    image.filename.c_str(), image.width, image.height, array_width, array_height);
+            std::exit(EXIT_FAILURE);
+        }
+
+        if ( image.is_baked )
+        {
+            const BakedTexture& baked = image.baked;
+            for (uint32_t level = 0; level < baked.header->num_levels; ++level)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, baked.levels[level].width, baked.levels[level].height,
+                                1, GL_RGB, GL_UNSIGNED_BYTE, BakedTexture_LevelData(baked, level));
+        }
+        else
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, image.width, image.height, 1, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+            generate_mipmaps = true;
+        }
+
+        printf("OK (%dx%d).\n", image.width, image.height);
+
+        FreeTextureImage(&image);
+    }
+
+    if ( generate_mipmaps )
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindSampler(textureunit, sampler_id);
+
+    return Resources_AddTexture(path.c_str(), content_hash, GL_TEXTURE_2D_ARRAY, texture_id, sampler_id,
+                                textureunit, TextureBytes(array_width, array_height, count));
+}
+
+// Função que coloca um objeto armazenado em g_VirtualScene na fila de
+// renderização do quadro. Veja definição dos objetos na função
+// BuildTrianglesAndAddToVirtualScene(), e SubmitRenderQueue().
+void DrawVirtualObject(int object, glm::mat4 model, int object_id)
+{
+    const SceneObject& scene_object = g_VirtualScene[object];
+
+    // Vetores reaproveitados entre chamadas, evitando alocações a cada quadro
+    static AABBBatch                  boxes;
+    static std::vector<unsigned char> visible;
+
+    // Testamos a AABB de cada parte do objeto, já em coordenadas globais,
+    // contra o frustum da câmera, todas de uma vez.
+    boxes.clear();
+    for (size_t i = 0; i < scene_object.parts.size(); ++i)
+    {
+        glm::vec3 center, extent;
+        TransformAABB(model, scene_object.parts[i].bbox_min, scene_object.parts[i].bbox_max, &center, &extent);
+        boxes.push(center, extent);
+    }
+    int num_visible = CullAABBBatch(g_ViewFrustum, boxes, &visible);
+
+    g_NumDrawnObjects += num_visible;
+    g_NumCulledObjects += scene_object.parts.size() - num_visible;
+
+    if ( num_visible == 0 )
+        return;
+
+    // Um único nível de detalhe para o objeto inteiro, a partir da sua
+    // esfera envolvente em coordenadas globais
+    glm::vec3 center, extent;
+    TransformAABB(model, scene_object.bbox_min, scene_object.bbox_max, &center, &extent);
+    int lod = SelectLevelOfDetail(center, glm::length(extent));
+
+    RenderItem item;
+    item.model       = model;
+    item.object      = object;
+    item.object_id   = object_id;
+    item.first_range = g_RenderQueueCounts.size();
+
+    // Partes visíveis vizinhas no vetor indices[] viram uma única faixa
+    size_t index_size = IndexTypeSize(scene_object.index_type);
+    size_t range_first = 0;
+    size_t range_end = 0;
+    for (size_t i = 0; i < scene_object.parts.size(); ++i)
+    {
+        if ( !visible[i] )
+            continue;
+
+        const SceneObjectPart& part = scene_object.parts[i];
+        if ( g_RenderQueueCounts.size() == item.first_range || part.first_index[lod] != range_end )
+        {
+            if ( g_RenderQueueCounts.size() > item.first_range )
+                g_RenderQueueCounts.back() = range_end - range_first;
+            g_RenderQueueCounts.push_back(0);
+            g_RenderQueueOffsets.push_back((const GLvoid*)(part.first_index[lod] * index_size));
+            range_first = part.first_index[lod];
+        }
+        range_end = part.first_index[lod] + part.num_indices[lod];
+    }
+    g_RenderQueueCounts.back() = range_end - range_first;
+    item.num_ranges = g_RenderQueueCounts.size() - item.first_range;
+
+    // A profundidade é a distância do centro do objeto ao plano near
+    const glm::vec4& near_plane = g_ViewFrustum.planes[4];
+    float depth = glm::dot(glm::vec3(near_plane), center) + near_plane.w;
+
+    RenderQueueEntry entry;
+    entry.sort_key = RenderSortKey(g_MaterialPrograms[MaterialFromObjectId(object_id)],
+                                   scene_object.vertex_array_object_id, depth);
+    entry.item     = g_RenderQueueItems.size();
+
+    g_RenderQueueItems.push_back(item);
+    g_RenderQueue.push_back(entry);
+}
+
+// Chave de ordenação de um desenho: programa de GPU (bits 63-56), VAO (bits
+// 55-32) e profundidade (bits 31-0). As texturas ficam ligadas às suas
+// unidades desde o carregamento (veja LoadTextureImage()), então não entram
+// na chave. Para floats positivos, a ordem dos bits é a mesma dos valores:
+// dentro de um mesmo programa e VAO, os objetos mais próximos vêm primeiro,
+// e o teste de profundidade descarta mais fragmentos dos que vêm depois.
+uint64_t RenderSortKey(GLuint program_id, GLuint vertex_array_object_id, float depth)
+{
+    depth = std::max(depth, 0.0f);
+    uint32_t depth_bits;
+    std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    return ((uint64_t)(program_id & 0xFF) << 56)
+         | ((uint64_t)(vertex_array_object_id & 0xFFFFFF) << 32)
+         | depth_bits;
+}
+
+// Desenha todos os objetos colocados na fila por DrawVirtualObject() no
+// quadro atual, ordenados pela chave, e esvazia a fila.
+void SubmitRenderQueue()
+{
+    std::sort(g_RenderQueue.begin(), g_RenderQueue.end());
+
+    for (size_t i = 0; i < g_RenderQueue.size(); ++i)
+    {
+        const RenderItem& item = g_RenderQueueItems[g_RenderQueue[i].item];
+        const SceneObject& scene_object = g_VirtualScene[item.object];
+
+        UseMaterial(MaterialFromObjectId(item.object_id));
+        UpdateObjectUniforms(item.model, item.object_id, scene_object);
+
+        // "Ligamos" o VAO. Informamos que queremos utilizar os atributos de
+        // vértices apontados pelo VAO criado pela função BuildTrianglesAndAddToVirtualScene(). Veja
+        // comentários detalhados dentro da definição de BuildTrianglesAndAddToVirtualScene().
+        // Itens vizinhos na fila costumam usar o mesmo VAO, e então
+        // GLState_BindVertexArray() não faz nada.
+        GLState_BindVertexArray(scene_object.vertex_array_object_id);
+
+        // Objetos combinados (veja AddMergedObjectToVirtualScene()) enviam
+        // todas as suas faixas de índices em uma única chamada.
+        if ( item.num_ranges > 1 )
+        {
+            GLState_MultiDrawElements(
+                scene_object.rendering_mode,
+                &g_RenderQueueCounts[item.first_range],
+                scene_object.index_type,
+                &g_RenderQueueOffsets[item.first_range],
+                item.num_ranges
+            );
+        }
+        else
+        {
+            // Pedimos para a GPU rasterizar os vértices dos eixos XYZ
+            // apontados pelo VAO como linhas. Veja a definição de
+            // g_VirtualScene[] dentro da função BuildTrianglesAndAddToVirtualScene(), e veja
+            // a documentação da função glDrawElements() em
+            // http://docs.gl/gl3/glDrawElements.
+            GLState_DrawElements(
+                scene_object.rendering_mode,
+                g_RenderQueueCounts[item.first_range],
+                scene_object.index_type,
+                g_RenderQueueOffsets[item.first_range]
+            );
+        }
+    }
+
+    g_RenderQueue.clear();
+    g_RenderQueueItems.clear();
+    g_RenderQueueCounts.clear();
+    g_RenderQueueOffsets.clear();
+}
+
+// Versão de DrawVirtualObject() que busca o objeto pelo nome. Útil para
+// testes e depuração; no loop de renderização prefira buscar o handle uma
+// única vez com GetVirtualObjectHandle().
+void DrawVirtualObject(const char* object_name, glm::mat4 model, int object_id)
+{
+    DrawVirtualObject(GetVirtualObjectHandle(object_name), model, object_id);
+}
+
+// Adiciona "object" à cena virtual e retorna o seu handle. Um objeto com o
+// mesmo nome de outro já existente o substitui, mantendo o mesmo handle.
+int AddObjectToVirtualScene(const SceneObject& object)
+{
+    std::map<std::string, int>::iterator it = g_VirtualSceneHandles.find(object.name);
+    if ( it != g_VirtualSceneHandles.end() )
+    {
+        g_VirtualScene[it->second] = object;
+        return it->second;
+    }
+
+    int handle = (int)g_VirtualScene.size();
+    g_VirtualScene.push_back(object);
+    g_VirtualSceneHandles[object.name] = handle;
+    return handle;
+}
+
+// Retorna o handle do objeto "object_name" em g_VirtualScene. Aborta o
+// programa caso o objeto não exista.
+int GetVirtualObjectHandle(const char* object_name)
+{
+    std::map<std::string, int>::iterator it = g_VirtualSceneHandles.find(object_name);
+    if ( it == g_VirtualSceneHandles.end() )
+    {
+        fprintf(stderr, "ERROR: Unknown object \"%s\" in virtual scene.\n", object_name);
+        std::exit(EXIT_FAILURE);
+    }
+    return it->second;
+}
+
+// Função que carrega os shaders de vértices e de fragmentos que serão
+// utilizados para renderização. Veja slides 180-200 do documento Aula_03_Rendering_Pipeline_Grafico.pdf.
+//
+void LoadShadersFromFiles()
+{
+    TraceScope trace("LoadShadersFromFiles");
+
+    // Note que o caminho para os arquivos "shader_vertex.glsl" e
     // "shader_fragment.glsl" estão fixados, sendo que assumimos a existência
     // da seguinte estrutura no sistema de arquivos:
     //
@@ -1285,50 +2304,174 @@ void LoadShadersFromFiles()
     //       |
     //       o-- shader_fragment.glsl
     //
-    GLuint vertex_shader_id = LoadShader_Vertex("../../src/shader_vertex.glsl");
-    GLuint fragment_shader_id = LoadShader_Fragment("../../src/shader_fragment.glsl");
+    //
+    // Cada material é compilado com um #define próprio (veja o início de
+    // "shader_fragment.glsl") e lê sua imagem de textura da unidade escolhida
+    // pelo gerenciador de recursos (veja UpdateMaterialTextureUnits()).
+    static const char* const variants[NUM_MATERIALS] = {
+        "#define MATERIAL_SPHERE\n",
+        "#define MATERIAL_BALL\n",
+        "#define MATERIAL_GUN\n",
+        "#define MATERIAL_TABLE_TOP\n",
+        "#define MATERIAL_BRICK_ROOM\n",
+        "#define MATERIAL_AK47\n",
+        "#define MATERIAL_UNKNOWN\n",
+    };
+
+    // Deletamos os programas de GPU anteriores, caso eles existam, para que
+    // sejam recompilados a partir dos arquivos (tecla "R").
+    for (std::map<std::string, GLuint>::iterator it = g_GpuProgramCache.begin(); it != g_GpuProgramCache.end(); ++it)
+        glDeleteProgram(it->second);
+    g_GpuProgramCache.clear();
+
+    // Os ids dos programas deletados podem ser reaproveitados pelo driver
+    GLState_Invalidate();
+
+    for (int material = 0; material < NUM_MATERIALS; ++material)
+    {
+        GLuint program_id = LoadGpuProgram("../../src/shader_vertex.glsl", "../../src/shader_fragment.glsl", variants[material]);
+        g_MaterialPrograms[material] = program_id;
+
+        // Matrizes, bbox e identificador do objeto ficam em blocos de uniforms
+        // ("uniform blocks"), ligados aos pontos de ligação dos buffers criados
+        // em CreateUniformBuffers().
+        glUniformBlockBinding(program_id, glGetUniformBlockIndex(program_id, "FrameUniforms"), FRAME_UNIFORMS_BINDING);
+        glUniformBlockBinding(program_id, glGetUniformBlockIndex(program_id, "ObjectUniforms"), OBJECT_UNIFORMS_BINDING);
+    }
 
-    // Deletamos o programa de GPU anterior, caso ele exista.
-    if ( g_GpuProgramID != 0 )
-        glDeleteProgram(g_GpuProgramID);
+    UpdateMaterialTextureUnits();
+}
+
+// Aponta a variável "material_texture" de "shader_fragment.glsl", em cada
+// programa de material, para a unidade de textura da textura do material
+// (veja g_MaterialTextures). Deve ser chamada depois que as texturas são
+// carregadas e sempre que os programas são recompilados.
+void UpdateMaterialTextureUnits()
+{
+    for (int material = 0; material < NUM_MATERIALS; ++material)
+    {
+        if ( g_MaterialTextures[material] < 0 )
+            continue;
+
+        GLuint program_id = g_MaterialPrograms[material];
+        GLState_UseProgram(program_id);
+        glUniform1i(glGetUniformLocation(program_id, "material_texture"), Resources_TextureUnit(g_MaterialTextures[material]));
+    }
+}
+
+// Retorna um programa de GPU compilado a partir dos arquivos GLSL dados, com
+// as linhas "defines" inseridas logo após a linha "#version" de cada shader.
+// Programas já compilados com os mesmos parâmetros são reaproveitados.
+GLuint LoadGpuProgram(const char* vertex_filename, const char* fragment_filename, const char* defines)
+{
+    std::string key = std::string(vertex_filename) + "|" + fragment_filename + "|" + defines;
+
+    std::map<std::string, GLuint>::iterator it = g_GpuProgramCache.find(key);
+    if ( it != g_GpuProgramCache.end() )
+        return it->second;
+
+    GLuint vertex_shader_id = LoadShader_Vertex(vertex_filename, defines);
+    GLuint fragment_shader_id = LoadShader_Fragment(fragment_filename, defines);
 
     // Criamos um programa de GPU utilizando os shaders carregados acima.
-    g_GpuProgramID = CreateGpuProgram(vertex_shader_id, fragment_shader_id);
-
-    // Buscamos o endereço das variáveis definidas dentro do Vertex Shader.
-    // Utilizaremos estas variáveis para enviar dados para a placa de vídeo
-    // (GPU)! Veja arquivo "shader_vertex.glsl" e "shader_fragment.glsl".
-    g_model_uniform      = glGetUniformLocation(g_GpuProgramID, "model"); // Variável da matriz "model"
-    g_view_uniform       = glGetUniformLocation(g_GpuProgramID, "view"); // Variável da matriz "view" em shader_vertex.glsl
-    g_projection_uniform = glGetUniformLocation(g_GpuProgramID, "projection"); // Variável da matriz "projection" em shader_vertex.glsl
-    g_object_id_uniform  = glGetUniformLocation(g_GpuProgramID, "object_id"); // Variável "object_id" em shader_fragment.glsl
-    g_bbox_min_uniform   = glGetUniformLocation(g_GpuProgramID, "bbox_min");
-    g_bbox_max_uniform   = glGetUniformLocation(g_GpuProgramID, "bbox_max");
-
-    // Variáveis em "shader_fragment.glsl" para acesso das imagens de textura
-    glUseProgram(g_GpuProgramID);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureTableTop"), 0);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TexturePoolTable"), 1);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureObjUnkown"), 2);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureCueBall"), 3);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall1"), 4);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall2"), 5);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall3"), 6);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall4"), 7);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall5"), 8);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall6"), 9);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall7"), 10);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall8"), 11);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall9"), 12);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall10"), 13);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall11"), 14);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall12"), 15);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall13"), 16);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall14"), 17);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "TextureBall15"), 18);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "brick_room_texture"), 19);
-    glUniform1i(glGetUniformLocation(g_GpuProgramID, "ak47_texture"), 20);
-    glUseProgram(0);
+    GLuint program_id = CreateGpuProgram(vertex_shader_id, fragment_shader_id);
+
+    g_GpuProgramCache[key] = program_id;
+    return program_id;
+}
+
+// Material usado para desenhar um objeto com o object_id dado. Note que
+// BRICK_ROOM (21) está dentro da faixa de ids das bolas, então é testado antes.
+Material MaterialFromObjectId(int object_id)
+{
+    if ( object_id == SPHERE )
+        return MATERIAL_SPHERE;
+    if ( object_id == GUN )
+        return MATERIAL_GUN;
+    if ( object_id == TABLE_TOP )
+        return MATERIAL_TABLE_TOP;
+    if ( object_id == BRICK_ROOM )
+        return MATERIAL_BRICK_ROOM;
+    if ( object_id == AK47 )
+        return MATERIAL_AK47;
+    if ( object_id >= 10 && object_id <= 25 )
+        return MATERIAL_BALL;
+    return MATERIAL_UNKNOWN;
+}
+
+// Ativa o programa de GPU do material, caso ele já não esteja ativo.
+void UseMaterial(Material material)
+{
+    GLState_UseProgram(g_MaterialPrograms[material]);
+}
+
+// Cria os buffers que armazenam os blocos "FrameUniforms" e "ObjectUniforms"
+// e os associa aos seus pontos de ligação. Os programas de GPU criados em
+// LoadShadersFromFiles() leem destes mesmos pontos, então os buffers
+// sobrevivem à recarga dos shaders.
+void CreateUniformBuffers()
+{
+    glGenBuffers(1, &g_FrameUniformBufferId);
+    GLState_BindBuffer(GL_UNIFORM_BUFFER, g_FrameUniformBufferId);
+    GLState_BufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, g_FrameUniformBufferId);
+
+    glGenBuffers(1, &g_ObjectUniformBufferId);
+    GLState_BindBuffer(GL_UNIFORM_BUFFER, g_ObjectUniformBufferId);
+    GLState_BufferData(GL_UNIFORM_BUFFER, sizeof(ObjectUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, OBJECT_UNIFORMS_BINDING, g_ObjectUniformBufferId);
+
+    GLState_BindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Envia os dados que são constantes durante todo o quadro.
+void UpdateFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec4& camera_position)
+{
+    FrameUniforms frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.camera_position = camera_position;
+    frame.light_direction = normalize(glm::vec4(1.0f,12.0f,0.0f,0.0f));
+    frame.gouraud_light_direction = normalize(glm::vec4(1.0f,1.0f,0.0f,0.0f));
+
+    GLState_UniformBufferData(g_FrameUniformBufferId, &frame, sizeof(FrameUniforms));
+}
+
+// Envia os dados do objeto que será desenhado a seguir. A matriz das
+// normais é computada aqui, uma vez por objeto, e não a cada vértice.
+void UpdateObjectUniforms(const glm::mat4& model, int object_id, const SceneObject& object)
+{
+    ObjectUniforms uniforms;
+    uniforms.model = model;
+    uniforms.normal_matrix = glm::inverseTranspose(model);
+    uniforms.bbox_min = glm::vec4(object.bbox_min, 1.0f);
+    uniforms.bbox_max = glm::vec4(object.bbox_max, 1.0f);
+    uniforms.material = glm::ivec4(object_id, 0, 0, 0);
+
+    // Objetos desenhados em seguida com os mesmos dados (os lotes de
+    // esferas, por exemplo) não reenviam o bloco.
+    GLState_UniformBufferData(g_ObjectUniformBufferId, &uniforms, sizeof(ObjectUniforms));
+}
+
+// Escolhe o nível de detalhe de um objeto pelo tamanho aproximado da sua
+// projeção na tela, dada a sua esfera envolvente (center, radius) em
+// coordenadas globais. O tamanho é o raio projetado como fração de metade
+// da altura da janela; na projeção ortográfica ele não depende da distância.
+int SelectLevelOfDetail(const glm::vec3& center, float radius)
+{
+    float screen_size = radius * g_ProjectionScale;
+    if ( g_UsePerspectiveProjection )
+    {
+        float distance = glm::length(center - glm::vec3(g_FinalCameraCoords));
+        screen_size /= std::max(distance, radius);
+    }
+
+    for (int lod = 0; lod < NUM_LODS - 1; ++lod)
+    {
+        if ( screen_size >= g_LodScreenSizes[lod] )
+            return lod;
+    }
+    return NUM_LODS - 1;
 }
 
 // Função que pega a matriz M e guarda a mesma no topo da pilha
@@ -1355,6 +2498,8 @@ void PopMatrix(glm::mat4& M)
 // especificadas dentro do arquivo ".obj"
 void ComputeNormals(ObjModel* model)
 {
+    TraceScope trace("ComputeNormals");
+
     if ( !model->attrib.normals.empty() )
         return;
 
@@ -1414,18 +2559,56 @@ void ComputeNormals(ObjModel* model)
     }
 }
 
-// Constrói triângulos para futura renderização a partir de um ObjModel.
-void BuildTrianglesAndAddToVirtualScene(ObjModel* model)
+// Processa os triângulos de um ObjModel para futura renderização: junta
+// vértices idênticos, reordena os triângulos, gera os níveis de detalhe e
+// compacta os vértices e índices (veja "meshOptimization.hpp"). Não usa
+// OpenGL, então pode ser chamada em uma thread auxiliar; o resultado é
+// enviado à GPU por AddMeshToVirtualScene().
+//
+// Com "planar_texcoords", as coordenadas de textura do ".obj" são trocadas
+// pela projeção planar XY da posição, normalizada pela bbox de cada objeto
+// (veja slides 99-104 e 158-160 do documento
+// Aula_20_Mapeamento_de_Texturas.pdf). Calculadas aqui, e não no shader,
+// elas continuam usando a bbox de cada parte depois que as partes são
+// combinadas em um só objeto (veja AddMergedObjectToVirtualScene()).
+void BuildMeshData(ObjModel* model, MeshData* mesh, bool planar_texcoords)
 {
-    GLuint vertex_array_object_id;
-    glGenVertexArrays(1, &vertex_array_object_id);
-    glBindVertexArray(vertex_array_object_id);
+    TraceScope trace("BuildMeshData", model->filename.c_str());
+
+    static_assert(NUM_LODS <= MESH_MAX_LODS, "NUM_LODS maior que o suportado por \"meshCache.hpp\"");
 
     std::vector<GLuint> indices;
     std::vector<float>  model_coefficients;
     std::vector<float>  normal_coefficients;
     std::vector<float>  texture_coefficients;
 
+    // Índices dos níveis de detalhe 1 em diante, de todos os objetos. São
+    // copiados para o final de indices[] depois do laço abaixo, um nível
+    // após o outro, de forma que as partes vizinhas de um objeto combinado
+    // (veja AddMergedObjectToVirtualScene()) continuem vizinhas em todos os
+    // níveis.
+    std::vector<GLuint> lod_indices[NUM_LODS];
+    std::vector<MeshObject> objects;
+
+    // Cada combinação distinta de posição, normal e coordenadas de textura
+    // vira um único vértice, compartilhado por todos os triângulos que a usam.
+    std::map<VertexKey, GLuint> vertex_index;
+    size_t num_corners = 0;
+
+    // Um ".obj" pode misturar faces com e sem normais ("vn") ou coordenadas
+    // de textura ("vt"). Todo vértice recebe uma normal e uma coordenada de
+    // textura (zeradas quando faltam, como na chave acima), para que os três
+    // vetores de atributos tenham sempre o mesmo número de vértices; eles só
+    // são descartados se nenhuma face os tiver.
+    bool any_normals = false;
+    bool any_texcoords = planar_texcoords;
+
+    // ACMR (veja ComputeACMR()) antes e depois de reordenar os triângulos,
+    // ponderado pelo número de triângulos de cada forma
+    const int acmr_cache_size = 16;
+    float acmr_before = 0.0f;
+    float acmr_after = 0.0f;
+
     for (size_t shape = 0; shape < model->shapes.size(); ++shape)
     {
         size_t first_index = indices.size();
@@ -1437,6 +2620,23 @@ void BuildTrianglesAndAddToVirtualScene(ObjModel* model)
         glm::vec3 bbox_min = glm::vec3(maxval,maxval,maxval);
         glm::vec3 bbox_max = glm::vec3(minval,minval,minval);
 
+        // A projeção planar precisa da bbox do objeto antes do laço abaixo
+        glm::vec3 planar_min = glm::vec3(maxval,maxval,maxval);
+        glm::vec3 planar_max = glm::vec3(-maxval,-maxval,-maxval);
+        if ( planar_texcoords )
+        {
+            for (size_t corner = 0; corner < 3*num_triangles; ++corner)
+            {
+                int vertex_index = model->shapes[shape].mesh.indices[corner].vertex_index;
+                glm::vec3 position(model->attrib.vertices[3*vertex_index + 0],
+                                   model->attrib.vertices[3*vertex_index + 1],
+                                   model->attrib.vertices[3*vertex_index + 2]);
+                planar_min = glm::min(planar_min, position);
+                planar_max = glm::max(planar_max, position);
+            }
+        }
+        glm::vec3 planar_size = glm::max(planar_max - planar_min, glm::vec3(1e-6f));
+
         for (size_t triangle = 0; triangle < num_triangles; ++triangle)
         {
             assert(model->shapes[shape].mesh.num_face_vertices[triangle] == 3);
@@ -1445,15 +2645,9 @@ void BuildTrianglesAndAddToVirtualScene(ObjModel* model)
             {
                 tinyobj::index_t idx = model->shapes[shape].mesh.indices[3*triangle + vertex];
 
-                indices.push_back(first_index + 3*triangle + vertex);
-
                 const float vx = model->attrib.vertices[3*idx.vertex_index + 0];
                 const float vy = model->attrib.vertices[3*idx.vertex_index + 1];
                 const float vz = model->attrib.vertices[3*idx.vertex_index + 2];
-                model_coefficients.push_back( vx ); // X
-                model_coefficients.push_back( vy ); // Y
-                model_coefficients.push_back( vz ); // Z
-                model_coefficients.push_back( 1.0f ); // W
 
                 bbox_min.x = std::min(bbox_min.x, vx);
                 bbox_min.y = std::min(bbox_min.y, vy);
@@ -1462,133 +2656,475 @@ void BuildTrianglesAndAddToVirtualScene(ObjModel* model)
                 bbox_max.y = std::max(bbox_max.y, vy);
                 bbox_max.z = std::max(bbox_max.z, vz);
 
-                // Inspecionando o código da tinyobjloader, o aluno Bernardo
-                // Sulzbach (2017/1) apontou que a maneira correta de testar se
-                // existem normais e coordenadas de textura no ObjModel é
-                // comparando se o índice retornado é -1. Fazemos isso abaixo.
+                num_corners += 1;
 
+                VertexKey key;
+                key.attributes[0] = vx;
+                key.attributes[1] = vy;
+                key.attributes[2] = vz;
                 if ( idx.normal_index != -1 )
                 {
-                    const float nx = model->attrib.normals[3*idx.normal_index + 0];
-                    const float ny = model->attrib.normals[3*idx.normal_index + 1];
-                    const float nz = model->attrib.normals[3*idx.normal_index + 2];
-                    normal_coefficients.push_back( nx ); // X
-                    normal_coefficients.push_back( ny ); // Y
-                    normal_coefficients.push_back( nz ); // Z
-                    normal_coefficients.push_back( 0.0f ); // W
+                    key.attributes[3] = model->attrib.normals[3*idx.normal_index + 0];
+                    key.attributes[4] = model->attrib.normals[3*idx.normal_index + 1];
+                    key.attributes[5] = model->attrib.normals[3*idx.normal_index + 2];
+                }
+                if ( planar_texcoords )
+                {
+                    key.attributes[6] = (vx - planar_min.x) / planar_size.x;
+                    key.attributes[7] = (vy - planar_min.y) / planar_size.y;
+                }
+                else if ( idx.texcoord_index != -1 )
+                {
+                    key.attributes[6] = model->attrib.texcoords[2*idx.texcoord_index + 0];
+                    key.attributes[7] = model->attrib.texcoords[2*idx.texcoord_index + 1];
                 }
 
-                if ( idx.texcoord_index != -1 )
+                std::map<VertexKey, GLuint>::iterator existing = vertex_index.find(key);
+                if ( existing != vertex_index.end() )
                 {
-                    const float u = model->attrib.texcoords[2*idx.texcoord_index + 0];
-                    const float v = model->attrib.texcoords[2*idx.texcoord_index + 1];
-                    texture_coefficients.push_back( u );
-                    texture_coefficients.push_back( v );
+                    indices.push_back(existing->second);
+                    continue;
                 }
+
+                GLuint new_index = model_coefficients.size() / 4;
+                vertex_index[key] = new_index;
+                indices.push_back(new_index);
+
+                model_coefficients.push_back( vx ); // X
+                model_coefficients.push_back( vy ); // Y
+                model_coefficients.push_back( vz ); // Z
+                model_coefficients.push_back( 1.0f ); // W
+
+                // Inspecionando o código da tinyobjloader, o aluno Bernardo
+                // Sulzbach (2017/1) apontou que a maneira correta de testar se
+                // existem normais e coordenadas de textura no ObjModel é
+                // comparando se o índice retornado é -1. Fazemos isso abaixo.
+
+                any_normals   = any_normals || idx.normal_index != -1;
+                any_texcoords = any_texcoords || idx.texcoord_index != -1;
+
+                normal_coefficients.push_back( key.attributes[3] ); // X
+                normal_coefficients.push_back( key.attributes[4] ); // Y
+                normal_coefficients.push_back( key.attributes[5] ); // Z
+                normal_coefficients.push_back( 0.0f ); // W
+
+                texture_coefficients.push_back( key.attributes[6] ); // U
+                texture_coefficients.push_back( key.attributes[7] ); // V
             }
         }
 
         size_t last_index = indices.size() - 1;
 
-        SceneObject theobject;
+        MeshObject theobject;
         theobject.name           = model->shapes[shape].name;
-        theobject.first_index    = first_index; // Primeiro índice
-        theobject.num_indices    = last_index - first_index + 1; // Número de indices
+        theobject.first_index[0] = first_index; // Primeiro índice
+        theobject.num_indices[0] = last_index - first_index + 1; // Número de indices
+        theobject.bbox_min       = bbox_min;
+        theobject.bbox_max       = bbox_max;
+
+        // Reordenamos os triângulos para aproveitar o cache de vértices
+        // transformados da GPU
+        acmr_before += ComputeACMR(&indices[first_index], theobject.num_indices[0], acmr_cache_size) * (theobject.num_indices[0] / 3);
+        OptimizeVertexCache(&indices[first_index], theobject.num_indices[0]);
+        acmr_after += ComputeACMR(&indices[first_index], theobject.num_indices[0], acmr_cache_size) * (theobject.num_indices[0] / 3);
+
+        // Geramos os níveis de detalhe simplificando a malha original. Cada
+        // nível tem metade dos triângulos do anterior, mas nunca menos de 64,
+        // abaixo do que as malhas ficam visivelmente poligonais.
+        size_t target_index_counts[NUM_LODS - 1];
+        for (int lod = 1; lod < NUM_LODS; ++lod)
+            target_index_counts[lod - 1] = std::max(theobject.num_indices[0] >> lod, (size_t)(3 * 64));
+
+        std::vector<GLuint> levels[NUM_LODS - 1];
+        SimplifyMesh(model_coefficients, &indices[first_index], theobject.num_indices[0],
+                     target_index_counts, NUM_LODS - 1, levels);
+
+        for (int lod = 1; lod < NUM_LODS; ++lod)
+        {
+            OptimizeVertexCache(levels[lod - 1].data(), levels[lod - 1].size());
+
+            theobject.first_index[lod] = lod_indices[lod].size(); // Relativo ao início do nível; corrigido abaixo
+            theobject.num_indices[lod] = levels[lod - 1].size();
+            lod_indices[lod].insert(lod_indices[lod].end(), levels[lod - 1].begin(), levels[lod - 1].end());
+        }
+
+        const std::vector<int>& material_ids = model->shapes[shape].mesh.material_ids;
+        theobject.material_id = material_ids.empty() ? -1 : material_ids[0];
+
+        objects.push_back(theobject);
+    }
+
+    size_t num_triangles = num_corners / 3;
+    if ( num_triangles > 0 )
+    {
+        printf("Modelo \"%s\": %d vértices (antes %d), ACMR %.2f -> %.2f.\n",
+               model->filename.c_str(), (int)(model_coefficients.size() / 4), (int)num_corners,
+               acmr_before / num_triangles, acmr_after / num_triangles);
+    }
+
+    // Memória de GPU dos vértices e índices: formato compacto contra três
+    // buffers de floats com índices de 32 bits
+    size_t num_vertices = model_coefficients.size() / 4;
+    GLenum index_type = IndexTypeForVertexCount(num_vertices);
+
+    for (int lod = 1; lod < NUM_LODS; ++lod)
+    {
+        size_t level_start = indices.size();
+        indices.insert(indices.end(), lod_indices[lod].begin(), lod_indices[lod].end());
+
+        for (size_t i = 0; i < objects.size(); ++i)
+            objects[i].first_index[lod] += level_start;
+    }
+
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        const MeshObject& object = objects[i];
+        printf("Objeto '%s': LODs com %d/%d/%d/%d triângulos.\n", object.name.c_str(),
+               (int)object.num_indices[0] / 3, (int)object.num_indices[1] / 3,
+               (int)object.num_indices[2] / 3, (int)object.num_indices[3] / 3);
+    }
+
+    size_t unpacked_bytes = num_vertices * 10 * sizeof(float) + indices.size() * sizeof(GLuint);
+    size_t packed_bytes   = num_vertices * sizeof(PackedVertex) + indices.size() * IndexTypeSize(index_type);
+    printf("Modelo \"%s\": %d KiB na GPU (antes %d KiB).\n", model->filename.c_str(),
+           (int)(packed_bytes / 1024), (int)(unpacked_bytes / 1024));
+
+    if ( !any_normals )
+        normal_coefficients.clear();
+    if ( !any_texcoords )
+        texture_coefficients.clear();
+
+    // Todos os atributos vão intercalados em um único VBO (veja PackedVertex)
+    mesh->vertex_storage = PackVertices(model_coefficients, normal_coefficients, texture_coefficients);
+
+    // Modelos com menos de 65536 vértices usam índices de 16 bits
+    if ( index_type == GL_UNSIGNED_SHORT )
+    {
+        std::vector<GLushort> short_indices(indices.begin(), indices.end());
+        mesh->index_storage.assign((const unsigned char*)short_indices.data(),
+                                   (const unsigned char*)(short_indices.data() + short_indices.size()));
+    }
+    else
+    {
+        mesh->index_storage.assign((const unsigned char*)indices.data(),
+                                   (const unsigned char*)(indices.data() + indices.size()));
+    }
+
+    mesh->name          = model->shapes[0].name;
+    mesh->num_lods      = NUM_LODS;
+    mesh->has_normals   = !normal_coefficients.empty();
+    mesh->has_texcoords = !texture_coefficients.empty();
+    mesh->planar_texcoords = planar_texcoords;
+    mesh->objects       = objects;
+    mesh->vertices      = mesh->vertex_storage.data();
+    mesh->num_vertices  = mesh->vertex_storage.size();
+    mesh->indices       = mesh->index_storage.data();
+    mesh->num_indices   = indices.size();
+    mesh->index_type    = index_type;
+}
+
+// Lê o modelo "filename" e o processa com BuildMeshData(), ou, se possível,
+// mapeia em memória o resultado já processado em uma execução anterior
+// (veja "meshCache.hpp"). Não usa OpenGL, então pode ser chamada em uma
+// thread auxiliar.
+void LoadMesh(const char* filename, MeshData* mesh, bool planar_texcoords)
+{
+    TraceScope trace("LoadMesh", filename);
+
+    std::string cache_filename = std::string(filename) + ".fmesh";
+    if ( MeshCache_Read(filename, cache_filename.c_str(), NUM_LODS, planar_texcoords, mesh) )
+    {
+        printf("Modelo \"%s\": %d vértices, lido de \"%s\".\n",
+               filename, (int)mesh->num_vertices, cache_filename.c_str());
+        return;
+    }
+
+    ObjModel model(filename);
+    ComputeNormals(&model);
+    BuildMeshData(&model, mesh, planar_texcoords);
+    mesh->source = filename;
+    HashFile(filename, &mesh->source_hash);
+
+    if ( !MeshCache_Write(filename, cache_filename.c_str(), *mesh) )
+        fprintf(stderr, "WARNING: Cannot write mesh cache \"%s\".\n", cache_filename.c_str());
+}
+
+// Envia à GPU um modelo processado por BuildMeshData() ou lido por
+// LoadMesh(), e adiciona os seus objetos à cena virtual. Retorna o handle do
+// modelo no gerenciador de recursos (veja "resourceManager.hpp"), com uma
+// referência. Um modelo já carregado, pelo mesmo arquivo ou por outro de
+// mesmo conteúdo, não é enviado de novo: os seus objetos já estão na cena.
+int AddMeshToVirtualScene(const MeshData& mesh)
+{
+    TraceScope trace("AddMeshToVirtualScene", mesh.name.c_str());
+
+    int resource = Resources_Find(mesh.source.c_str());
+    if ( resource >= 0 )
+        return Resources_AddRef(resource);
+    resource = Resources_FindByHash(RESOURCE_MESH, mesh.source_hash);
+    if ( resource >= 0 )
+    {
+        printf("Modelo \"%s\": mesmo conteúdo de \"%s\".\n", mesh.source.c_str(), g_Resources.items[resource].path.c_str());
+        return Resources_AddAlias(mesh.source.c_str(), resource);
+    }
+
+    GLuint vertex_array_object_id;
+    glGenVertexArrays(1, &vertex_array_object_id);
+    GLState_BindVertexArray(vertex_array_object_id);
+
+    for (size_t i = 0; i < mesh.objects.size(); ++i)
+    {
+        const MeshObject& object = mesh.objects[i];
+
+        SceneObject theobject;
+        theobject.name           = object.name;
+        theobject.first_index    = object.first_index[0]; // Primeiro índice
+        theobject.num_indices    = object.num_indices[0]; // Número de indices
         theobject.rendering_mode = GL_TRIANGLES;       // Índices correspondem ao tipo de rasterização GL_TRIANGLES.
         theobject.vertex_array_object_id = vertex_array_object_id;
+        theobject.index_type     = mesh.index_type;
+        theobject.bbox_min       = object.bbox_min;
+        theobject.bbox_max       = object.bbox_max;
+        theobject.material_id    = object.material_id;
 
-        theobject.bbox_min = bbox_min;
-        theobject.bbox_max = bbox_max;
+        SceneObjectPart part;
+        for (int lod = 0; lod < NUM_LODS; ++lod)
+        {
+            part.first_index[lod] = object.first_index[lod];
+            part.num_indices[lod] = object.num_indices[lod];
+        }
+        part.bbox_min = object.bbox_min;
+        part.bbox_max = object.bbox_max;
+        theobject.parts.push_back(part);
 
-        g_VirtualScene[model->shapes[shape].name] = theobject;
+        AddObjectToVirtualScene(theobject);
     }
 
-    GLuint VBO_model_coefficients_id;
-    glGenBuffers(1, &VBO_model_coefficients_id);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_model_coefficients_id);
-    glBufferData(GL_ARRAY_BUFFER, model_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, model_coefficients.size() * sizeof(float), model_coefficients.data());
+    GLuint VBO_vertices_id;
+    glGenBuffers(1, &VBO_vertices_id);
+    GLState_BindBuffer(GL_ARRAY_BUFFER, VBO_vertices_id);
+    GLState_BufferData(GL_ARRAY_BUFFER, mesh.num_vertices * sizeof(PackedVertex), NULL, GL_STATIC_DRAW);
+    GLState_BufferSubData(GL_ARRAY_BUFFER, 0, mesh.num_vertices * sizeof(PackedVertex), mesh.vertices);
+
     GLuint location = 0; // "(location = 0)" em "shader_vertex.glsl"
-    GLint  number_of_dimensions = 4; // vec4 em "shader_vertex.glsl"
-    glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
+    GLint  number_of_dimensions = 3; // vec3 em "shader_vertex.glsl"
+    glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE,
+                          sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
     glEnableVertexAttribArray(location);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    if ( !normal_coefficients.empty() )
+    if ( mesh.has_normals )
     {
-        GLuint VBO_normal_coefficients_id;
-        glGenBuffers(1, &VBO_normal_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_normal_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, normal_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, normal_coefficients.size() * sizeof(float), normal_coefficients.data());
         location = 1; // "(location = 1)" em "shader_vertex.glsl"
-        number_of_dimensions = 4; // vec4 em "shader_vertex.glsl"
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
+        number_of_dimensions = 4; // x, y, z de 10 bits e w de 2 bits
+        glVertexAttribPointer(location, number_of_dimensions, GL_INT_2_10_10_10_REV, GL_TRUE,
+                              sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
         glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-    if ( !texture_coefficients.empty() )
+    if ( mesh.has_texcoords )
     {
-        GLuint VBO_texture_coefficients_id;
-        glGenBuffers(1, &VBO_texture_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_texture_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, texture_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, texture_coefficients.size() * sizeof(float), texture_coefficients.data());
-        location = 2; // "(location = 1)" em "shader_vertex.glsl"
+        location = 2; // "(location = 2)" em "shader_vertex.glsl"
         number_of_dimensions = 2; // vec2 em "shader_vertex.glsl"
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
+        glVertexAttribPointer(location, number_of_dimensions, GL_HALF_FLOAT, GL_FALSE,
+                              sizeof(PackedVertex), (void*)offsetof(PackedVertex, texcoords));
         glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
+    GLState_BindBuffer(GL_ARRAY_BUFFER, 0);
 
     GLuint indices_id;
     glGenBuffers(1, &indices_id);
 
     // "Ligamos" o buffer. Note que o tipo agora é GL_ELEMENT_ARRAY_BUFFER.
+    // Modelos com menos de 65536 vértices usam índices de 16 bits.
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), NULL, GL_STATIC_DRAW);
-    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+    size_t index_bytes = mesh.num_indices * IndexTypeSize(mesh.index_type);
+    GLState_BufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, NULL, GL_STATIC_DRAW);
+    GLState_BufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, index_bytes, mesh.indices);
     // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); // XXX Errado!
     //
 
     // "Desligamos" o VAO, evitando assim que operações posteriores venham a
     // alterar o mesmo. Isso evita bugs.
-    glBindVertexArray(0);
+    GLState_BindVertexArray(0);
+
+    // Um modelo carregado de novo depois de descarregado volta com os
+    // objetos combinados a partir dos seus
+    RebuildMergedObjects(vertex_array_object_id);
+
+    return Resources_AddMesh(mesh.source.c_str(), mesh.source_hash, vertex_array_object_id, VBO_vertices_id, indices_id,
+                             mesh.num_vertices * sizeof(PackedVertex) + index_bytes);
+}
+
+// Chamada pelo gerenciador de recursos antes de descarregar um modelo:
+// os objetos da cena virtual que usam o seu VAO (inclusive os combinados por
+// AddMergedObjectToVirtualScene()) ficam sem partes, e portanto deixam de ser
+// desenhados. Os nomes continuam em g_VirtualSceneHandles, então um modelo
+// carregado de novo reaproveita os mesmos handles, e os seus objetos
+// combinados são refeitos por AddMeshToVirtualScene().
+void RemoveVertexArrayFromVirtualScene(GLuint vertex_array_object_id)
+{
+    for (size_t i = 0; i < g_VirtualScene.size(); ++i)
+    {
+        SceneObject& object = g_VirtualScene[i];
+        if ( object.vertex_array_object_id != vertex_array_object_id )
+            continue;
+        object.parts.clear();
+        object.num_indices = 0;
+        object.vertex_array_object_id = 0;
+    }
+
+    // Os ids do VAO e dos buffers deletados podem ser reaproveitados pelo driver
+    GLState_Invalidate();
+}
+
+
+// Constrói triângulos para futura renderização a partir de um ObjModel, lido
+// de "filename", e retorna o handle do recurso (veja AddMeshToVirtualScene()).
+int BuildTrianglesAndAddToVirtualScene(ObjModel* model, const char* filename)
+{
+    MeshData mesh;
+    BuildMeshData(model, &mesh);
+    mesh.source = filename;
+    HashFile(filename, &mesh.source_hash);
+    return AddMeshToVirtualScene(mesh);
+}
+
+// Cria em g_VirtualScene um objeto "merged_name" que desenha, de uma vez, os
+// objetos "object_names" já construídos por BuildTrianglesAndAddToVirtualScene().
+// Todos devem pertencer ao mesmo modelo (mesmo VAO) e usar o mesmo material.
+// Cada objeto original vira uma parte do objeto combinado, com a sua própria
+// AABB; DrawVirtualObject() descarta as partes fora do frustum e junta as
+// faixas de índices vizinhas das demais em uma única chamada glDrawElements()
+// ou glMultiDrawElements().
+//
+// A combinação fica registrada em g_MergedObjects e é refeita sempre que o
+// modelo for carregado de novo (veja RebuildMergedObjects()).
+void BuildMergedObject(const MergedObject& description)
+{
+    const char* merged_name = description.name.c_str();
+    int count = (int)description.object_names.size();
+
+    SceneObject merged;
+    merged.name        = merged_name;
+    merged.num_indices = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const SceneObject& object = g_VirtualScene[GetVirtualObjectHandle(description.object_names[i].c_str())];
+
+        if ( i == 0 )
+        {
+            merged.rendering_mode = object.rendering_mode;
+            merged.vertex_array_object_id = object.vertex_array_object_id;
+            merged.index_type     = object.index_type;
+            merged.bbox_min       = object.bbox_min;
+            merged.bbox_max       = object.bbox_max;
+            merged.material_id    = object.material_id;
+        }
+
+        if ( object.vertex_array_object_id != merged.vertex_array_object_id )
+        {
+            fprintf(stderr, "ERROR: Object \"%s\" belongs to a different model than the rest of \"%s\".\n", object.name.c_str(), merged_name);
+            std::exit(EXIT_FAILURE);
+        }
+
+        if ( object.material_id != merged.material_id )
+            fprintf(stderr, "WARNING: Object \"%s\" uses a different material than the rest of \"%s\".\n", object.name.c_str(), merged_name);
+
+        merged.parts.insert(merged.parts.end(), object.parts.begin(), object.parts.end());
+        merged.num_indices += object.num_indices;
+        merged.bbox_min = glm::min(merged.bbox_min, object.bbox_min);
+        merged.bbox_max = glm::max(merged.bbox_max, object.bbox_max);
+    }
+
+    std::sort(merged.parts.begin(), merged.parts.end(), [](const SceneObjectPart& a, const SceneObjectPart& b) {
+        return a.first_index[0] < b.first_index[0];
+    });
+    merged.first_index = merged.parts[0].first_index[0];
+
+    // Número de faixas contíguas quando todas as partes estão visíveis
+    int num_ranges = 1;
+    for (size_t i = 1; i < merged.parts.size(); ++i)
+    {
+        if ( merged.parts[i].first_index[0] != merged.parts[i-1].first_index[0] + merged.parts[i-1].num_indices[0] )
+            num_ranges += 1;
+    }
+
+    printf("Objeto combinado '%s': %d partes em %d faixa(s) de índices.\n",
+           merged_name, count, num_ranges);
+
+    AddObjectToVirtualScene(merged);
+}
+
+void AddMergedObjectToVirtualScene(const char* merged_name, const char* const* object_names, int count)
+{
+    MergedObject description;
+    description.name = merged_name;
+    description.object_names.assign(object_names, object_names + count);
+
+    // Uma combinação pedida de novo com o mesmo nome substitui a anterior
+    for (size_t i = 0; i < g_MergedObjects.size(); ++i)
+    {
+        if ( g_MergedObjects[i].name == description.name )
+        {
+            g_MergedObjects[i] = description;
+            BuildMergedObject(description);
+            return;
+        }
+    }
+
+    g_MergedObjects.push_back(description);
+    BuildMergedObject(description);
+}
+
+// Refaz os objetos combinados cujas partes pertencem ao modelo
+// "vertex_array_object_id", que acabou de ser enviado à GPU
+void RebuildMergedObjects(GLuint vertex_array_object_id)
+{
+    for (size_t i = 0; i < g_MergedObjects.size(); ++i)
+    {
+        const MergedObject& description = g_MergedObjects[i];
+        const SceneObject& first = g_VirtualScene[GetVirtualObjectHandle(description.object_names[0].c_str())];
+        if ( first.vertex_array_object_id == vertex_array_object_id )
+            BuildMergedObject(description);
+    }
 }
 
 // Carrega um Vertex Shader de um arquivo GLSL. Veja definição de LoadShader() abaixo.
-GLuint LoadShader_Vertex(const char* filename)
+GLuint LoadShader_Vertex(const char* filename, const char* defines)
 {
     // Criamos um identificador (ID) para este shader, informando que o mesmo
     // será aplicado nos vértices.
     GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
 
     // Carregamos e compilamos o shader
-    LoadShader(filename, vertex_shader_id);
+    LoadShader(filename, vertex_shader_id, defines);
 
     // Retorna o ID gerado acima
     return vertex_shader_id;
 }
 
 // Carrega um Fragment Shader de um arquivo GLSL . Veja definição de LoadShader() abaixo.
-GLuint LoadShader_Fragment(const char* filename)
+GLuint LoadShader_Fragment(const char* filename, const char* defines)
 {
     // Criamos um identificador (ID) para este shader, informando que o mesmo
     // será aplicado nos fragmentos.
     GLuint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
 
     // Carregamos e compilamos o shader
-    LoadShader(filename, fragment_shader_id);
+    LoadShader(filename, fragment_shader_id, defines);
 
     // Retorna o ID gerado acima
     return fragment_shader_id;
 }
 
 // Função auxilar, utilizada pelas duas funções acima. Carrega código de GPU de
-// um arquivo GLSL e faz sua compilação.
-void LoadShader(const char* filename, GLuint shader_id)
+// um arquivo GLSL e faz sua compilação. As linhas em "defines" (por exemplo,
+// "#define MATERIAL_BALL\n") são inseridas logo após a linha "#version".
+void LoadShader(const char* filename, GLuint shader_id, const char* defines)
 {
+    TraceScope trace("LoadShader", filename);
+
     // Lemos o arquivo de texto indicado pela variável "filename"
     // e colocamos seu conteúdo em memória, apontado pela variável
     // "shader_string".
@@ -1603,6 +3139,15 @@ void LoadShader(const char* filename, GLuint shader_id)
     std::stringstream shader;
     shader << file.rdbuf();
     std::string str = shader.str();
+
+    // A diretiva "#line" mantém os números de linha dos erros de compilação
+    // iguais aos do arquivo original.
+    if ( defines[0] != '\0' )
+    {
+        size_t version_end = str.find('\n') + 1;
+        str.insert(version_end, std::string(defines) + "#line 2\n");
+    }
+
     const GLchar* shader_string = str.c_str();
     const GLint   shader_string_length = static_cast<GLint>( str.length() );
 
@@ -1659,6 +3204,8 @@ void LoadShader(const char* filename, GLuint shader_id)
 // Vertex Shader e um Fragment Shader.
 GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id)
 {
+    TraceScope trace("CreateGpuProgram");
+
     // Criamos um identificador (ID) para este programa de GPU
     GLuint program_id = glCreateProgram();
 
@@ -1715,6 +3262,8 @@ void FramebufferSizeCallback(GLFWwindow* window, int width, int height)
     // função "glViewport" define o mapeamento das "normalized device
     // coordinates" (NDC) para "pixel coordinates".  Essa é a operação de
     // "Screen Mapping" ou "Viewport Mapping" vista em aula ({+ViewportMapping2+}).
+    // A cena 3D usa o seu próprio viewport, possivelmente menor; veja
+    // DynamicResolution_BeginScene().
     glViewport(0, 0, width, height);
 
     // Atualizamos também a razão que define a proporção da janela (largura /
@@ -1735,101 +3284,217 @@ double g_LastCursorPosX, g_LastCursorPosY;
 // Função callback chamada sempre que o usuário aperta algum dos botões do mouse
 void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    // O evento é aplicado depois, em ordem, por ProcessInputEvents()
+    InputEvent event;
+    event.time   = glfwGetTime();
+    event.type   = INPUT_EVENT_MOUSE_BUTTON;
+    event.code   = button;
+    event.action = action;
+    glfwGetCursorPos(window, &event.x, &event.y);
+    InputQueue_Push(event);
+}
+
+// Função callback chamada sempre que o usuário movimentar o cursor do mouse em
+// cima da janela OpenGL.
+void CursorPosCallback(GLFWwindow* window, double xpos, double ypos)
+{
+    // O evento é aplicado depois, em ordem, por ProcessInputEvents()
+    InputEvent event;
+    event.time   = glfwGetTime();
+    event.type   = INPUT_EVENT_CURSOR_POS;
+    event.code   = 0;
+    event.action = 0;
+    event.x      = xpos;
+    event.y      = ypos;
+    InputQueue_Push(event);
+}
+
+// Pede um tiro a partir de g_FinalCameraCoords, na direção em que a câmera
+// está olhando (veja UpdateCameraCoords())
+void QueueShot()
+{
+    ShotRequest shot;
+    shot.origin = g_FinalCameraCoords;
+    shot.direction = g_FinalCameraLookAtCoords - g_FinalCameraCoords;
+    g_PendingShots.push_back(shot);
+}
+
+// Tecla de movimento correspondente a uma tecla GLFW_KEY_*, ou -1
+int MoveKeyForKey(int key)
+{
+    switch ( key )
     {
-        // Se o usuário pressionou o botão esquerdo do mouse, guardamos a
-        // posição atual do cursor nas variáveis g_LastCursorPosX e
-        // g_LastCursorPosY.  Também, setamos a variávelw 
-        // g_LeftMouseButtonPressed como true, para saber que o usuário está
-        // com o botão esquerdo pressionado.
-        glfwGetCursorPos(window, &g_LastCursorPosX, &g_LastCursorPosY);
-        g_LeftMouseButtonPressed = true;
-        g_TapFlag = true;
+        case GLFW_KEY_W:            return MOVE_FORWARD;
+        case GLFW_KEY_S:            return MOVE_BACKWARD;
+        case GLFW_KEY_A:            return MOVE_LEFT;
+        case GLFW_KEY_D:            return MOVE_RIGHT;
+        case GLFW_KEY_LEFT_SHIFT:   return MOVE_UP;
+        case GLFW_KEY_LEFT_CONTROL: return MOVE_DOWN;
+        default:                    return -1;
     }
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE)
+}
+
+// Aplica um evento de entrada vindo das callbacks acima
+void ApplyInputEvent(const InputEvent& event)
+{
+    if ( event.type == INPUT_EVENT_MOUSE_BUTTON )
     {
-        // Quando o usuário soltar o botão esquerdo do mouse, atualizamos a
-        // variável abaixo para false.
-        g_LeftMouseButtonPressed = false;
+        if (event.code == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_PRESS)
+        {
+            // Se o usuário pressionou o botão esquerdo do mouse, guardamos a
+            // posição atual do cursor nas variáveis g_LastCursorPosX e
+            // g_LastCursorPosY.  Também, setamos a variávelw 
+            // g_LeftMouseButtonPressed como true, para saber que o usuário está
+            // com o botão esquerdo pressionado.
+            g_LastCursorPosX = event.x;
+            g_LastCursorPosY = event.y;
+            g_LeftMouseButtonPressed = true;
+            g_LeftMouseClicked = true;
+
+            // A pistola atira para onde a câmera apontava no clique
+            if (gunType == 0)
+            {
+                UpdateCameraCoords();
+                QueueShot();
+            }
+        }
+        if (event.code == GLFW_MOUSE_BUTTON_LEFT && event.action == GLFW_RELEASE)
+        {
+            // Quando o usuário soltar o botão esquerdo do mouse, atualizamos a
+            // variável abaixo para false.
+            g_LeftMouseButtonPressed = false;
+        }
+        if (event.code == GLFW_MOUSE_BUTTON_RIGHT && event.action == GLFW_PRESS)
+        {
+            // Se o usuário pressionou o botão esquerdo do mouse, guardamos a
+            // posição atual do cursor nas variáveis g_LastCursorPosX e
+            // g_LastCursorPosY.  Também, setamos a variável
+            // g_RightMouseButtonPressed como true, para saber que o usuário está
+            // com o botão esquerdo pressionado.
+            g_LastCursorPosX = event.x;
+            g_LastCursorPosY = event.y;
+            g_RightMouseButtonPressed = true;
+        }
+        if (event.code == GLFW_MOUSE_BUTTON_RIGHT && event.action == GLFW_RELEASE)
+        {
+            // Quando o usuário soltar o botão esquerdo do mouse, atualizamos a
+            // variável abaixo para false.
+            g_RightMouseButtonPressed = false;
+        }
     }
-    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS)
+    else if ( event.type == INPUT_EVENT_CURSOR_POS )
     {
-        // Se o usuário pressionou o botão esquerdo do mouse, guardamos a
-        // posição atual do cursor nas variáveis g_LastCursorPosX e
-        // g_LastCursorPosY.  Também, setamos a variável
-        // g_RightMouseButtonPressed como true, para saber que o usuário está
-        // com o botão esquerdo pressionado.
-        glfwGetCursorPos(window, &g_LastCursorPosX, &g_LastCursorPosY);
-        g_RightMouseButtonPressed = true;
+        // Abaixo executamos o seguinte: caso o botão esquerdo do mouse esteja
+        // pressionado, computamos quanto que o mouse se movimento desde o último
+        // instante de tempo, e usamos esta movimentação para atualizar os
+        // parâmetros que definem a posição da câmera dentro da cena virtual.
+        // Assim, temos que o usuário consegue controlar a câmera.
+
+        // Deslocamento do cursor do mouse em x e y de coordenadas de tela!
+        float dx = event.x - g_LastCursorPosX;
+        float dy = event.y - g_LastCursorPosY;
+
+        // Em coordenadas esféricas, o ângulo phi deve ficar entre -pi/2 e +pi/2.
+        float phimax = 3.141592f/2;
+        float phimin = -phimax;
+        float zoom_vision_slowdown = Bezier(1, 1, 0.3,  0.3, g_zoomAnim);
+        if (!g_FreeCamera)
+        {
+            // Atualizamos parâmetros da câmera com os deslocamentos
+            g_CameraTheta -= 0.01f*dx * zoom_vision_slowdown;
+            g_CameraPhi   += 0.01f*dy * zoom_vision_slowdown;
+
+            if (g_CameraPhi > phimax)
+                g_CameraPhi = phimax;
+
+            if (g_CameraPhi < phimin)
+                g_CameraPhi = phimin;
+        } else {
+            // Atualizamos parâmetros da câmera com os deslocamentos
+            g_free_CameraTheta -= 0.01f*dx * zoom_vision_slowdown;
+            g_free_CameraPhi   += 0.01f*dy * zoom_vision_slowdown;
+
+            if (g_free_CameraPhi > phimax)
+                g_free_CameraPhi = phimax;
+
+            if (g_free_CameraPhi < phimin)
+                g_free_CameraPhi = phimin;
+        }
+
+        // Atualizamos as variáveis globais para armazenar a posição atual do
+        // cursor como sendo a última posição conhecida do cursor.
+        g_LastCursorPosX = event.x;
+        g_LastCursorPosY = event.y;
     }
-    if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_RELEASE)
+    else if ( event.type == INPUT_EVENT_KEY )
     {
-        // Quando o usuário soltar o botão esquerdo do mouse, atualizamos a
-        // variável abaixo para false.
-        g_RightMouseButtonPressed = false;
+        int move_key = MoveKeyForKey(event.code);
+        if ( move_key >= 0 && event.action != GLFW_REPEAT )
+            g_MoveKeyHeld[move_key] = (event.action == GLFW_PRESS);
+
+        // Guns
+        // Se o usuário apertar a tecla 1, muda pra ak47
+        if (event.code == GLFW_KEY_1 && event.action == GLFW_PRESS)
+        {
+            SelectGun(1);
+        }
+
+        // Se o usuário apertar a tecla 1, muda pra pistola
+        if (event.code == GLFW_KEY_0 && event.action == GLFW_PRESS)
+        {
+            SelectGun(0);
+        }
+
+        if (event.code == GLFW_KEY_F && event.action == GLFW_PRESS)
+        {
+            g_FreeCamera = !g_FreeCamera;
+        }
     }
 }
 
-// Função callback chamada sempre que o usuário movimentar o cursor do mouse em
-// cima da janela OpenGL.
-void CursorPosCallback(GLFWwindow* window, double xpos, double ypos)
+// Soma o tempo desde g_InputTime até "time" às teclas de movimento
+// pressionadas, e avança g_InputTime
+void AccumulateMoveKeyTime(double time)
 {
-    // Abaixo executamos o seguinte: caso o botão esquerdo do mouse esteja
-    // pressionado, computamos quanto que o mouse se movimento desde o último
-    // instante de tempo, e usamos esta movimentação para atualizar os
-    // parâmetros que definem a posição da câmera dentro da cena virtual.
-    // Assim, temos que o usuário consegue controlar a câmera.
-
-    // Deslocamento do cursor do mouse em x e y de coordenadas de tela!
-    float dx = xpos - g_LastCursorPosX;
-    float dy = ypos - g_LastCursorPosY;
+    for (int i = 0; i < NUM_MOVE_KEYS; ++i)
+        if ( g_MoveKeyHeld[i] )
+            g_MoveKeyTime[i] += (float)(time - g_InputTime);
+    g_InputTime = time;
+}
 
-    // Em coordenadas esféricas, o ângulo phi deve ficar entre -pi/2 e +pi/2.
-    float phimax = 3.141592f/2;
-    float phimin = -phimax;
-    float zoom_vision_slowdown = Bezier(1, 1, 0.3,  0.3, g_zoomAnim);
-    if (!g_FreeCamera)
+// Consome a fila de eventos de entrada em ordem de tempo. Entre um evento e
+// o seguinte, as teclas de movimento pressionadas acumulam o tempo em
+// g_MoveKeyTime, de forma que o movimento aplicado no quadro corresponde ao
+// tempo real em que cada tecla ficou pressionada.
+void ProcessInputEvents(double until)
+{
+    InputEvent event;
+    while ( InputQueue_Pop(&event) )
     {
-        
-        // Atualizamos parâmetros da câmera com os deslocamentos
-        g_CameraTheta -= 0.01f*dx * zoom_vision_slowdown;
-        g_CameraPhi   += 0.01f*dy * zoom_vision_slowdown;
-    
-        if (g_CameraPhi > phimax)
-            g_CameraPhi = phimax;
-    
-        if (g_CameraPhi < phimin)
-            g_CameraPhi = phimin;
-    
-
-    } else {
-
-    
-        // Atualizamos parâmetros da câmera com os deslocamentos
-        g_free_CameraTheta -= 0.01f*dx * zoom_vision_slowdown;
-        g_free_CameraPhi   += 0.01f*dy * zoom_vision_slowdown;
-    
-        if (g_free_CameraPhi > phimax)
-            g_free_CameraPhi = phimax;
-    
-        if (g_free_CameraPhi < phimin)
-            g_free_CameraPhi = phimin;
-
-
+        AccumulateMoveKeyTime(std::min(std::max(event.time, g_InputTime), until));
+        ApplyInputEvent(event);
     }
+    AccumulateMoveKeyTime(until);
+}
 
-    // Atualizamos as variáveis globais para armazenar a posição atual do
-    // cursor como sendo a última posição conhecida do cursor.
-    g_LastCursorPosX = xpos;
-    g_LastCursorPosY = ypos;
-
-    if (g_RightMouseButtonPressed)
+// Como ProcessInputEvents(), mas para no primeiro evento que não é um
+// movimento do cursor, deixando-o na fila junto com os seguintes. As teclas
+// de movimento acumulam tempo só até esse evento.
+void ProcessCursorEvents(double until)
+{
+    InputEvent event;
+    while ( InputQueue_Peek(&event) )
     {
-        // Atualizamos as variáveis globais para armazenar a posição atual do
-        // cursor como sendo a última posição conhecida do cursor.
-        g_LastCursorPosX = xpos;
-        g_LastCursorPosY = ypos;
+        if ( event.type != INPUT_EVENT_CURSOR_POS )
+        {
+            until = std::min(std::max(event.time, g_InputTime), until);
+            break;
+        }
+        InputQueue_Pop(&event);
+        AccumulateMoveKeyTime(std::min(std::max(event.time, g_InputTime), until));
+        ApplyInputEvent(event);
     }
+    AccumulateMoveKeyTime(until);
 }
 
 // Função callback chamada sempre que o usuário movimenta a "rodinha" do mouse.
@@ -1883,19 +3548,6 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mod)
     }
 
 
-    // Guns
-    // Se o usuário apertar a tecla 1, muda pra ak47
-    if (key == GLFW_KEY_1 && action == GLFW_PRESS)
-    {
-        gunType = 1;
-    }
-
-    // Se o usuário apertar a tecla 1, muda pra pistola
-    if (key == GLFW_KEY_0 && action == GLFW_PRESS)
-    {
-        gunType = 0;
-    }
-
     // Se o usuário apertar a tecla H, fazemos um "toggle" do texto informativo mostrado na tela.
     if (key == GLFW_KEY_H && action == GLFW_PRESS)
     {
@@ -1909,60 +3561,17 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mod)
         fprintf(stdout,"Shaders recarregados!\n");
         fflush(stdout);
     }
-    if (key == GLFW_KEY_F && action == GLFW_PRESS)
-    {
-        g_FreeCamera = !g_FreeCamera;   
-    
-    }
-    if (key == GLFW_KEY_W && action == GLFW_PRESS)
-    {
-        w_held = true;
-    }
-    if (key == GLFW_KEY_A && action == GLFW_PRESS)
-    {
-        a_held = true;
-    }
-    if (key == GLFW_KEY_S && action == GLFW_PRESS)
-    {
-        s_held = true;
-    }
-    if (key == GLFW_KEY_D && action == GLFW_PRESS)
-    {
-        d_held = true;
-    }
-    if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_PRESS)
-    {
-        shift_held = true;
-    }
-    if (key == GLFW_KEY_LEFT_CONTROL && action == GLFW_PRESS)
-    {
-        ctrl_held = true;
-    }
-    //release
-    if (key == GLFW_KEY_W && action == GLFW_RELEASE)
-    {
-        w_held = false;
-    }
-    if (key == GLFW_KEY_A && action == GLFW_RELEASE)
-    {
-        a_held = false;
-    }
-    if (key == GLFW_KEY_S && action == GLFW_RELEASE)
-    {
-        s_held = false;
-    }
-    if (key == GLFW_KEY_D && action == GLFW_RELEASE)
-    {
-        d_held = false;
-    }
-    if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_RELEASE)
-    {
-        shift_held = false;
-    }
-    if (key == GLFW_KEY_LEFT_CONTROL && action == GLFW_RELEASE)
-    {
-        ctrl_held = false;
-    }
+
+    // Movimento, troca de arma e de câmera são aplicados depois, em ordem
+    // com os eventos do mouse, por ProcessInputEvents()
+    InputEvent event;
+    event.time   = glfwGetTime();
+    event.type   = INPUT_EVENT_KEY;
+    event.code   = key;
+    event.action = action;
+    event.x      = 0.0;
+    event.y      = 0.0;
+    InputQueue_Push(event);
 }
 
 // Definimos o callback para impressão de erros da GLFW no terminal
@@ -2084,6 +3693,134 @@ void TextRendering_ShowFramesPerSecond(GLFWwindow* window)
     TextRendering_PrintString(window, buffer, 1.0f-(numchars + 1)*charwidth, 1.0f-lineheight, 1.0f);
 }
 
+// Escrevemos na tela o número de objetos desenhados e descartados (culled)
+// pelo teste de frustum no quadro atual.
+void TextRendering_ShowCullingStats(GLFWwindow* window)
+{
+    if ( !g_ShowInfoText )
+        return;
+
+    char buffer[40];
+    int numchars = snprintf(buffer, 40, "%d drawn, %d culled", g_NumDrawnObjects, g_NumCulledObjects);
+
+    float lineheight = TextRendering_LineHeight(window);
+    float charwidth = TextRendering_CharWidth(window);
+
+    TextRendering_PrintString(window, buffer, 1.0f-(numchars + 1)*charwidth, 1.0f-2*lineheight, 1.0f);
+}
+
+// Escrevemos na tela que a arma escolhida pelo jogador ainda está sendo
+// carregada. Aparece mesmo com as informações escondidas.
+void TextRendering_ShowWeaponLoading(GLFWwindow* window)
+{
+    if ( g_PendingGunType < 0 )
+        return;
+
+    float lineheight = TextRendering_LineHeight(window);
+    TextRendering_PrintString(window, "Carregando arma...", -1.0f+lineheight/10, -1.0f+2*lineheight/10, 1.0f);
+}
+
+// Escrevemos na tela os contadores de "glState.hpp" do último quadro completo
+void TextRendering_ShowRenderStats(GLFWwindow* window)
+{
+    if ( !g_ShowInfoText )
+        return;
+
+    const GLStateCounters& counters = g_GLStateLastFrameCounters;
+
+    char buffer[80];
+    int numchars = snprintf(buffer, 80, "%d draws, %d binds, %d uploads (%d KiB), %d skipped",
+                            counters.draw_calls, counters.binds, counters.uploads,
+                            (int)(counters.uploaded_bytes / 1024), counters.skipped_calls);
+
+    float lineheight = TextRendering_LineHeight(window);
+    float charwidth = TextRendering_CharWidth(window);
+
+    TextRendering_PrintString(window, buffer, 1.0f-(numchars + 1)*charwidth, 1.0f-3*lineheight, 1.0f);
+}
+
+// Escrevemos na tela os percentis do tempo de quadro e a média dos tempos de
+// CPU e GPU de cada fase nos últimos PROFILE_HISTORY_SIZE quadros, e um
+// gráfico com o tempo de cada um dos últimos quadros. Ao contrário do FPS
+// (uma média de um segundo), o gráfico mostra quadros lentos isolados.
+void TextRendering_ShowFrameTimes(GLFWwindow* window)
+{
+    if ( !g_ShowInfoText )
+        return;
+
+    float lineheight = TextRendering_LineHeight(window);
+    float charwidth = TextRendering_CharWidth(window);
+
+    char lines[4][80];
+    snprintf(lines[0], 80, "frame p50 %.1f p95 %.1f p99 %.1f ms",
+             HistoryPercentile(g_FrameTimeHistory, 50), HistoryPercentile(g_FrameTimeHistory, 95),
+             HistoryPercentile(g_FrameTimeHistory, 99));
+    snprintf(lines[1], 80, "cpu cam %.2f scn %.2f phy %.2f col %.2f",
+             HistoryMean(g_PhaseHistory[PHASE_CAMERA]), HistoryMean(g_PhaseHistory[PHASE_SCENE]),
+             HistoryMean(g_PhaseHistory[PHASE_PHYSICS]), HistoryMean(g_PhaseHistory[PHASE_COLLISIONS]));
+    snprintf(lines[2], 80, "cpu ray %.2f sub %.2f txt %.2f swp %.2f",
+             HistoryMean(g_PhaseHistory[PHASE_RAYCAST]), HistoryMean(g_PhaseHistory[PHASE_SUBMIT]),
+             HistoryMean(g_PhaseHistory[PHASE_OVERLAY]), HistoryMean(g_PhaseHistory[PHASE_SWAP]));
+    snprintf(lines[3], 80, "gpu scn %.2f sph %.2f txt %.2f res %d%%",
+             HistoryMean(g_GpuPassHistory[GPU_PASS_SCENE]), HistoryMean(g_GpuPassHistory[GPU_PASS_SPHERES]),
+             HistoryMean(g_GpuPassHistory[GPU_PASS_TEXT]), (int)(100.0f * g_DynamicResolution.scale + 0.5f));
+
+    for (int i = 0; i < 4; ++i)
+    {
+        int numchars = strlen(lines[i]);
+        TextRendering_PrintString(window, lines[i], 1.0f-(numchars + 1)*charwidth, 1.0f-(4 + i)*lineheight, 1.0f);
+    }
+
+    // Gráfico dos últimos 120 quadros, do mais antigo (à esquerda) ao mais
+    // recente. A altura máxima corresponde a 33,3 ms (30 quadros por segundo).
+    const int graph_frames = 120;
+    float values[graph_frames];
+    int count = std::min(graph_frames, g_FrameTimeHistory.count);
+    for (int i = 0; i < count; ++i)
+        values[i] = g_FrameTimeHistory.recent(count - 1 - i);
+
+    float graph_width = 40 * charwidth;
+    float graph_height = 3 * lineheight;
+    float graph_x = 1.0f - graph_width - charwidth;
+    float graph_y = 1.0f - 8*lineheight - graph_height;
+    if ( count > 0 )
+        TextRendering_PrintBarGraph(window, values, count, graph_x, graph_y, graph_width * count / graph_frames, graph_height, 1000.0f / 30.0f);
+}
+
+// Desenha a tela de carregamento: quantos dos recursos pedidos às threads
+// auxiliares (veja "assetLoader.hpp") já foram lidos, e uma barra de
+// progresso. Também lê a entrada, para que o sistema operacional não
+// considere a janela travada.
+void DrawLoadingScreen(GLFWwindow* window)
+{
+    glfwPollEvents();
+
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    int num_jobs = AssetLoader_NumJobs();
+    int num_done = AssetLoader_NumDone();
+
+    char buffer[40];
+    int numchars = snprintf(buffer, 40, "Carregando... %d/%d", num_done, num_jobs);
+
+    float lineheight = TextRendering_LineHeight(window);
+    float charwidth = TextRendering_CharWidth(window);
+    TextRendering_PrintString(window, buffer, -0.5f*numchars*charwidth, lineheight, 1.0f);
+
+    // Uma barra por recurso, cheia se ele já foi lido
+    std::vector<float> progress(num_jobs);
+    for (int i = 0; i < num_jobs; ++i)
+        progress[i] = (i < num_done) ? 1.0f : 0.0f;
+    if ( num_jobs > 0 )
+        TextRendering_PrintBarGraph(window, progress.data(), num_jobs, -0.5f, -lineheight, 1.0f, lineheight, 1.0f);
+
+    TextRendering_Flush(window);
+    glfwSwapBuffers(window);
+}
+
 // Função para debugging: imprime no terminal todas informações de um modelo
 // geométrico carregado de um arquivo ".obj".
 // Veja: https://github.com/syoyo/tinyobjloader/blob/22883def8db9ef1f3ffb9b404318e7dd25fdbb51/loader_example.cc#L98
@@ -2256,20 +3993,413 @@ void PrintObjModelInfo(ObjModel* model)
 void DrawSphere(glm::vec4 position, float radius, int index){
     glm::mat4 model = Matrix_Translate(position.x, position.y, position.z) 
         * Matrix_Scale(radius, radius, radius);
-    glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-    glUniform1i(g_object_id_uniform, index + 10);
-    DrawVirtualObject("the_sphere");
-
+    QueueSphereInstance(model, index + 10);
 }
 
 
 void DrawSphereCoords(int x, int y, int z, float radius){
     glm::mat4 model = Matrix_Translate(x,y,z) 
         * Matrix_Scale(radius, radius, radius);
-    glUniformMatrix4fv(g_model_uniform, 1 , GL_FALSE , glm::value_ptr(model));
-    glUniform1i(g_object_id_uniform, SPHERE);
-    DrawVirtualObject("the_sphere");
+    QueueSphereInstance(model, SPHERE);
+}
+
+// Cria o buffer de atributos por instância e o associa ao VAO do objeto
+// "object". Cada instância ocupa as locations 3-6 (matriz model, uma
+// coluna por location) e 7 (object_id) em "shader_vertex.glsl".
+void CreateSphereInstanceBuffer(int object)
+{
+    g_SphereInstanceObject = object;
+    GLState_BindVertexArray(g_VirtualScene[object].vertex_array_object_id);
+
+    glGenBuffers(1, &g_SphereInstanceBufferId);
+    GLState_BindBuffer(GL_ARRAY_BUFFER, g_SphereInstanceBufferId);
+    GLState_BufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+
+    SetSphereInstanceAttributes(0);
+
+    for (GLuint location = 3; location <= 7; ++location)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1); // Avança uma vez por instância, não por vértice
+    }
+
+    GLState_BindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState_BindVertexArray(0);
+}
+
+// Aponta os atributos por instância do VAO atualmente ligado para a instância
+// que começa em "first_byte" do buffer g_SphereInstanceBufferId. OpenGL 3.3
+// não tem glDrawElementsInstancedBaseInstance(), então é assim que cada lote
+// de DrawSphereInstances() começa na sua primeira instância.
+void SetSphereInstanceAttributes(GLintptr first_byte)
+{
+    GLsizei stride = sizeof(SphereInstance);
+    for (GLuint column = 0; column < 4; ++column)
+    {
+        GLuint location = 3 + column; // "(location = 3)" em "shader_vertex.glsl"
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride, (void*)(first_byte + column * sizeof(glm::vec4)));
+    }
+
+    GLuint location = 7; // "(location = 7)" em "shader_vertex.glsl"
+    glVertexAttribIPointer(location, 1, GL_INT, stride, (void*)(first_byte + sizeof(glm::mat4)));
+}
+
+void QueueSphereInstance(glm::mat4 model, int object_id)
+{
+    SphereInstance instance;
+    instance.model = model;
+    instance.object_id = object_id;
+    g_SphereInstances.push_back(instance);
+}
+
+// Envia todas as esferas enfileiradas neste quadro para a GPU (um único
+// upload) e as desenha com um glDrawElementsInstanced() por lote, sendo os
+// lotes separados por material (marcadores SPHERE ou bolas) e por nível de
+// detalhe.
+void DrawSphereInstances()
+{
+    if ( g_SphereInstances.empty() )
+        return;
+
+    const SceneObject& sphere = g_VirtualScene[g_SphereInstanceObject];
+
+    // Descartamos as esferas fora do frustum da câmera, testando todas de uma vez
+    static AABBBatch                  boxes;
+    static std::vector<unsigned char> visible;
+
+    boxes.clear();
+    for (size_t i = 0; i < g_SphereInstances.size(); ++i)
+    {
+        glm::vec3 center, extent;
+        TransformAABB(g_SphereInstances[i].model, sphere.bbox_min, sphere.bbox_max, &center, &extent);
+        boxes.push(center, extent);
+    }
+    int num_visible = CullAABBBatch(g_ViewFrustum, boxes, &visible);
+
+    g_NumDrawnObjects += num_visible;
+    g_NumCulledObjects += g_SphereInstances.size() - num_visible;
+
+    if ( num_visible == 0 )
+    {
+        g_SphereInstances.clear();
+        return;
+    }
+
+    // Separamos as esferas visíveis em lotes por material (marcadores ou
+    // bolas) e nível de detalhe, com uma ordenação por contagem: o lote
+    // material * NUM_LODS + lod ocupa as posições [batch_first, batch_first + batch_count).
+    const int num_batches = 2 * NUM_LODS;
+    static std::vector<int>            batch_of_instance;
+    static std::vector<SphereInstance> sorted_instances;
+
+    GLsizei batch_count[num_batches] = { 0 };
+    GLsizei batch_first[num_batches];
+
+    batch_of_instance.resize(g_SphereInstances.size());
+    for (size_t i = 0; i < g_SphereInstances.size(); ++i)
+    {
+        if ( !visible[i] )
+            continue;
+
+        glm::vec3 center = glm::vec3(boxes.center_x[i], boxes.center_y[i], boxes.center_z[i]);
+        glm::vec3 extent = glm::vec3(boxes.extent_x[i], boxes.extent_y[i], boxes.extent_z[i]);
+        int lod = SelectLevelOfDetail(center, glm::length(extent));
+        int material = (g_SphereInstances[i].object_id == SPHERE) ? 0 : 1;
+
+        batch_of_instance[i] = material * NUM_LODS + lod;
+        batch_count[batch_of_instance[i]] += 1;
+    }
+
+    GLsizei next_first = 0;
+    for (int batch = 0; batch < num_batches; ++batch)
+    {
+        batch_first[batch] = next_first;
+        next_first += batch_count[batch];
+    }
+
+    GLsizei batch_end[num_batches];
+    std::copy(batch_first, batch_first + num_batches, batch_end);
+
+    sorted_instances.resize(num_visible);
+    for (size_t i = 0; i < g_SphereInstances.size(); ++i)
+    {
+        if ( visible[i] )
+            sorted_instances[batch_end[batch_of_instance[i]]++] = g_SphereInstances[i];
+    }
+
+    // Realocamos o buffer inteiro ("orphaning") para não esperar a GPU
+    // terminar de ler os dados do quadro anterior.
+    GLsizeiptr size = sorted_instances.size() * sizeof(SphereInstance);
+    GLState_BindBuffer(GL_ARRAY_BUFFER, g_SphereInstanceBufferId);
+    GLState_BufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    GLState_BufferSubData(GL_ARRAY_BUFFER, 0, size, sorted_instances.data());
+
+    GLState_BindVertexArray(sphere.vertex_array_object_id);
+
+    const SceneObjectPart& mesh = sphere.parts[0];
+    const Material batch_material[2] = { MATERIAL_SPHERE, MATERIAL_BALL };
+
+    for (int batch = 0; batch < num_batches; ++batch)
+    {
+        if ( batch_count[batch] == 0 )
+            continue;
+
+        int lod = batch % NUM_LODS;
+
+        // A matriz model e o object_id de cada esfera vêm dos atributos por
+        // instância; do bloco de uniforms só é usada a bbox.
+        UseMaterial(batch_material[batch / NUM_LODS]);
+        UpdateObjectUniforms(Matrix_Identity(), SPHERE, sphere);
+        SetSphereInstanceAttributes(batch_first[batch] * sizeof(SphereInstance));
+
+        GLState_DrawElementsInstanced(
+            sphere.rendering_mode,
+            mesh.num_indices[lod],
+            sphere.index_type,
+            (void*)(mesh.first_index[lod] * IndexTypeSize(sphere.index_type)),
+            batch_count[batch]
+        );
+    }
+
+    g_SphereInstances.clear();
+}
+
+// Roteiro do modo benchmark: a câmera em primeira pessoa dá uma volta
+// completa em torno da mesa ao longo dos g_BenchmarkFrames quadros, sempre
+// olhando para o centro dela, e dispara a pistola a cada 2 segundos
+// simulados. Nenhuma parte da simulação usa números aleatórios, então o
+// passo de tempo fixo basta para que tudo se repita igual.
+void BenchmarkScript(int frame)
+{
+    const float radius = 2.5f;
+    float angle = 2.0f * 3.141592f * frame / g_BenchmarkFrames;
+
+    g_FreeCamera = true;
+    gunType = 0;
+    g_POV_Coords = glm::vec4(radius * cos(angle), 1.7f, radius * sin(angle), 1.0f);
+    g_free_CameraTheta = -(angle + 3.141592f); // Olhando para a origem
+    g_free_CameraPhi = 0.28f; // Inclinada para baixo, em direção à mesa
+
+    if ( frame % 120 == 60 )
+    {
+        UpdateCameraCoords();
+        QueueShot();
+    }
+}
+
+// Calcula g_FinalCameraCoords e g_FinalCameraLookAtCoords: a câmera livre
+// (em g_POV_Coords) e a câmera que orbita g_Camera_LookAt, interpoladas por
+// cameraBezierT. Chamada no início do quadro e de novo no "late latch", com
+// os ângulos atualizados pela entrada mais recente.
+void UpdateCameraCoords()
+{
+    float r = g_CameraDistance;
+    float y = g_Camera_LookAt.y + r*sin(g_CameraPhi);
+    float z = g_Camera_LookAt.z + r*cos(g_CameraPhi)*cos(g_CameraTheta);
+    float x = g_Camera_LookAt.x + r*cos(g_CameraPhi)*sin(g_CameraTheta);
+
+    g_LookAt_Coords = glm::vec4(x,y,z,1.0f);
+
+    g_POV_LookAt = g_POV_Coords + glm::vec4(cos(-g_free_CameraTheta)*cos(g_free_CameraPhi), -sin(g_free_CameraPhi), sin(-g_free_CameraTheta)*cos(g_free_CameraPhi),0.0f);
+
+    g_FinalCameraCoords = Bezier(g_POV_Coords, g_POV_Coords + glm::vec4(0.0f,1.0f,0.0f,0.0f), g_LookAt_Coords +  glm::vec4(0.0f,1.0f,0.0f,0.0f), g_LookAt_Coords ,cameraBezierT);
+    g_FinalCameraLookAtCoords = Bezier(g_POV_LookAt, g_POV_LookAt, g_Camera_LookAt, g_Camera_LookAt, cameraBezierT);
+}
+
+// Matriz de modelagem da arma selecionada (gunType), que acompanha a posição
+// e a orientação da câmera livre, o zoom e o recuo do tiro
+glm::mat4 GunModelMatrix()
+{
+    if(gunType == 1){
+        // ak 47
+        return Matrix_Translate(g_POV_Coords.x, g_POV_Coords.y, g_POV_Coords.z)
+            * Matrix_Rotate_X(0.0f)
+            * Matrix_Rotate_Y(g_free_CameraTheta + (3.14))
+            * Matrix_Rotate_Z(g_free_CameraPhi + -LERP(0, (3.14 / LERP(30, 50, g_zoomAnim)) ,g_recoilAnim))
+            * Matrix_Translate(
+            LERP(-0.25f, -0.35f, g_zoomAnim),
+            LERP(-0.25f, -0.20f, g_zoomAnim),
+            LERP(-0.1f, 0.0f, g_zoomAnim))
+            * Matrix_Rotate_Y(3.141f)
+            * Matrix_Scale(0.05f, 0.05f, 0.05f);
+    }
+
+    return Matrix_Translate(g_POV_Coords.x, g_POV_Coords.y, g_POV_Coords.z)
+        * Matrix_Rotate_X(0.0f)
+        * Matrix_Rotate_Y(g_free_CameraTheta + (3.14))
+        * Matrix_Rotate_Z(g_free_CameraPhi + -LERP(0, (3.14 / LERP(5, 20, g_zoomAnim)) ,g_recoilAnim))
+        * Matrix_Translate(
+        LERP(-0.15f, -0.3f, g_zoomAnim),
+        LERP(-0.2f, -0.18f, g_zoomAnim),
+        LERP(-0.1f, 0.0f, g_zoomAnim))
+        * Matrix_Scale(0.01f, 0.01f, 0.01f);
+}
+
+LazyWeapon* FindLazyWeapon(int gun_type)
+{
+    for (int i = 0; i < NUM_LAZY_WEAPONS; ++i)
+        if ( g_LazyWeapons[i].gun_type == gun_type )
+            return &g_LazyWeapons[i];
+    return NULL;
+}
+
+// Pede às threads auxiliares a leitura do modelo e da textura da arma, se
+// isso ainda não foi feito. Pode ser chamada antes de a arma ser escolhida,
+// para que ela já esteja pronta quando for (veja "--prefetch-weapons").
+void RequestWeapon(LazyWeapon* weapon)
+{
+    if ( weapon->state != WEAPON_UNLOADED )
+        return;
+
+    printf("Carregando arma \"%s\" em segundo plano...\n", weapon->object_name);
+    weapon->state = WEAPON_LOADING;
+    weapon->texture_uploaded = false;
+    weapon->request_time = glfwGetTime();
+    weapon->texture_job = SubmitTextureImage(weapon->texture_filename, &weapon->image);
+    weapon->model_job = SubmitMesh(weapon->model_filename, &weapon->mesh, weapon->planar_texcoords);
+}
+
+// Troca para a arma "gun_type". Uma arma ainda não carregada é pedida às
+// threads auxiliares, e a troca só acontece quando ela estiver na GPU (veja
+// UpdateWeaponLoading()); até lá o jogador continua com a arma atual.
+void SelectGun(int gun_type)
+{
+    LazyWeapon* weapon = FindLazyWeapon(gun_type);
+    if ( weapon == NULL || weapon->state == WEAPON_READY )
+    {
+        gunType = gun_type;
+        g_PendingGunType = -1;
+        return;
+    }
+    if ( weapon->state == WEAPON_FAILED )
+        return;
+
+    RequestWeapon(weapon);
+    g_PendingGunType = gun_type;
+}
+
+// Marca a arma como indisponível depois de um erro de leitura, liberando o
+// que já tinha sido carregado
+void FailWeapon(LazyWeapon* weapon, const char* reason)
+{
+    fprintf(stderr, "ERROR: Cannot load weapon \"%s\": %s\n", weapon->object_name, reason);
+
+    if ( weapon->texture_uploaded )
+    {
+        Resources_Release(g_MaterialTextures[weapon->material]);
+        g_MaterialTextures[weapon->material] = -1;
+    }
+    else
+        FreeTextureImage(&weapon->image);
+    MeshData_Free(&weapon->mesh);
+
+    weapon->state = WEAPON_FAILED;
+    if ( g_PendingGunType == weapon->gun_type )
+        g_PendingGunType = -1;
+}
+
+// Nome da primeira parte de "weapon" que não é um objeto do seu modelo já
+// lido, ou NULL se todas existem. Verificado antes de enviar o modelo à GPU,
+// pois AddMergedObjectToVirtualScene() aborta o programa se faltar uma parte.
+const char* FindMissingWeaponPart(const LazyWeapon* weapon)
+{
+    for (int i = 0; i < weapon->num_parts; ++i)
+    {
+        bool found = false;
+        for (size_t j = 0; j < weapon->mesh.objects.size() && !found; ++j)
+            found = (weapon->mesh.objects[j].name == weapon->part_names[i]);
+        if ( !found )
+            return weapon->part_names[i];
+    }
+    return NULL;
+}
+
+// Chamada a cada quadro: envia à GPU a textura e o modelo das armas cuja
+// leitura já terminou, no máximo um recurso por quadro, para não causar um
+// quadro lento. Quando a arma fica pronta e o jogador ainda a quer, a troca
+// de arma acontece.
+void UpdateWeaponLoading()
+{
+    for (int i = 0; i < NUM_LAZY_WEAPONS; ++i)
+    {
+        LazyWeapon* weapon = &g_LazyWeapons[i];
+        if ( weapon->state != WEAPON_LOADING )
+            continue;
+
+        if ( !weapon->texture_uploaded )
+        {
+            if ( !AssetLoader_IsDone(weapon->texture_job) )
+                continue;
+            if ( !weapon->image.is_baked && weapon->image.data == NULL )
+            {
+                // Esperamos o modelo, que ainda pode estar sendo lido
+                if ( AssetLoader_IsDone(weapon->model_job) )
+                    FailWeapon(weapon, "cannot open texture");
+                continue;
+            }
+
+            g_MaterialTextures[weapon->material] = LoadTextureImage(&weapon->image);
+            UpdateMaterialTextureUnits();
+            weapon->texture_uploaded = true;
+            return;
+        }
+
+        if ( !AssetLoader_IsDone(weapon->model_job) )
+            continue;
+        try
+        {
+            AssetLoader_Wait(weapon->model_job, []() {});
+        }
+        catch ( const std::exception& e )
+        {
+            FailWeapon(weapon, e.what());
+            continue;
+        }
 
+        const char* missing_part = FindMissingWeaponPart(weapon);
+        if ( missing_part != NULL )
+        {
+            std::string reason = std::string("missing part \"") + missing_part + "\"";
+            FailWeapon(weapon, reason.c_str());
+            continue;
+        }
+
+        weapon->mesh_resource = AddMeshToVirtualScene(weapon->mesh);
+        MeshData_Free(&weapon->mesh);
+        AddMergedObjectToVirtualScene(weapon->object_name, weapon->part_names, weapon->num_parts);
+        weapon->object = GetVirtualObjectHandle(weapon->object_name);
+        weapon->state = WEAPON_READY;
+
+        printf("Arma \"%s\" carregada em %.0f ms.\n", weapon->object_name, 1000.0 * (glfwGetTime() - weapon->request_time));
+        Resources_PrintSummary();
+
+        if ( g_PendingGunType == weapon->gun_type )
+        {
+            gunType = weapon->gun_type;
+            g_PendingGunType = -1;
+        }
+        return;
+    }
+}
+
+// Solta os modelos das armas carregadas e libera as leituras que não chegaram
+// à GPU. Deve ser chamada depois de AssetLoader_Stop(). As texturas ficam em
+// g_MaterialTextures, soltas junto com as demais.
+void UnloadWeapons()
+{
+    for (int i = 0; i < NUM_LAZY_WEAPONS; ++i)
+    {
+        LazyWeapon* weapon = &g_LazyWeapons[i];
+        if ( weapon->state == WEAPON_READY )
+            Resources_Release(weapon->mesh_resource);
+        else if ( weapon->state == WEAPON_LOADING )
+        {
+            if ( !weapon->texture_uploaded )
+                FreeTextureImage(&weapon->image);
+            MeshData_Free(&weapon->mesh);
+        }
+        weapon->state = WEAPON_UNLOADED;
+    }
 }
 
 float ellapsed_time(){
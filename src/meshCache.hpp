@@ -0,0 +1,457 @@
+#ifndef _MESHCACHE_H
+#define _MESHCACHE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Headers do sistema operacional
+#include <sys/stat.h>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Headers da biblioteca GLM: criação de matrizes e vetores.
+#include <glm/vec3.hpp>
+
+// Headers locais
+#include "meshOptimization.hpp"
+#include "bakedTexture.hpp"
+
+// Cache binário dos modelos ".obj" já processados. Ler o texto do ".obj",
+// calcular normais, juntar vértices idênticos, reordenar os triângulos e
+// gerar os níveis de detalhe (veja BuildMeshData() em main.cpp) dá sempre o
+// mesmo resultado para o mesmo arquivo, então o resultado final (vértices
+// compactados, índices já no tipo usado pela GPU e as faixas e AABBs de cada
+// objeto) é gravado ao lado do modelo, em "<modelo>.fmesh". Nas próximas
+// execuções, o arquivo é mapeado em memória e os vértices e índices vão
+// direto para a GPU.
+//
+// O cache vale enquanto o tamanho e a data de modificação do ".obj" e da sua
+// biblioteca de materiais (o ".mtl" da linha "mtllib", de onde vêm os
+// materiais de cada objeto) forem os gravados nele. Se só a data mudou,
+// comparamos também um hash do conteúdo; assim, um arquivo apenas copiado ou
+// restaurado pelo git não é processado de novo. Mudanças no processamento em
+// si devem incrementar MESH_CACHE_VERSION, invalidando todos os caches.
+//
+// Um cache corrompido ou truncado (faixas de índices fora do arquivo, índices
+// que apontam para além dos vértices) é descartado, e o ".obj" é lido de novo.
+//
+// Formato: MeshCacheHeader, seguido de num_objects MeshCacheObject, dos nomes
+// dos objetos, dos vértices (PackedVertex) e dos índices (de 16 ou 32 bits),
+// cada bloco começando em um offset alinhado em 16 bytes.
+
+const char     MESH_CACHE_MAGIC[8] = { 'F', 'C', 'G', 'M', 'E', 'S', 'H', '1' };
+const uint32_t MESH_CACHE_VERSION  = 1;
+const uint32_t MESH_MAX_LODS       = 8;
+const size_t   MESH_CACHE_NAME_SIZE = 256;
+
+struct MeshCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t num_lods;
+    uint32_t vertex_size;    // sizeof(PackedVertex)
+    uint32_t index_size;     // 2 ou 4 bytes
+    uint32_t flags;          // MESH_HAS_NORMALS, MESH_HAS_TEXCOORDS, MESH_PLANAR_TEXCOORDS
+    uint32_t num_objects;
+
+    // Chave: o ".obj" a partir do qual o cache foi gerado
+    uint64_t source_size;
+    int64_t  source_mtime;
+    uint64_t source_hash;
+
+    // Chave: o ".mtl" do ".obj", relativo ao diretório dele ("" se não há
+    // "mtllib"); tamanho e data zerados se ele não existia
+    char     material_library[MESH_CACHE_NAME_SIZE];
+    uint64_t material_size;
+    int64_t  material_mtime;
+    uint64_t material_hash;
+
+    uint64_t num_vertices;
+    uint64_t num_indices;
+    uint64_t objects_offset;
+    uint64_t names_offset;
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t file_size;
+};
+
+const uint32_t MESH_HAS_NORMALS   = 1;
+const uint32_t MESH_HAS_TEXCOORDS = 2;
+const uint32_t MESH_PLANAR_TEXCOORDS = 4; // Coordenadas de textura planares (veja BuildMeshData() em main.cpp)
+
+struct MeshCacheObject
+{
+    uint32_t name_offset;    // Relativo a names_offset
+    uint32_t name_length;
+    int32_t  material_id;
+    float    bbox_min[3];
+    float    bbox_max[3];
+    uint64_t first_index[MESH_MAX_LODS];
+    uint64_t num_indices[MESH_MAX_LODS];
+};
+
+// Objeto de um modelo processado: uma faixa de índices por nível de detalhe
+struct MeshObject
+{
+    std::string name;
+    int         material_id; // Material (tinyobj) da primeira face, -1 se não houver
+    glm::vec3   bbox_min;
+    glm::vec3   bbox_max;
+    size_t      first_index[MESH_MAX_LODS];
+    size_t      num_indices[MESH_MAX_LODS];
+};
+
+// Modelo processado, pronto para ser enviado à GPU. Os vértices e índices
+// apontam ou para o arquivo de cache mapeado em memória ou para os vetores
+// "*_storage", então um MeshData não deve ser copiado.
+struct MeshData
+{
+    std::string             name;          // Nome do primeiro objeto, para mensagens
+    std::string             source;        // Arquivo ".obj" de origem
+    uint64_t                source_hash;   // Hash do conteúdo do ".obj" (veja HashFile())
+    uint32_t                num_lods;
+    bool                    has_normals;
+    bool                    has_texcoords;
+    bool                    planar_texcoords; // Geradas pela bbox de cada objeto, e não lidas do ".obj"
+    std::vector<MeshObject> objects;
+
+    const PackedVertex*     vertices;
+    size_t                  num_vertices;
+    const void*             indices;       // GLushort ou GLuint, conforme index_type
+    size_t                  num_indices;
+    GLenum                  index_type;
+
+    MappedFile                 file;
+    std::vector<PackedVertex>  vertex_storage;
+    std::vector<unsigned char> index_storage;
+
+    MeshData() : source_hash(0), num_lods(0), has_normals(false), has_texcoords(false), planar_texcoords(false), vertices(NULL), num_vertices(0),
+                 indices(NULL), num_indices(0), index_type(GL_UNSIGNED_INT)
+    {
+        file.data = NULL;
+        file.size = 0;
+    }
+};
+
+void MeshData_Free(MeshData* mesh)
+{
+    MappedFile_Close(&mesh->file);
+    std::vector<PackedVertex>().swap(mesh->vertex_storage);
+    std::vector<unsigned char>().swap(mesh->index_storage);
+    mesh->objects.clear();
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+    mesh->num_vertices = 0;
+    mesh->num_indices = 0;
+}
+
+// Hash FNV-1a de 64 bits de um bloco de memória
+uint64_t HashBytes(const unsigned char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Hash do conteúdo de um arquivo. Retorna false se ele não puder ser lido.
+bool HashFile(const char* filename, uint64_t* hash)
+{
+    MappedFile file;
+    if ( !MappedFile_Open(filename, &file) )
+        return false;
+    *hash = HashBytes(file.data, file.size);
+    MappedFile_Close(&file);
+    return true;
+}
+
+// Tamanho, data de modificação e hash do conteúdo de um arquivo; o hash só é
+// calculado se "hash" não for NULL. Retorna false se o arquivo não existe.
+bool MeshCache_SourceKey(const char* filename, uint64_t* size, int64_t* mtime, uint64_t* hash)
+{
+    struct stat info;
+    if ( stat(filename, &info) != 0 )
+        return false;
+    *size = (uint64_t)info.st_size;
+    *mtime = (int64_t)info.st_mtime;
+
+    return hash == NULL || HashFile(filename, hash);
+}
+
+// Se o tamanho, a data e (se só a data for diferente) o hash do arquivo
+// "filename" são os gravados em um cache. Um arquivo que não existe
+// corresponde a tamanho e data zerados.
+bool MeshCache_KeyMatches(const char* filename, uint64_t size, int64_t mtime, uint64_t hash)
+{
+    uint64_t current_size, current_hash;
+    int64_t current_mtime;
+    if ( !MeshCache_SourceKey(filename, &current_size, &current_mtime, NULL) )
+        return size == 0 && mtime == 0;
+    if ( current_size != size )
+        return false;
+    if ( current_mtime == mtime )
+        return true;
+    return MeshCache_SourceKey(filename, &current_size, &current_mtime, &current_hash) && current_hash == hash;
+}
+
+// Nome do ".mtl" da primeira linha "mtllib" do ".obj" "filename", como
+// escrito nele, ou "" se não houver
+std::string MeshCache_MaterialLibrary(const char* filename)
+{
+    MappedFile file;
+    if ( !MappedFile_Open(filename, &file) )
+        return std::string();
+
+    const char* text = (const char*)file.data;
+    const char* end = text + file.size;
+    std::string name;
+    for (const char* line = text; line < end && name.empty(); )
+    {
+        const char* line_end = std::find(line, end, '\n');
+        while ( line < line_end && (*line == ' ' || *line == '\t') )
+            ++line;
+        if ( line_end - line > 7 && std::strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t') )
+        {
+            const char* first = line + 7;
+            while ( first < line_end && (*first == ' ' || *first == '\t') )
+                ++first;
+            const char* last = first;
+            while ( last < line_end && *last != ' ' && *last != '\t' && *last != '\r' )
+                ++last;
+            name.assign(first, last);
+        }
+        line = line_end + 1;
+    }
+
+    MappedFile_Close(&file);
+    return name;
+}
+
+// Caminho do ".mtl" "name" de "source_filename", que fica no mesmo diretório
+// (como em ObjModel, em main.cpp)
+std::string MeshCache_MaterialPath(const char* source_filename, const char* name)
+{
+    std::string path(source_filename);
+    size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? std::string(name) : path.substr(0, slash + 1) + name;
+}
+
+// Se "count" elementos de "size" bytes a partir de "offset" cabem em um
+// arquivo de "file_size" bytes, sem overflow
+bool MeshCache_Fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size)
+{
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+uint64_t MeshCache_Align(uint64_t offset)
+{
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+// Grava "mesh", gerado a partir de "source_filename" (cujo hash já está em
+// mesh.source_hash), em "cache_filename". Retorna false se o arquivo não
+// puder ser escrito.
+bool MeshCache_Write(const char* source_filename, const char* cache_filename, const MeshData& mesh)
+{
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.num_lods = mesh.num_lods;
+    header.vertex_size = sizeof(PackedVertex);
+    header.index_size = (uint32_t)IndexTypeSize(mesh.index_type);
+    header.flags = (mesh.has_normals ? MESH_HAS_NORMALS : 0) | (mesh.has_texcoords ? MESH_HAS_TEXCOORDS : 0)
+                 | (mesh.planar_texcoords ? MESH_PLANAR_TEXCOORDS : 0);
+    header.num_objects = (uint32_t)mesh.objects.size();
+    header.source_hash = mesh.source_hash;
+    if ( !MeshCache_SourceKey(source_filename, &header.source_size, &header.source_mtime, NULL) )
+        return false;
+
+    std::string material_library = MeshCache_MaterialLibrary(source_filename);
+    if ( material_library.size() >= MESH_CACHE_NAME_SIZE )
+        return false;
+    std::memcpy(header.material_library, material_library.c_str(), material_library.size() + 1);
+    if ( !material_library.empty()
+         && !MeshCache_SourceKey(MeshCache_MaterialPath(source_filename, header.material_library).c_str(),
+                                 &header.material_size, &header.material_mtime, &header.material_hash) )
+    {
+        header.material_size = 0;
+        header.material_mtime = 0;
+        header.material_hash = 0;
+    }
+
+    std::vector<MeshCacheObject> objects(mesh.objects.size());
+    std::string names;
+    for (size_t i = 0; i < mesh.objects.size(); ++i)
+    {
+        const MeshObject& object = mesh.objects[i];
+        MeshCacheObject& record = objects[i];
+        std::memset(&record, 0, sizeof(record));
+        record.name_offset = (uint32_t)names.size();
+        record.name_length = (uint32_t)object.name.size();
+        record.material_id = object.material_id;
+        for (int j = 0; j < 3; ++j)
+        {
+            record.bbox_min[j] = object.bbox_min[j];
+            record.bbox_max[j] = object.bbox_max[j];
+        }
+        for (uint32_t lod = 0; lod < mesh.num_lods; ++lod)
+        {
+            record.first_index[lod] = object.first_index[lod];
+            record.num_indices[lod] = object.num_indices[lod];
+        }
+        names += object.name;
+    }
+
+    header.num_vertices = mesh.num_vertices;
+    header.num_indices = mesh.num_indices;
+    header.objects_offset = MeshCache_Align(sizeof(MeshCacheHeader));
+    header.names_offset = MeshCache_Align(header.objects_offset + objects.size() * sizeof(MeshCacheObject));
+    header.vertices_offset = MeshCache_Align(header.names_offset + names.size());
+    header.indices_offset = MeshCache_Align(header.vertices_offset + mesh.num_vertices * sizeof(PackedVertex));
+    header.file_size = header.indices_offset + mesh.num_indices * header.index_size;
+
+    // Montamos o arquivo inteiro em memória, com os espaços de alinhamento
+    // zerados, e o escrevemos em um arquivo temporário renomeado no fim
+    std::vector<unsigned char> data(header.file_size, 0);
+    std::memcpy(&data[0], &header, sizeof(header));
+    if ( !objects.empty() )
+        std::memcpy(&data[header.objects_offset], objects.data(), objects.size() * sizeof(MeshCacheObject));
+    if ( !names.empty() )
+        std::memcpy(&data[header.names_offset], names.data(), names.size());
+    if ( mesh.num_vertices > 0 )
+        std::memcpy(&data[header.vertices_offset], mesh.vertices, mesh.num_vertices * sizeof(PackedVertex));
+    if ( mesh.num_indices > 0 )
+        std::memcpy(&data[header.indices_offset], mesh.indices, mesh.num_indices * header.index_size);
+
+    std::string temporary = std::string(cache_filename) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if ( file == NULL )
+        return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = (fclose(file) == 0) && ok;
+
+    std::remove(cache_filename);
+    if ( !ok || std::rename(temporary.c_str(), cache_filename) != 0 )
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Abre o cache "cache_filename" do modelo "source_filename", se ele existir,
+// for consistente, tiver "num_lods" níveis de detalhe, o mesmo tipo de
+// coordenadas de textura ("planar_texcoords") e corresponder ao ".obj" e ao
+// ".mtl" atuais. Se o ".obj" não existe, o cache é usado como está.
+bool MeshCache_Read(const char* source_filename, const char* cache_filename, uint32_t num_lods, bool planar_texcoords,
+                    MeshData* mesh)
+{
+    MappedFile& file = mesh->file;
+    if ( !MappedFile_Open(cache_filename, &file) )
+        return false;
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+    bool ok = file.size >= sizeof(MeshCacheHeader)
+           && std::memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) == 0
+           && header->version == MESH_CACHE_VERSION
+           && header->num_lods == num_lods && num_lods <= MESH_MAX_LODS
+           && ((header->flags & MESH_PLANAR_TEXCOORDS) != 0) == planar_texcoords
+           && header->vertex_size == sizeof(PackedVertex)
+           && (header->index_size == sizeof(GLushort) || header->index_size == sizeof(GLuint))
+           && header->file_size == file.size
+           && header->material_library[MESH_CACHE_NAME_SIZE - 1] == '\0'
+           && header->objects_offset % 16 == 0 && header->vertices_offset % 16 == 0 && header->indices_offset % 16 == 0
+           && MeshCache_Fits(header->objects_offset, header->num_objects, sizeof(MeshCacheObject), file.size)
+           && MeshCache_Fits(header->names_offset, 0, 1, file.size)
+           && MeshCache_Fits(header->vertices_offset, header->num_vertices, sizeof(PackedVertex), file.size)
+           && MeshCache_Fits(header->indices_offset, header->num_indices, header->index_size, file.size);
+
+    // O ".obj" ou o ".mtl" mudaram desde que o cache foi gerado?
+    uint64_t source_size;
+    int64_t source_mtime;
+    if ( ok && MeshCache_SourceKey(source_filename, &source_size, &source_mtime, NULL) )
+    {
+        ok = MeshCache_KeyMatches(source_filename, header->source_size, header->source_mtime, header->source_hash);
+        if ( ok && header->material_library[0] != '\0' )
+            ok = MeshCache_KeyMatches(MeshCache_MaterialPath(source_filename, header->material_library).c_str(),
+                                      header->material_size, header->material_mtime, header->material_hash);
+    }
+
+    // Todo índice deve apontar para um vértice do arquivo
+    if ( ok )
+    {
+        const unsigned char* indices = file.data + header->indices_offset;
+        uint64_t max_index = 0;
+        if ( header->index_size == sizeof(GLushort) )
+            for (uint64_t i = 0; i < header->num_indices; ++i)
+                max_index = std::max(max_index, (uint64_t)((const GLushort*)indices)[i]);
+        else
+            for (uint64_t i = 0; i < header->num_indices; ++i)
+                max_index = std::max(max_index, (uint64_t)((const GLuint*)indices)[i]);
+        ok = header->num_indices == 0 || max_index < header->num_vertices;
+    }
+
+    if ( !ok )
+    {
+        MappedFile_Close(&file);
+        return false;
+    }
+
+    const MeshCacheObject* objects = (const MeshCacheObject*)(file.data + header->objects_offset);
+    const char* names = (const char*)(file.data + header->names_offset);
+    mesh->objects.resize(header->num_objects);
+    for (uint32_t i = 0; i < header->num_objects; ++i)
+    {
+        const MeshCacheObject& record = objects[i];
+        bool valid = MeshCache_Fits(header->names_offset + record.name_offset, record.name_length, 1, file.size);
+        for (uint32_t lod = 0; lod < num_lods && valid; ++lod)
+            valid = record.first_index[lod] <= header->num_indices
+                 && record.num_indices[lod] <= header->num_indices - record.first_index[lod];
+        if ( !valid )
+        {
+            MappedFile_Close(&file);
+            mesh->objects.clear();
+            return false;
+        }
+
+        MeshObject& object = mesh->objects[i];
+        object.name.assign(names + record.name_offset, record.name_length);
+        object.material_id = record.material_id;
+        object.bbox_min = glm::vec3(record.bbox_min[0], record.bbox_min[1], record.bbox_min[2]);
+        object.bbox_max = glm::vec3(record.bbox_max[0], record.bbox_max[1], record.bbox_max[2]);
+        for (uint32_t lod = 0; lod < num_lods; ++lod)
+        {
+            object.first_index[lod] = (size_t)record.first_index[lod];
+            object.num_indices[lod] = (size_t)record.num_indices[lod];
+        }
+    }
+
+    mesh->name = mesh->objects.empty() ? std::string() : mesh->objects[0].name;
+    mesh->source = source_filename;
+    mesh->source_hash = header->source_hash;
+    mesh->num_lods = num_lods;
+    mesh->has_normals = (header->flags & MESH_HAS_NORMALS) != 0;
+    mesh->has_texcoords = (header->flags & MESH_HAS_TEXCOORDS) != 0;
+    mesh->planar_texcoords = planar_texcoords;
+    mesh->vertices = (const PackedVertex*)(file.data + header->vertices_offset);
+    mesh->num_vertices = (size_t)header->num_vertices;
+    mesh->indices = file.data + header->indices_offset;
+    mesh->num_indices = (size_t)header->num_indices;
+    mesh->index_type = (header->index_size == sizeof(GLushort)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    return true;
+}
+
+#endif // _MESHCACHE_H
+// vim: set spell spelllang=pt_br :
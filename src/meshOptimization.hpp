@@ -0,0 +1,290 @@
+#ifndef _MESHOPTIMIZATION_H
+#define _MESHOPTIMIZATION_H
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Headers da biblioteca GLM: criação de matrizes e vetores.
+#include <glm/vec4.hpp>
+#include <glm/gtc/packing.hpp>
+
+// Funções que preparam as malhas de BuildTrianglesAndAddToVirtualScene() para
+// que a GPU processe cada vértice o menor número de vezes possível: vértices
+// idênticos são guardados uma única vez (VertexKey) e os triângulos são
+// reordenados para aproveitar o cache de vértices já transformados
+// ("post-transform cache") da GPU (OptimizeVertexCache()). Por fim, os
+// atributos são compactados em um único buffer intercalado (PackVertices()).
+
+// Atributos de um vértice (posição, normal e coordenadas de textura), usados
+// como chave de um std::map para encontrar vértices idênticos.
+struct VertexKey
+{
+    float attributes[8];
+
+    VertexKey() { std::memset(attributes, 0, sizeof(attributes)); }
+
+    bool operator<(const VertexKey& other) const
+    {
+        return std::memcmp(attributes, other.attributes, sizeof(attributes)) < 0;
+    }
+};
+
+// Simula um cache FIFO de "cache_size" vértices transformados e retorna o
+// ACMR ("average cache miss ratio"): o número médio de vértices processados
+// pelo vertex shader por triângulo. Vai de 3.0 (nenhum reaproveitamento) até
+// perto de 0.5 em malhas regulares.
+float ComputeACMR(const GLuint* indices, size_t num_indices, int cache_size)
+{
+    if ( num_indices == 0 )
+        return 0.0f;
+
+    std::vector<GLuint> cache;
+    size_t misses = 0;
+
+    for (size_t i = 0; i < num_indices; ++i)
+    {
+        if ( std::find(cache.begin(), cache.end(), indices[i]) != cache.end() )
+            continue;
+
+        misses += 1;
+        cache.push_back(indices[i]);
+        if ( (int)cache.size() > cache_size )
+            cache.erase(cache.begin());
+    }
+
+    return (float)misses / (num_indices / 3);
+}
+
+// Pontuação de um vértice no algoritmo de Tom Forsyth ("Linear-Speed Vertex
+// Cache Optimisation", 2006), dada a sua posição no cache LRU simulado (-1 se
+// fora dele) e o número de triângulos ainda não emitidos que o usam.
+float ForsythVertexScore(int cache_position, int remaining_triangles)
+{
+    const int   cache_size = 32;
+    const float cache_decay_power = 1.5f;
+    const float last_triangle_score = 0.75f;
+    const float valence_boost_scale = 2.0f;
+    const float valence_boost_power = 0.5f;
+
+    if ( remaining_triangles == 0 )
+        return -1.0f; // Nenhum triângulo precisa mais deste vértice
+
+    float score = 0.0f;
+    if ( cache_position >= 0 )
+    {
+        if ( cache_position < 3 )
+        {
+            // Os vértices do último triângulo emitido recebem uma pontuação
+            // fixa, para não favorecer tiras longas e finas de triângulos.
+            score = last_triangle_score;
+        }
+        else
+        {
+            float scaler = 1.0f / (cache_size - 3);
+            score = std::pow(1.0f - (cache_position - 3) * scaler, cache_decay_power);
+        }
+    }
+
+    // Vértices com poucos triângulos restantes são priorizados, para que
+    // saiam logo do caminho.
+    score += valence_boost_scale * std::pow((float)remaining_triangles, -valence_boost_power);
+    return score;
+}
+
+// Reordena os triângulos de "indices" (sem alterar os triângulos em si) para
+// que vértices usados por triângulos próximos na ordem ainda estejam no cache
+// da GPU quando forem usados de novo. Algoritmo de Tom Forsyth.
+void OptimizeVertexCache(GLuint* indices, size_t num_indices)
+{
+    const int cache_size = 32;
+
+    size_t num_triangles = num_indices / 3;
+    if ( num_triangles == 0 )
+        return;
+
+    // Numeramos localmente os vértices usados pela malha
+    std::unordered_map<GLuint, int> local_vertex;
+    std::vector<int> triangle_vertices(num_indices);
+    for (size_t i = 0; i < num_indices; ++i)
+    {
+        std::unordered_map<GLuint, int>::iterator it = local_vertex.find(indices[i]);
+        if ( it == local_vertex.end() )
+            it = local_vertex.insert(std::make_pair(indices[i], (int)local_vertex.size())).first;
+        triangle_vertices[i] = it->second;
+    }
+    size_t num_vertices = local_vertex.size();
+
+    // Triângulos de cada vértice, em um único vetor (formato CSR)
+    std::vector<int> vertex_remaining(num_vertices, 0);
+    for (size_t i = 0; i < num_indices; ++i)
+        vertex_remaining[triangle_vertices[i]] += 1;
+
+    std::vector<int> vertex_first_triangle(num_vertices + 1, 0);
+    for (size_t v = 0; v < num_vertices; ++v)
+        vertex_first_triangle[v + 1] = vertex_first_triangle[v] + vertex_remaining[v];
+
+    std::vector<int> vertex_triangles(num_indices);
+    std::vector<int> fill(vertex_first_triangle.begin(), vertex_first_triangle.end() - 1);
+    for (size_t t = 0; t < num_triangles; ++t)
+        for (int c = 0; c < 3; ++c)
+            vertex_triangles[fill[triangle_vertices[3*t + c]]++] = (int)t;
+
+    std::vector<float> vertex_score(num_vertices);
+    for (size_t v = 0; v < num_vertices; ++v)
+        vertex_score[v] = ForsythVertexScore(-1, vertex_remaining[v]);
+
+    std::vector<float> triangle_score(num_triangles);
+    std::vector<bool>  triangle_emitted(num_triangles, false);
+    for (size_t t = 0; t < num_triangles; ++t)
+        triangle_score[t] = vertex_score[triangle_vertices[3*t]] + vertex_score[triangle_vertices[3*t+1]] + vertex_score[triangle_vertices[3*t+2]];
+
+    std::vector<int> cache, new_cache;
+    std::vector<GLuint> output;
+    output.reserve(num_indices);
+
+    size_t scan_cursor = 0; // Primeiro triângulo que pode ainda não ter sido emitido
+    int best_triangle = -1;
+
+    for (size_t emitted = 0; emitted < num_triangles; ++emitted)
+    {
+        if ( best_triangle < 0 )
+        {
+            // Nenhum candidato vindo do cache: recomeçamos pelo primeiro
+            // triângulo ainda não emitido, na ordem original.
+            while ( triangle_emitted[scan_cursor] )
+                scan_cursor += 1;
+            best_triangle = (int)scan_cursor;
+        }
+
+        int t = best_triangle;
+        triangle_emitted[t] = true;
+        for (int c = 0; c < 3; ++c)
+        {
+            int v = triangle_vertices[3*t + c];
+            output.push_back(indices[3*t + c]);
+
+            // Removemos o triângulo da lista de triângulos restantes do vértice
+            int* first = &vertex_triangles[vertex_first_triangle[v]];
+            int* last  = first + vertex_remaining[v];
+            std::iter_swap(std::find(first, last, t), last - 1);
+            vertex_remaining[v] -= 1;
+        }
+
+        // Os vértices do triângulo vão para o início do cache LRU simulado
+        new_cache.clear();
+        for (int c = 0; c < 3; ++c)
+            new_cache.push_back(triangle_vertices[3*t + c]);
+        for (size_t i = 0; i < cache.size(); ++i)
+            if ( std::find(new_cache.begin(), new_cache.begin() + 3, cache[i]) == new_cache.begin() + 3 )
+                new_cache.push_back(cache[i]);
+        cache.swap(new_cache);
+
+        // Atualizamos as pontuações dos vértices no cache (e dos que saíram)
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            int v = cache[i];
+            int position = (i < (size_t)cache_size) ? (int)i : -1;
+            vertex_score[v] = ForsythVertexScore(position, vertex_remaining[v]);
+        }
+        if ( cache.size() > (size_t)cache_size )
+            cache.resize(cache_size);
+
+        // E as dos triângulos que usam estes vértices, escolhendo o próximo
+        best_triangle = -1;
+        float best_score = -1.0f;
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            int v = cache[i];
+            for (int j = 0; j < vertex_remaining[v]; ++j)
+            {
+                int u = vertex_triangles[vertex_first_triangle[v] + j];
+                triangle_score[u] = vertex_score[triangle_vertices[3*u]] + vertex_score[triangle_vertices[3*u+1]] + vertex_score[triangle_vertices[3*u+2]];
+                if ( triangle_score[u] > best_score )
+                {
+                    best_score = triangle_score[u];
+                    best_triangle = u;
+                }
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Vértice compacto, guardado intercalado em um único VBO: posição em floats
+// (w = 1 é reconstruído no vertex shader), normal em GL_INT_2_10_10_10_REV e
+// coordenadas de textura em half-floats. São 20 bytes por vértice, contra os
+// 40 bytes dos três buffers de floats (vec4, vec4 e vec2) usados antes.
+struct PackedVertex
+{
+    float    position[3];
+    GLuint   normal;
+    GLushort texcoords[2];
+};
+
+// Converte os atributos em "model_coefficients" (4 floats por vértice),
+// "normal_coefficients" (4 floats) e "texture_coefficients" (2 floats) para
+// PackedVertex. Os dois últimos podem estar vazios, se o modelo não tiver
+// normais ou coordenadas de textura; caso contrário, devem ter um valor para
+// cada vértice.
+std::vector<PackedVertex> PackVertices(const std::vector<float>& model_coefficients,
+                                       const std::vector<float>& normal_coefficients,
+                                       const std::vector<float>& texture_coefficients)
+{
+    size_t num_vertices = model_coefficients.size() / 4;
+    std::vector<PackedVertex> vertices(num_vertices);
+
+    assert(normal_coefficients.empty() || normal_coefficients.size() == 4 * num_vertices);
+    assert(texture_coefficients.empty() || texture_coefficients.size() == 2 * num_vertices);
+
+    for (size_t i = 0; i < num_vertices; ++i)
+    {
+        PackedVertex& vertex = vertices[i];
+        vertex.position[0] = model_coefficients[4*i + 0];
+        vertex.position[1] = model_coefficients[4*i + 1];
+        vertex.position[2] = model_coefficients[4*i + 2];
+
+        vertex.normal = 0;
+        if ( !normal_coefficients.empty() )
+        {
+            const float* n = &normal_coefficients[4*i];
+            vertex.normal = glm::packSnorm3x10_1x2(glm::vec4(n[0], n[1], n[2], 0.0f));
+        }
+
+        vertex.texcoords[0] = vertex.texcoords[1] = 0;
+        if ( !texture_coefficients.empty() )
+        {
+            vertex.texcoords[0] = glm::packHalf1x16(texture_coefficients[2*i + 0]);
+            vertex.texcoords[1] = glm::packHalf1x16(texture_coefficients[2*i + 1]);
+        }
+    }
+
+    return vertices;
+}
+
+// Tipo dos índices de um modelo com "num_vertices" vértices: 16 bits sempre
+// que possível, para gastar metade da memória e da banda de leitura.
+GLenum IndexTypeForVertexCount(size_t num_vertices)
+{
+    return (num_vertices <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// Tamanho em bytes de um índice do tipo "index_type"
+size_t IndexTypeSize(GLenum index_type)
+{
+    return (index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+#endif // _MESHOPTIMIZATION_H
+// vim: set spell spelllang=pt_br :
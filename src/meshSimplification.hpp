@@ -0,0 +1,302 @@
+#ifndef _MESHSIMPLIFICATION_H
+#define _MESHSIMPLIFICATION_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <map>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Headers da biblioteca GLM: criação de matrizes e vetores.
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+
+// Simplificação de malhas por colapso de arestas guiado por "quadric error
+// metrics" (Garland e Heckbert, 1997), usada para gerar os níveis de detalhe
+// (LODs) dos modelos em BuildTrianglesAndAddToVirtualScene().
+//
+// Usamos colapsos de meia-aresta (u -> v): o vértice u é removido e os seus
+// triângulos passam a usar o vértice v, que já existe no buffer de vértices.
+// Assim, cada nível de detalhe é apenas um novo vetor de índices sobre os
+// mesmos vértices, e não é preciso criar novos atributos.
+
+// Quádrica simétrica 4x4, guardada pelos seus 10 coeficientes distintos. O
+// valor Q(p) é a soma dos quadrados das distâncias de p aos planos somados.
+struct MeshQuadric
+{
+    double a[10]; // a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+
+    MeshQuadric() { std::memset(a, 0, sizeof(a)); }
+
+    void addPlane(double nx, double ny, double nz, double d, double weight)
+    {
+        a[0] += weight*nx*nx; a[1] += weight*nx*ny; a[2] += weight*nx*nz; a[3] += weight*nx*d;
+        a[4] += weight*ny*ny; a[5] += weight*ny*nz; a[6] += weight*ny*d;
+        a[7] += weight*nz*nz; a[8] += weight*nz*d;
+        a[9] += weight*d*d;
+    }
+
+    void add(const MeshQuadric& other)
+    {
+        for (int i = 0; i < 10; ++i)
+            a[i] += other.a[i];
+    }
+
+    double evaluate(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+             + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+             + a[7]*z*z + 2*a[8]*z
+             + a[9];
+    }
+};
+
+// Simplifica a malha de triângulos "indices" (índices para vértices em
+// "model_coefficients", 4 floats por vértice) em "num_levels" níveis
+// sucessivos. O nível l é escrito em levels[l] e tem no máximo
+// target_index_counts[l] índices, a menos que a malha não possa ser mais
+// simplificada sem alterar a sua borda ou costuras. Vértices na borda da
+// malha (arestas usadas por um único triângulo) nunca são removidos. Como
+// BuildTrianglesAndAddToVirtualScene() só junta vértices com atributos
+// idênticos, isso inclui as costuras de textura e as quinas.
+void SimplifyMesh(const std::vector<float>& model_coefficients,
+                  const GLuint* indices, size_t num_indices,
+                  const size_t* target_index_counts, int num_levels,
+                  std::vector<GLuint>* levels)
+{
+    // Numeramos localmente os vértices usados pela malha
+    std::unordered_map<GLuint, int> local_vertex;
+    std::vector<GLuint>    global_vertex;
+    std::vector<glm::vec3> position;
+
+    size_t num_faces = num_indices / 3;
+    std::vector<int>  face_vertices(3 * num_faces);
+    std::vector<bool> face_alive(num_faces, true);
+
+    for (size_t i = 0; i < num_indices; ++i)
+    {
+        std::unordered_map<GLuint, int>::iterator it = local_vertex.find(indices[i]);
+        if ( it == local_vertex.end() )
+        {
+            it = local_vertex.insert(std::make_pair(indices[i], (int)global_vertex.size())).first;
+            global_vertex.push_back(indices[i]);
+            const float* p = &model_coefficients[4*indices[i]];
+            position.push_back(glm::vec3(p[0], p[1], p[2]));
+        }
+        face_vertices[i] = it->second;
+    }
+
+    size_t num_vertices = global_vertex.size();
+    std::vector<MeshQuadric>      quadric(num_vertices);
+    std::vector<std::vector<int>> vertex_faces(num_vertices);
+    std::vector<bool>             locked(num_vertices, false);
+    std::vector<bool>             removed(num_vertices, false);
+    std::vector<unsigned>         version(num_vertices, 0);
+
+    // Quádricas iniciais: planos dos triângulos vizinhos, com peso pela área
+    for (size_t f = 0; f < num_faces; ++f)
+    {
+        const int* v = &face_vertices[3*f];
+        glm::vec3 n = glm::cross(position[v[1]] - position[v[0]], position[v[2]] - position[v[0]]);
+        float length = glm::length(n);
+        if ( length > 0.0f )
+        {
+            n /= length;
+            double d = -glm::dot(n, position[v[0]]);
+            for (int c = 0; c < 3; ++c)
+                quadric[v[c]].addPlane(n.x, n.y, n.z, d, 0.5 * length);
+        }
+        for (int c = 0; c < 3; ++c)
+            vertex_faces[v[c]].push_back((int)f);
+    }
+
+    // Travamos os vértices de arestas de borda (e de arestas não-manifold)
+    std::map<std::pair<int,int>, int> edge_uses;
+    for (size_t f = 0; f < num_faces; ++f)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            int a = face_vertices[3*f + c];
+            int b = face_vertices[3*f + (c+1)%3];
+            edge_uses[std::make_pair(std::min(a,b), std::max(a,b))] += 1;
+        }
+    }
+    for (std::map<std::pair<int,int>, int>::iterator it = edge_uses.begin(); it != edge_uses.end(); ++it)
+    {
+        if ( it->second != 2 )
+        {
+            locked[it->first.first] = true;
+            locked[it->first.second] = true;
+        }
+    }
+
+    struct Collapse
+    {
+        double   cost;
+        int      from, to;
+        unsigned from_version, to_version;
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+
+    // Vizinhos de um vértice, através dos seus triângulos ainda existentes
+    std::vector<int> neighbors;
+    auto collect_neighbors = [&](int u, std::vector<int>* out) {
+        out->clear();
+        for (size_t i = 0; i < vertex_faces[u].size(); ++i)
+        {
+            int f = vertex_faces[u][i];
+            if ( !face_alive[f] )
+                continue;
+            for (int c = 0; c < 3; ++c)
+            {
+                int w = face_vertices[3*f + c];
+                if ( w != u && std::find(out->begin(), out->end(), w) == out->end() )
+                    out->push_back(w);
+            }
+        }
+    };
+
+    auto push_collapse = [&](int from, int to) {
+        if ( locked[from] )
+            return;
+        MeshQuadric q = quadric[from];
+        q.add(quadric[to]);
+        Collapse collapse;
+        collapse.cost = q.evaluate(position[to]);
+        collapse.from = from;
+        collapse.to = to;
+        collapse.from_version = version[from];
+        collapse.to_version = version[to];
+        heap.push(collapse);
+    };
+
+    for (size_t u = 0; u < num_vertices; ++u)
+    {
+        collect_neighbors((int)u, &neighbors);
+        for (size_t i = 0; i < neighbors.size(); ++i)
+            push_collapse((int)u, neighbors[i]);
+    }
+
+    size_t alive_faces = num_faces;
+    std::vector<int> from_neighbors, to_neighbors;
+
+    auto write_level = [&](std::vector<GLuint>* level) {
+        level->clear();
+        for (size_t f = 0; f < num_faces; ++f)
+        {
+            if ( !face_alive[f] )
+                continue;
+            for (int c = 0; c < 3; ++c)
+                level->push_back(global_vertex[face_vertices[3*f + c]]);
+        }
+    };
+
+    for (int l = 0; l < num_levels; ++l)
+    {
+        while ( 3 * alive_faces > target_index_counts[l] && !heap.empty() )
+        {
+            Collapse collapse = heap.top();
+            heap.pop();
+
+            int u = collapse.from;
+            int v = collapse.to;
+            if ( removed[u] || removed[v] || version[u] != collapse.from_version || version[v] != collapse.to_version )
+                continue;
+
+            // A aresta u-v ainda deve existir, e os vizinhos em comum de u e v
+            // devem ser só os vértices opostos dos triângulos da aresta. Caso
+            // contrário o colapso criaria geometria não-manifold.
+            collect_neighbors(u, &from_neighbors);
+            collect_neighbors(v, &to_neighbors);
+            if ( std::find(from_neighbors.begin(), from_neighbors.end(), v) == from_neighbors.end() )
+                continue;
+
+            int shared_faces = 0;
+            bool flips = false;
+            for (size_t i = 0; i < vertex_faces[u].size() && !flips; ++i)
+            {
+                int f = vertex_faces[u][i];
+                if ( !face_alive[f] )
+                    continue;
+
+                const int* fv = &face_vertices[3*f];
+                if ( fv[0] == v || fv[1] == v || fv[2] == v )
+                {
+                    shared_faces += 1;
+                    continue;
+                }
+
+                // O triângulo não pode inverter nem degenerar ao mover u para v
+                glm::vec3 p[3], q[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    p[c] = position[fv[c]];
+                    q[c] = (fv[c] == u) ? position[v] : p[c];
+                }
+                glm::vec3 n_before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 n_after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+                float length_after = glm::length(n_after);
+                if ( length_after == 0.0f || glm::dot(n_before, n_after) <= 0.0f )
+                    flips = true;
+            }
+            if ( flips )
+                continue;
+
+            int shared_neighbors = 0;
+            for (size_t i = 0; i < from_neighbors.size(); ++i)
+                if ( std::find(to_neighbors.begin(), to_neighbors.end(), from_neighbors[i]) != to_neighbors.end() )
+                    shared_neighbors += 1;
+            if ( shared_neighbors != shared_faces )
+                continue;
+
+            // Colapsamos u em v
+            for (size_t i = 0; i < vertex_faces[u].size(); ++i)
+            {
+                int f = vertex_faces[u][i];
+                if ( !face_alive[f] )
+                    continue;
+
+                int* fv = &face_vertices[3*f];
+                if ( fv[0] == v || fv[1] == v || fv[2] == v )
+                {
+                    face_alive[f] = false;
+                    alive_faces -= 1;
+                    continue;
+                }
+                for (int c = 0; c < 3; ++c)
+                    if ( fv[c] == u )
+                        fv[c] = v;
+                vertex_faces[v].push_back(f);
+            }
+            vertex_faces[u].clear();
+            removed[u] = true;
+            quadric[v].add(quadric[u]);
+            version[v] += 1;
+
+            // Os colapsos que envolvem v mudaram de custo
+            collect_neighbors(v, &to_neighbors);
+            for (size_t i = 0; i < to_neighbors.size(); ++i)
+            {
+                push_collapse(v, to_neighbors[i]);
+                push_collapse(to_neighbors[i], v);
+            }
+        }
+
+        write_level(&levels[l]);
+    }
+}
+
+#endif // _MESHSIMPLIFICATION_H
+// vim: set spell spelllang=pt_br :
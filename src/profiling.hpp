@@ -0,0 +1,314 @@
+#ifndef _PROFILING_H
+#define _PROFILING_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+// Headers abaixo são específicos de C++
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Headers locais
+#include "trace.hpp"
+
+// Medição do tempo de CPU de cada fase do laço de renderização, e do tempo
+// de GPU de cada passo de desenho, usada pelo overlay de texto e pelo modo
+// "--benchmark N" (veja main()). Cada quadro é dividido em fases
+// consecutivas: Profiler_BeginPhase() encerra a fase anterior e começa a
+// próxima (uma fase pode aparecer mais de uma vez no quadro), e
+// Profiler_EndFrame() encerra a última e guarda as amostras. O quadro e as
+// fases também aparecem no trace, se ativado (veja "trace.hpp").
+
+enum ProfilePhase
+{
+    PHASE_CAMERA,     // Entrada, câmera e matrizes
+    PHASE_SCENE,      // Objetos estáticos colocados na fila de renderização
+    PHASE_PHYSICS,    // Movimento das bolas e colisões com a mesa
+    PHASE_COLLISIONS, // Colisões entre pares de bolas
+    PHASE_RAYCAST,    // Tiros
+    PHASE_SUBMIT,     // Fila de renderização e esferas enviadas à GPU
+    PHASE_OVERLAY,    // Texto
+    PHASE_SWAP,       // glfwSwapBuffers(); inclui esperar pela GPU
+    NUM_PROFILE_PHASES
+};
+
+const char* const g_ProfilePhaseNames[NUM_PROFILE_PHASES] = {
+    "camera", "scene", "physics", "collisions", "raycast", "submit", "overlay", "swap"
+};
+
+// Passos de desenho medidos na GPU com "timer queries" (GL_TIME_ELAPSED)
+enum GpuPass
+{
+    GPU_PASS_SCENE,   // SubmitRenderQueue()
+    GPU_PASS_SPHERES, // DrawSphereInstances()
+    GPU_PASS_TEXT,    // TextRendering_Flush()
+    NUM_GPU_PASSES
+};
+
+const char* const g_GpuPassNames[NUM_GPU_PASSES] = { "scene", "spheres", "text" };
+
+// Últimas amostras de uma medida, em um buffer circular, para as
+// estatísticas e o gráfico do overlay.
+const int PROFILE_HISTORY_SIZE = 240;
+
+struct SampleHistory
+{
+    float samples[PROFILE_HISTORY_SIZE];
+    int   next;  // Posição da próxima amostra
+    int   count; // Número de amostras válidas
+
+    void push(float value)
+    {
+        samples[next] = value;
+        next = (next + 1) % PROFILE_HISTORY_SIZE;
+        count = std::min(count + 1, PROFILE_HISTORY_SIZE);
+    }
+
+    // Amostra de "age" quadros atrás (0 é a mais recente)
+    float recent(int age) const
+    {
+        return samples[(next - 1 - age + 2 * PROFILE_HISTORY_SIZE) % PROFILE_HISTORY_SIZE];
+    }
+};
+
+SampleHistory g_FrameTimeHistory;
+SampleHistory g_PhaseHistory[NUM_PROFILE_PHASES];
+SampleHistory g_GpuPassHistory[NUM_GPU_PASSES];
+
+struct FrameProfiler
+{
+    std::chrono::steady_clock::time_point frame_start;
+    std::chrono::steady_clock::time_point phase_start;
+    int    current_phase; // -1 fora de um quadro
+    bool   recording;     // Guardar as amostras de cada quadro (modo benchmark)
+    double phase_ms[NUM_PROFILE_PHASES]; // Quadro atual
+
+    // Amostras de todos os quadros medidos
+    std::vector<double> frame_samples;
+    std::vector<double> phase_samples[NUM_PROFILE_PHASES];
+    std::vector<double> gpu_samples[NUM_GPU_PASSES];
+};
+
+FrameProfiler g_Profiler;
+
+double Profiler_ElapsedMs(std::chrono::steady_clock::time_point since, std::chrono::steady_clock::time_point until)
+{
+    return std::chrono::duration<double, std::milli>(until - since).count();
+}
+
+void Profiler_BeginFrame()
+{
+    g_Profiler.frame_start = g_Profiler.phase_start = std::chrono::steady_clock::now();
+    g_Profiler.current_phase = -1;
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+        g_Profiler.phase_ms[i] = 0.0;
+    Trace_Begin("frame");
+}
+
+void Profiler_BeginPhase(ProfilePhase phase)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( g_Profiler.current_phase >= 0 )
+    {
+        g_Profiler.phase_ms[g_Profiler.current_phase] += Profiler_ElapsedMs(g_Profiler.phase_start, now);
+        Trace_End(g_ProfilePhaseNames[g_Profiler.current_phase]);
+    }
+    g_Profiler.phase_start = now;
+    g_Profiler.current_phase = phase;
+    Trace_Begin(g_ProfilePhaseNames[phase]);
+}
+
+void Profiler_EndFrame()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( g_Profiler.current_phase >= 0 )
+    {
+        g_Profiler.phase_ms[g_Profiler.current_phase] += Profiler_ElapsedMs(g_Profiler.phase_start, now);
+        Trace_End(g_ProfilePhaseNames[g_Profiler.current_phase]);
+    }
+    g_Profiler.current_phase = -1;
+    Trace_End("frame");
+
+    double frame_ms = Profiler_ElapsedMs(g_Profiler.frame_start, now);
+    g_FrameTimeHistory.push((float)frame_ms);
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+        g_PhaseHistory[i].push((float)g_Profiler.phase_ms[i]);
+
+    if ( !g_Profiler.recording )
+        return;
+
+    g_Profiler.frame_samples.push_back(frame_ms);
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+        g_Profiler.phase_samples[i].push_back(g_Profiler.phase_ms[i]);
+}
+
+// Percentil "p" (entre 0 e 100) dos "count" valores em "values", pelo
+// método do posto mais próximo ("nearest rank"). Reordena "values":
+// std::nth_element() só coloca no lugar o valor procurado, sem ordenar tudo.
+double PercentileInPlace(double* values, size_t count, double p)
+{
+    if ( count == 0 )
+        return 0.0;
+
+    size_t rank = (size_t)std::ceil(p / 100.0 * count);
+    rank = std::min(std::max(rank, (size_t)1), count);
+    std::nth_element(values, values + rank - 1, values + count);
+    return values[rank - 1];
+}
+
+double Percentile(std::vector<double> samples, double p)
+{
+    return samples.empty() ? 0.0 : PercentileInPlace(samples.data(), samples.size(), p);
+}
+
+double Mean(const std::vector<double>& samples)
+{
+    if ( samples.empty() )
+        return 0.0;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i)
+        sum += samples[i];
+    return sum / samples.size();
+}
+
+// Percentil e média das amostras de um histórico. São chamadas a cada quadro
+// pelo overlay, então usam um buffer fixo em vez de copiar para um vetor.
+float HistoryPercentile(const SampleHistory& history, double p)
+{
+    static double scratch[PROFILE_HISTORY_SIZE];
+    std::copy(history.samples, history.samples + history.count, scratch);
+    return (float)PercentileInPlace(scratch, history.count, p);
+}
+
+float HistoryMean(const SampleHistory& history)
+{
+    if ( history.count == 0 )
+        return 0.0f;
+
+    double sum = 0.0;
+    for (int i = 0; i < history.count; ++i)
+        sum += history.samples[i];
+    return (float)(sum / history.count);
+}
+
+// Tempos de GPU. Os resultados de uma "timer query" só ficam prontos alguns
+// quadros depois; esperar por eles pararia a CPU até a GPU terminar. Usamos
+// então um anel de GPU_TIMER_FRAMES conjuntos de queries: no início de cada
+// quadro lemos as do conjunto que vamos reutilizar, se já estiverem prontas
+// (caso contrário a amostra é descartada), e só então as reiniciamos.
+const int GPU_TIMER_FRAMES = 4;
+
+struct GpuTimers
+{
+    GLuint queries[GPU_TIMER_FRAMES][NUM_GPU_PASSES];
+    bool   pending[GPU_TIMER_FRAMES][NUM_GPU_PASSES];
+    int    frame;        // Conjunto de queries do quadro atual
+    int    current_pass; // -1 se nenhuma query está ativa
+};
+
+GpuTimers g_GpuTimers;
+
+void GpuTimers_Init()
+{
+    glGenQueries(GPU_TIMER_FRAMES * NUM_GPU_PASSES, &g_GpuTimers.queries[0][0]);
+    for (int f = 0; f < GPU_TIMER_FRAMES; ++f)
+        for (int p = 0; p < NUM_GPU_PASSES; ++p)
+            g_GpuTimers.pending[f][p] = false;
+    g_GpuTimers.frame = 0;
+    g_GpuTimers.current_pass = -1;
+}
+
+void GpuTimers_BeginFrame()
+{
+    g_GpuTimers.frame = (g_GpuTimers.frame + 1) % GPU_TIMER_FRAMES;
+
+    for (int p = 0; p < NUM_GPU_PASSES; ++p)
+    {
+        if ( !g_GpuTimers.pending[g_GpuTimers.frame][p] )
+            continue;
+
+        GLuint query = g_GpuTimers.queries[g_GpuTimers.frame][p];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if ( available )
+        {
+            GLuint64 elapsed_ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+            g_GpuPassHistory[p].push((float)(elapsed_ns / 1.0e6));
+            if ( g_Profiler.recording )
+                g_Profiler.gpu_samples[p].push_back(elapsed_ns / 1.0e6);
+        }
+        g_GpuTimers.pending[g_GpuTimers.frame][p] = false;
+    }
+}
+
+// Só uma query GL_TIME_ELAPSED pode estar ativa por vez, então os passos
+// medidos não podem se sobrepor.
+void GpuTimers_Begin(GpuPass pass)
+{
+    glBeginQuery(GL_TIME_ELAPSED, g_GpuTimers.queries[g_GpuTimers.frame][pass]);
+    g_GpuTimers.current_pass = pass;
+}
+
+void GpuTimers_End()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    g_GpuTimers.pending[g_GpuTimers.frame][g_GpuTimers.current_pass] = true;
+    g_GpuTimers.current_pass = -1;
+}
+
+// Hash (FNV-1a de 64 bits) dos pixels do framebuffer atualmente ligado para
+// leitura. Duas execuções do benchmark que desenham exatamente a mesma
+// imagem têm o mesmo hash.
+uint64_t HashFramebuffer(int width, int height)
+{
+    std::vector<unsigned char> pixels(4 * (size_t)width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        hash ^= pixels[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Imprime o relatório do benchmark no terminal, em linhas "chave=valor"
+// fáceis de comparar entre execuções.
+void Profiler_PrintReport(uint64_t frame_hash)
+{
+    const std::vector<double>& frames = g_Profiler.frame_samples;
+
+    printf("benchmark frames=%d\n", (int)frames.size());
+    printf("benchmark frame_ms mean=%.3f p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+           Mean(frames), Percentile(frames, 50), Percentile(frames, 90),
+           Percentile(frames, 99), Percentile(frames, 100));
+
+    for (int i = 0; i < NUM_PROFILE_PHASES; ++i)
+    {
+        const std::vector<double>& phase = g_Profiler.phase_samples[i];
+        printf("benchmark cpu_ms phase=%s mean=%.3f p50=%.3f p99=%.3f\n", g_ProfilePhaseNames[i],
+               Mean(phase), Percentile(phase, 50), Percentile(phase, 99));
+    }
+
+    for (int i = 0; i < NUM_GPU_PASSES; ++i)
+    {
+        const std::vector<double>& pass = g_Profiler.gpu_samples[i];
+        printf("benchmark gpu_ms pass=%s samples=%d mean=%.3f p50=%.3f p99=%.3f\n", g_GpuPassNames[i],
+               (int)pass.size(), Mean(pass), Percentile(pass, 50), Percentile(pass, 99));
+    }
+
+    printf("benchmark frame_hash=%016llx\n", (unsigned long long)frame_hash);
+}
+
+#endif // _PROFILING_H
+// vim: set spell spelllang=pt_br :
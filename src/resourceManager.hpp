@@ -0,0 +1,321 @@
+#ifndef _RESOURCEMANAGER_H
+#define _RESOURCEMANAGER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+// Headers abaixo são específicos de C++
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Headers das bibliotecas OpenGL
+#include <glad/glad.h>   // Criação de contexto OpenGL 3.3
+
+// Gerenciador de recursos de GPU: texturas e modelos, pedidos pelo caminho do
+// arquivo e identificados por um handle (índice em g_Resources.items).
+//
+// - Um recurso cujo conteúdo (hash dos arquivos de origem) é igual ao de
+//   outro já carregado não é enviado de novo à GPU: os dois caminhos levam ao
+//   mesmo handle.
+// - Cada recurso tem um contador de referências: Resources_AddRef() e
+//   Resources_Release(). Um recurso sem referências continua na GPU, para o
+//   caso de ser pedido de novo, até que o total de memória de GPU passe do
+//   orçamento ("--resource-budget-mb", veja main()); então os recursos sem
+//   referências são descarregados, do usado há mais tempo ao mais recente.
+//   Resources_EvictUnused() descarrega todos eles de uma vez, por exemplo ao
+//   trocar de cena.
+// - Cada textura carregada ocupa uma unidade de textura própria, alocada
+//   pelo gerenciador (veja Resources_AllocateTextureUnit()) e devolvida
+//   quando a textura é descarregada.
+//
+// Os handles continuam válidos depois que o recurso é descarregado: um novo
+// pedido pelo mesmo caminho reaproveita o handle. A criação dos objetos
+// OpenGL fica com quem carrega o recurso (veja LoadTextureImage() e
+// AddMeshToVirtualScene() em main.cpp); o gerenciador só os destrói.
+
+enum ResourceType
+{
+    RESOURCE_TEXTURE,
+    RESOURCE_MESH
+};
+
+struct Resource
+{
+    ResourceType type;
+    std::string  path;
+    uint64_t     content_hash;
+    bool         resident;      // Objetos OpenGL existem
+    int          refcount;
+    size_t       gpu_bytes;     // Estimativa da memória de GPU ocupada
+    uint64_t     last_release;  // Ordem da última vez em que ficou sem referências
+
+    // RESOURCE_TEXTURE
+    GLenum       texture_target;
+    GLuint       texture_id;
+    GLuint       sampler_id;
+    GLint        texture_unit;
+
+    // RESOURCE_MESH
+    GLuint       vertex_array_id;
+    GLuint       vertex_buffer_id;
+    GLuint       index_buffer_id;
+};
+
+// Unidades de textura disponíveis; a unidade 31 é a da fonte (veja
+// "textrendering.cpp")
+const int RESOURCE_TEXTURE_UNITS = 31;
+
+struct ResourceManager
+{
+    std::vector<Resource>           items;
+    std::map<std::string, int>      by_path;
+    std::map<uint64_t, int>         by_hash[2];   // Só recursos na GPU, por tipo
+    std::vector<bool>               unit_in_use;
+    size_t                          gpu_bytes;
+    size_t                          budget_bytes; // 0: sem limite
+    uint64_t                        release_counter;
+
+    // Chamada antes de descarregar um modelo, para que os objetos da cena
+    // virtual que usam o seu VAO sejam removidos (veja main.cpp)
+    void (*on_mesh_evicted)(GLuint vertex_array_id);
+};
+
+ResourceManager g_Resources = { {}, {}, {}, std::vector<bool>(RESOURCE_TEXTURE_UNITS, false), 0, 256u << 20, 0, NULL };
+
+// Handle do recurso "path" que está na GPU, ou -1 se ele nunca foi carregado
+// ou foi descarregado. Não altera o contador de referências.
+int Resources_Find(const char* path)
+{
+    std::map<std::string, int>::iterator it = g_Resources.by_path.find(path);
+    if ( it == g_Resources.by_path.end() || !g_Resources.items[it->second].resident )
+        return -1;
+    return it->second;
+}
+
+// Idem, procurando um recurso na GPU pelo hash do seu conteúdo
+int Resources_FindByHash(ResourceType type, uint64_t content_hash)
+{
+    std::map<uint64_t, int>::iterator it = g_Resources.by_hash[type].find(content_hash);
+    return (it == g_Resources.by_hash[type].end()) ? -1 : it->second;
+}
+
+int Resources_AddRef(int handle)
+{
+    g_Resources.items[handle].refcount += 1;
+    return handle;
+}
+
+// Libera os objetos OpenGL de um recurso, que deve estar sem referências
+void Resources_Evict(int handle)
+{
+    Resource& resource = g_Resources.items[handle];
+    if ( !resource.resident )
+        return;
+
+    if ( resource.type == RESOURCE_TEXTURE )
+    {
+        glActiveTexture(GL_TEXTURE0 + resource.texture_unit);
+        glBindTexture(resource.texture_target, 0);
+        glBindSampler(resource.texture_unit, 0);
+        glDeleteTextures(1, &resource.texture_id);
+        glDeleteSamplers(1, &resource.sampler_id);
+        g_Resources.unit_in_use[resource.texture_unit] = false;
+        resource.texture_unit = -1;
+    }
+    else
+    {
+        if ( g_Resources.on_mesh_evicted != NULL )
+            g_Resources.on_mesh_evicted(resource.vertex_array_id);
+        glDeleteVertexArrays(1, &resource.vertex_array_id);
+        glDeleteBuffers(1, &resource.vertex_buffer_id);
+        glDeleteBuffers(1, &resource.index_buffer_id);
+    }
+
+    printf("Recurso \"%s\" descarregado (%d KiB).\n", resource.path.c_str(), (int)(resource.gpu_bytes / 1024));
+
+    g_Resources.gpu_bytes -= resource.gpu_bytes;
+    g_Resources.by_hash[resource.type].erase(resource.content_hash);
+    resource.resident = false;
+}
+
+// Descarrega todos os recursos sem referências
+void Resources_EvictUnused()
+{
+    for (size_t i = 0; i < g_Resources.items.size(); ++i)
+        if ( g_Resources.items[i].resident && g_Resources.items[i].refcount == 0 )
+            Resources_Evict((int)i);
+}
+
+// Descarrega recursos sem referências, do usado há mais tempo ao mais
+// recente, até que a memória de GPU volte ao orçamento (se possível)
+void Resources_EnforceBudget()
+{
+    while ( g_Resources.budget_bytes > 0 && g_Resources.gpu_bytes > g_Resources.budget_bytes )
+    {
+        int oldest = -1;
+        for (size_t i = 0; i < g_Resources.items.size(); ++i)
+        {
+            const Resource& resource = g_Resources.items[i];
+            if ( resource.resident && resource.refcount == 0
+                 && (oldest < 0 || resource.last_release < g_Resources.items[oldest].last_release) )
+                oldest = (int)i;
+        }
+        if ( oldest < 0 )
+            return; // Tudo o que está na GPU está em uso
+        Resources_Evict(oldest);
+    }
+}
+
+void Resources_Release(int handle)
+{
+    Resource& resource = g_Resources.items[handle];
+    if ( resource.refcount <= 0 )
+    {
+        fprintf(stderr, "WARNING: Resource \"%s\" released more times than acquired.\n", resource.path.c_str());
+        return;
+    }
+
+    resource.refcount -= 1;
+    if ( resource.refcount == 0 )
+    {
+        resource.last_release = ++g_Resources.release_counter;
+        Resources_EnforceBudget();
+    }
+}
+
+// Registra um recurso recém-enviado à GPU, com uma referência, e retorna o
+// seu handle (o mesmo de um pedido anterior pelo mesmo caminho, se houver;
+// um caminho que era outro nome de um recurso ganha um handle próprio)
+int Resources_Add(const Resource& resource)
+{
+    int handle;
+    std::map<std::string, int>::iterator it = g_Resources.by_path.find(resource.path);
+    if ( it != g_Resources.by_path.end() && g_Resources.items[it->second].path == resource.path
+         && !g_Resources.items[it->second].resident )
+    {
+        handle = it->second;
+        g_Resources.items[handle] = resource;
+    }
+    else
+    {
+        handle = (int)g_Resources.items.size();
+        g_Resources.items.push_back(resource);
+        g_Resources.by_path[resource.path] = handle;
+    }
+
+    Resource& added = g_Resources.items[handle];
+    added.resident = true;
+    added.refcount = 1;
+    added.last_release = 0;
+    g_Resources.by_hash[added.type][added.content_hash] = handle;
+    g_Resources.gpu_bytes += added.gpu_bytes;
+
+    Resources_EnforceBudget();
+    return handle;
+}
+
+// Registra o recurso "path" como outro nome de "handle", de mesmo conteúdo,
+// e acrescenta uma referência a ele
+int Resources_AddAlias(const char* path, int handle)
+{
+    g_Resources.by_path[path] = handle;
+    return Resources_AddRef(handle);
+}
+
+// Reserva uma unidade de textura livre para a textura "path", que deve ser
+// criada e ligada nela antes de Resources_AddTexture(). Aborta o programa se
+// não houver unidade livre.
+GLint Resources_AllocateTextureUnit(const char* path)
+{
+    std::vector<bool>::iterator free_unit = std::find(g_Resources.unit_in_use.begin(), g_Resources.unit_in_use.end(), false);
+    if ( free_unit == g_Resources.unit_in_use.end() )
+    {
+        fprintf(stderr, "ERROR: No free texture unit for \"%s\".\n", path);
+        std::exit(EXIT_FAILURE);
+    }
+    *free_unit = true;
+    return (GLint)(free_unit - g_Resources.unit_in_use.begin());
+}
+
+// Registra uma textura já criada e ligada, junto com o seu sampler, à
+// unidade "texture_unit" (veja Resources_AllocateTextureUnit())
+int Resources_AddTexture(const char* path, uint64_t content_hash, GLenum target, GLuint texture_id,
+                         GLuint sampler_id, GLint texture_unit, size_t gpu_bytes)
+{
+    Resource resource = Resource();
+    resource.type = RESOURCE_TEXTURE;
+    resource.path = path;
+    resource.content_hash = content_hash;
+    resource.gpu_bytes = gpu_bytes;
+    resource.texture_target = target;
+    resource.texture_id = texture_id;
+    resource.sampler_id = sampler_id;
+    resource.texture_unit = texture_unit;
+
+    return Resources_Add(resource);
+}
+
+// Registra os buffers de um modelo já enviado à GPU
+int Resources_AddMesh(const char* path, uint64_t content_hash, GLuint vertex_array_id,
+                      GLuint vertex_buffer_id, GLuint index_buffer_id, size_t gpu_bytes)
+{
+    Resource resource = Resource();
+    resource.type = RESOURCE_MESH;
+    resource.path = path;
+    resource.content_hash = content_hash;
+    resource.gpu_bytes = gpu_bytes;
+    resource.texture_unit = -1;
+    resource.vertex_array_id = vertex_array_id;
+    resource.vertex_buffer_id = vertex_buffer_id;
+    resource.index_buffer_id = index_buffer_id;
+
+    return Resources_Add(resource);
+}
+
+// Unidade de textura da textura "handle", que deve estar na GPU
+GLint Resources_TextureUnit(int handle)
+{
+    return g_Resources.items[handle].texture_unit;
+}
+
+// Imprime quantos recursos estão na GPU e a memória ocupada por eles
+void Resources_PrintSummary()
+{
+    int counts[2] = { 0, 0 };
+    size_t bytes[2] = { 0, 0 };
+    for (size_t i = 0; i < g_Resources.items.size(); ++i)
+    {
+        const Resource& resource = g_Resources.items[i];
+        if ( !resource.resident )
+            continue;
+        counts[resource.type] += 1;
+        bytes[resource.type] += resource.gpu_bytes;
+    }
+
+    printf("Recursos na GPU: %d texturas (%.1f MiB), %d modelos (%.1f MiB), %d caminhos.\n",
+           counts[RESOURCE_TEXTURE], bytes[RESOURCE_TEXTURE] / 1048576.0,
+           counts[RESOURCE_MESH], bytes[RESOURCE_MESH] / 1048576.0, (int)g_Resources.by_path.size());
+}
+
+// Descarrega todos os recursos no fim do programa, avisando sobre os que
+// ainda tinham referências (vazamentos)
+void Resources_Shutdown()
+{
+    for (size_t i = 0; i < g_Resources.items.size(); ++i)
+    {
+        Resource& resource = g_Resources.items[i];
+        if ( resource.resident && resource.refcount > 0 )
+        {
+            fprintf(stderr, "WARNING: Resource \"%s\" still has %d reference(s) at shutdown.\n",
+                    resource.path.c_str(), resource.refcount);
+            resource.refcount = 0;
+        }
+    }
+    Resources_EvictUnused();
+}
+
+#endif // _RESOURCEMANAGER_H
+// vim: set spell spelllang=pt_br :
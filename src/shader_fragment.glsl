@@ -15,46 +15,46 @@ in vec2 texcoords;
 
 in float lamber_gourad;
 
-// Matrizes computadas no código C++ e enviadas para a GPU
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-// Identificador que define qual objeto está sendo desenhado no momento
-#define UNKNOWN -2
-#define SPHERE 0
-#define GUN 3
-#define TABLE_TOP 4
-#define BRICK_ROOM 21
-#define AK47 26
-uniform int object_id;
-
-// Parâmetros da axis-aligned bounding box (AABB) do modelo
-uniform vec4 bbox_min;
-uniform vec4 bbox_max;
-
-// Variáveis para acesso das imagens de textura
-uniform sampler2D TextureTableTop;
-uniform sampler2D TexturePoolTable;
-uniform sampler2D TextureObjUnkown;
-uniform sampler2D TextureCueBall;
-uniform sampler2D TextureBall1;
-uniform sampler2D TextureBall2;
-uniform sampler2D TextureBall3;
-uniform sampler2D TextureBall4;
-uniform sampler2D TextureBall5;
-uniform sampler2D TextureBall6;
-uniform sampler2D TextureBall7;
-uniform sampler2D TextureBall8;
-uniform sampler2D TextureBall9;
-uniform sampler2D TextureBall10;
-uniform sampler2D TextureBall11;
-uniform sampler2D TextureBall12;
-uniform sampler2D TextureBall13;
-uniform sampler2D TextureBall14;
-uniform sampler2D TextureBall15;
-uniform sampler2D brick_room_texture;
-uniform sampler2D ak47_texture;
+// Identificador do objeto, vindo do bloco "ObjectUniforms" ou, no desenho
+// instanciado, do atributo por instância. Veja "shader_vertex.glsl". Só é
+// usado pelas bolas, para escolher a camada da textura.
+flat in int fragment_object_id;
+
+// Dados computados no código C++ e enviados para a GPU. Devem ser idênticos
+// aos blocos declarados em "shader_vertex.glsl".
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 camera_position;
+    vec4 light_direction;
+    vec4 gouraud_light_direction;
+};
+
+layout (std140) uniform ObjectUniforms
+{
+    mat4  model;
+    mat4  normal_matrix;
+    vec4  bbox_min; // Parâmetros da axis-aligned bounding box (AABB) do modelo
+    vec4  bbox_max;
+    ivec4 material;
+};
+
+// Material sendo desenhado. Este shader é compilado uma vez por material,
+// com exatamente um dos #defines abaixo inserido logo após a linha
+// "#version" (veja LoadShadersFromFiles() em "main.cpp"), de forma que cada
+// fragmento só execute o código do seu material:
+//
+//   MATERIAL_SPHERE, MATERIAL_BALL, MATERIAL_GUN, MATERIAL_TABLE_TOP,
+//   MATERIAL_BRICK_ROOM, MATERIAL_AK47 e MATERIAL_UNKNOWN.
+
+// Imagem de textura do material. As bolas usam uma textura com uma camada
+// por bola (camada 0 = bola branca).
+#if defined(MATERIAL_BALL)
+uniform sampler2DArray material_texture;
+#else
+uniform sampler2D material_texture;
+#endif
 
 // O valor de saída ("out") de um Fragment Shader é a cor final do fragmento.
 out vec4 color;
@@ -65,10 +65,8 @@ out vec4 color;
 
 void main()
 {
-    // Obtemos a posição da câmera utilizando a inversa da matriz que define o
-    // sistema de coordenadas da câmera.
-    vec4 origin = vec4(0.0, 0.0, 0.0, 1.0);
-    vec4 camera_position = inverse(view) * origin;
+    // A posição da câmera (a inversa da matriz "view" aplicada à origem) já
+    // vem computada do código C++ no bloco "FrameUniforms".
 
     // O fragmento atual é coberto por um ponto que percente à superfície de um
     // dos objetos virtuais da cena. Este ponto, p, possui uma posição no
@@ -82,7 +80,7 @@ void main()
     vec4 n = normalize(normal);
 
     // Vetor que define o sentido da fonte de luz em relação ao ponto atual.
-    vec4 l = normalize(vec4(1.0,12.0,0.0,0.0));
+    vec4 l = light_direction;
 
     // Vetor que define o sentido da câmera em relação ao ponto atual.
     vec4 v = normalize(camera_position - p);
@@ -100,165 +98,72 @@ void main()
     float U = 0.0;
     float V = 0.0;
 
-    if ( object_id == SPHERE )
-    {
-        // PREENCHA AQUI as coordenadas de textura da esfera, computadas com
-        // projeção esférica EM COORDENADAS DO MODELO. Utilize como referência
-        // o slides 134-150 do documento Aula_20_Mapeamento_de_Texturas.pdf.
-        // A esfera que define a projeção deve estar centrada na posição
-        // "bbox_center" definida abaixo.
-
-        // Você deve utilizar:
-        //   função 'length( )' : comprimento Euclidiano de um vetor
-        //   função 'atan( , )' : arcotangente. Veja https://en.wikipedia.org/wiki/Atan2.
-        //   função 'asin( )'   : seno inverso.
-        //   constante M_PI
-        //   variável position_model
-
-        vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
-        vec4 p_vector = position_model - bbox_center;
-
-        float px = p_vector.x;
-        float py = p_vector.y;
-        float pz = p_vector.z;
-
-        float rho = length(p_vector);
-        float theta = atan(px, pz);
-        float phi = asin(py / rho);
-
-        U = (theta + M_PI) / (2 * M_PI);
-        V = (phi + M_PI_2) / M_PI;
-
-        // Propriedades espectrais da esfera
-        Kd = vec3(0.8,0.4,0.08);
-        Ks = vec3(0.0,0.0,0.0);
-        Ka = vec3(0.4,0.2,0.04);
-        q = 1.0;
-    }
-    else if ( object_id == TABLE_TOP || object_id == GUN || object_id == BRICK_ROOM)
-    {
-        // Coordenadas de textura do plano, obtidas do arquivo OBJ.
-        U = texcoords.x;
-        V = texcoords.y;
-
-        // Propriedades espectrais da mesa
-        Kd = vec3(0.2,0.2,0.2);
-        Ks = vec3(0.3,0.3,0.3);
-        Ka = vec3(0.0,0.0,0.0);
-        q = 20.0;
-    } 
-    else if ( object_id == GUN || object_id == AK47)
-    {
-        // PREENCHA AQUI as coordenadas de textura do coelho, computadas com
-        // projeção planar XY em COORDENADAS DO MODELO. Utilize como referência
-        // o slides 99-104 do documento Aula_20_Mapeamento_de_Texturas.pdf,
-        // e também use as variáveis min*/max* definidas abaixo para normalizar
-        // as coordenadas de textura U e V dentro do intervalo [0,1]. Para
-        // tanto, veja por exemplo o mapeamento da variável 'p_v' utilizando
-        // 'h' no slides 158-160 do documento Aula_20_Mapeamento_de_Texturas.pdf.
-        // Veja também a Questão 4 do Questionário 4 no Moodle.
-
-        float minx = bbox_min.x;
-        float maxx = bbox_max.x;
-
-        float miny = bbox_min.y;
-        float maxy = bbox_max.y;
-
-        float minz = bbox_min.z;
-        float maxz = bbox_max.z;
-
-        U = (position_model.x - minx) / (maxx - minx);
-        V = (position_model.y - miny) / (maxy - miny);
-
-        // Propriedades espectrais da arma
-        Kd = vec3(0.08,0.4,0.8);
-        Ks = vec3(0.8,0.8,0.8);
-        Ka = Kd/2; //vec3(0.0,0.0,0.0);
-        q = 32.0;
-    } 
-    else if( object_id >= 10 && object_id <= 25 )
-    {
-        vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
-        vec4 p_vector = position_model - bbox_center;
-
-        float px = p_vector.x;
-        float py = p_vector.y;
-        float pz = p_vector.z;
-
-        float rho = length(p_vector);
-        float theta = atan(px, pz);
-        float phi = asin(py / rho);
-
-        U = (theta + M_PI) / (2 * M_PI);
-        V = (phi + M_PI_2) / M_PI;
-
-        // Propriedades espectrais da esfera
-        Kd = vec3(0.8,0.4,0.08);
-        Ks = vec3(0.0,0.0,0.0);
-        Ka = vec3(0.4,0.2,0.04);
-        q = 1.0;
-    }
-    else
-    {
-        U = texcoords.x;
-        V = texcoords.y;
-        
-        Kd = vec3(0.0,0.0,0.0);
-        Ks = vec3(0.0,0.0,0.0);
-        Ka = vec3(0.0,0.0,0.0);
-        q = 1.0;
-    }
+#if defined(MATERIAL_SPHERE) || defined(MATERIAL_BALL)
+    // Coordenadas de textura da esfera, computadas com projeção esférica EM
+    // COORDENADAS DO MODELO. Veja slides 134-150 do documento
+    // Aula_20_Mapeamento_de_Texturas.pdf. A esfera que define a projeção está
+    // centrada na posição "bbox_center" definida abaixo.
+    vec4 bbox_center = (bbox_min + bbox_max) / 2.0;
+    vec4 p_vector = position_model - bbox_center;
+
+    float px = p_vector.x;
+    float py = p_vector.y;
+    float pz = p_vector.z;
+
+    float rho = length(p_vector);
+    float theta = atan(px, pz);
+    float phi = asin(py / rho);
+
+    U = (theta + M_PI) / (2 * M_PI);
+    V = (phi + M_PI_2) / M_PI;
+
+    // Propriedades espectrais da esfera
+    Kd = vec3(0.8,0.4,0.08);
+    Ks = vec3(0.0,0.0,0.0);
+    Ka = vec3(0.4,0.2,0.04);
+    q = 1.0;
+#elif defined(MATERIAL_TABLE_TOP) || defined(MATERIAL_GUN) || defined(MATERIAL_BRICK_ROOM)
+    // Coordenadas de textura do plano, obtidas do arquivo OBJ.
+    U = texcoords.x;
+    V = texcoords.y;
+
+    // Propriedades espectrais da mesa
+    Kd = vec3(0.2,0.2,0.2);
+    Ks = vec3(0.3,0.3,0.3);
+    Ka = vec3(0.0,0.0,0.0);
+    q = 20.0;
+#elif defined(MATERIAL_AK47)
+    // Coordenadas de textura da arma, computadas com projeção planar XY em
+    // COORDENADAS DO MODELO, normalizadas para o intervalo [0,1] com a bbox
+    // de cada parte. São calculadas na CPU (veja BuildMeshData() em
+    // main.cpp), porque as partes são desenhadas como um único objeto, cuja
+    // bbox é a da arma inteira.
+    U = texcoords.x;
+    V = texcoords.y;
+
+    // Propriedades espectrais da arma
+    Kd = vec3(0.08,0.4,0.8);
+    Ks = vec3(0.8,0.8,0.8);
+    Ka = Kd/2; //vec3(0.0,0.0,0.0);
+    q = 32.0;
+#else
+    U = texcoords.x;
+    V = texcoords.y;
+
+    Kd = vec3(0.0,0.0,0.0);
+    Ks = vec3(0.0,0.0,0.0);
+    Ka = vec3(0.0,0.0,0.0);
+    q = 1.0;
+#endif
 
     // Obtemos a refletância difusa a partir da leitura das imagens de Textura
-    vec3 Kd0;
-
-    if ( object_id == GUN )
-    {
-        Kd0 = texture(TextureTableTop, vec2(U,V)).rgb;
-    } else if ( object_id == TABLE_TOP ){
-        Kd0 = texture(TexturePoolTable, vec2(U,V)).rgb;
-    } else if ( object_id == UNKNOWN ){
-        Kd0 = texture(TextureObjUnkown, vec2(U,V)).rgb;
-    } else if ( object_id == BRICK_ROOM ){
-        Kd0 = texture(brick_room_texture, vec2(U,V)).rgb;
-    } else if (object_id == 10 ){
-        Kd0 = texture(TextureCueBall, vec2(U,V)).rgb;
-    } else if (object_id == 11 ){
-        Kd0 = texture(TextureBall1, vec2(U,V)).rgb;
-    } else if (object_id == 12 ){
-        Kd0 = texture(TextureBall2, vec2(U,V)).rgb;
-    } else if (object_id == 13 ){
-        Kd0 = texture(TextureBall3, vec2(U,V)).rgb;
-    } else if (object_id == 14 ){
-        Kd0 = texture(TextureBall4, vec2(U,V)).rgb;
-    } else if (object_id == 15 ){
-        Kd0 = texture(TextureBall5, vec2(U,V)).rgb;
-    } else if (object_id == 16 ){
-        Kd0 = texture(TextureBall6, vec2(U,V)).rgb;
-    } else if (object_id == 17 ){
-        Kd0 = texture(TextureBall7, vec2(U,V)).rgb;
-    } else if (object_id == 18 ){
-        Kd0 = texture(TextureBall8, vec2(U,V)).rgb;
-    } else if (object_id == 19 ){
-        Kd0 = texture(TextureBall9, vec2(U,V)).rgb;
-    } else if (object_id == 20 ){
-        Kd0 = texture(TextureBall10, vec2(U,V)).rgb;
-    } else if (object_id == 21 ){
-        Kd0 = texture(TextureBall11, vec2(U,V)).rgb;
-    } else if (object_id == 22 ){
-        Kd0 = texture(TextureBall12, vec2(U,V)).rgb;
-    } else if (object_id == 23 ){
-        Kd0 = texture(TextureBall13, vec2(U,V)).rgb;
-    } else if (object_id == 24 ){
-        Kd0 = texture(TextureBall14, vec2(U,V)).rgb;
-    } else if (object_id == 25 ){
-        Kd0 = texture(TextureBall15, vec2(U,V)).rgb;
-    } else if ( object_id == AK47 ){
-        Kd0 = texture(ak47_texture, vec2(U,V)).rgb;
-    } else {
-        Kd0 = texture(brick_room_texture, vec2(U,V)).rgb;
-    }
-    
+#if defined(MATERIAL_BALL)
+    // object_id 10 + n corresponde à bola n, que está na camada n
+    vec3 Kd0 = texture(material_texture, vec3(U,V,fragment_object_id - 10)).rgb;
+#else
+    vec3 Kd0 = texture(material_texture, vec2(U,V)).rgb;
+#endif
+
     // Espectro da fonte de iluminação
     vec3 I = vec3(1.0,1.0,1.0); 
 
@@ -275,17 +180,16 @@ void main()
     vec3 phong_specular_term  = Ks * I * pow(max(0,dot(r, v)), q);
    
 
-    if ( object_id == BRICK_ROOM) {
-        // Equação de Iluminação
-        float lambert = max(0,dot(n,l));
-        color.rgb = Kd0 * (pow(lambert,1) + 0.01) + Kd0 * (1 - (pow(lambert, 0.2)) + 0.01);
-    } else if ( object_id >= 10 && object_id <= 25 ) {
-        color.rgb = Kd0 * (pow(lamber_gourad,1) + 0.01) + Kd0 * (1 - (pow(lamber_gourad, 0.2)) + 0.01);
-    }
-    else {
-        color.rgb = lambert_diffuse_term + ambient_term + phong_specular_term;
-        color.rgb = Kd0 * color.rgb;
-    }
+#if defined(MATERIAL_BRICK_ROOM)
+    // Equação de Iluminação
+    float lambert = max(0,dot(n,l));
+    color.rgb = Kd0 * (pow(lambert,1) + 0.01) + Kd0 * (1 - (pow(lambert, 0.2)) + 0.01);
+#elif defined(MATERIAL_BALL)
+    color.rgb = Kd0 * (pow(lamber_gourad,1) + 0.01) + Kd0 * (1 - (pow(lamber_gourad, 0.2)) + 0.01);
+#else
+    color.rgb = lambert_diffuse_term + ambient_term + phong_specular_term;
+    color.rgb = Kd0 * color.rgb;
+#endif
 
     // NOTE: Se você quiser fazer o rendering de objetos transparentes, é
     // necessário:
@@ -1,15 +1,44 @@
 #version 330 core
 
 // Atributos de vértice recebidos como entrada ("in") pelo Vertex Shader.
-// Veja a função BuildTrianglesAndAddToVirtualScene() em "main.cpp".
-layout (location = 0) in vec4 model_coefficients;
-layout (location = 1) in vec4 normal_coefficients;
+// Veja a função BuildTrianglesAndAddToVirtualScene() em "main.cpp". Os
+// vértices vêm compactados (veja PackedVertex em "meshOptimization.hpp"): a
+// posição não traz o w, e a normal chega em 10 bits por coordenada.
+layout (location = 0) in vec3 model_position;
+layout (location = 1) in vec3 model_normal;
 layout (location = 2) in vec2 texture_coefficients;
 
-// Matrizes computadas no código C++ e enviadas para a GPU
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// As esferas (MATERIAL_SPHERE e MATERIAL_BALL) são sempre desenhadas com
+// instâncias; os demais materiais nunca. Veja LoadShadersFromFiles() e
+// DrawSphereInstances() em "main.cpp".
+#if defined(MATERIAL_SPHERE) || defined(MATERIAL_BALL)
+#define INSTANCED
+#endif
+
+// Atributos por instância, usados somente no desenho instanciado das esferas.
+layout (location = 3) in mat4 instance_model; // Ocupa as locations 3, 4, 5 e 6
+layout (location = 7) in int  instance_object_id;
+
+// Dados constantes durante todo o quadro, computados uma única vez no código
+// C++. Veja a função UpdateFrameUniforms() em "main.cpp".
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 camera_position;
+    vec4 light_direction;         // Luz do modelo de Phong (fragment shader)
+    vec4 gouraud_light_direction; // Luz do modelo de Gouraud (abaixo)
+};
+
+// Dados do objeto sendo desenhado. Veja a função UpdateObjectUniforms() em "main.cpp".
+layout (std140) uniform ObjectUniforms
+{
+    mat4  model;
+    mat4  normal_matrix; // inverse(transpose(model)), computada no código C++
+    vec4  bbox_min;
+    vec4  bbox_max;
+    ivec4 material;      // x = object_id
+};
 
 // Atributos de vértice que serão gerados como saída ("out") pelo Vertex Shader.
 // ** Estes serão interpolados pelo rasterizador! ** gerando, assim, valores
@@ -20,6 +49,7 @@ out vec4 position_model;
 out vec4 normal;
 out vec2 texcoords;
 out float lamber_gourad;
+flat out int fragment_object_id;
 
 void main()
 {
@@ -35,7 +65,19 @@ void main()
     // deste Vertex Shader, a placa de vídeo (GPU) fará a divisão por W. Veja
     // slides 41-67 e 69-86 do documento Aula_09_Projecoes.pdf.
 
-    gl_Position = projection * view * model * model_coefficients;
+    // Reconstruímos a coordenada w de pontos (1) e vetores (0)
+    vec4 model_coefficients = vec4(model_position, 1.0);
+    vec4 normal_coefficients = vec4(model_normal, 0.0);
+
+#ifdef INSTANCED
+    mat4 model_matrix = instance_model;
+    fragment_object_id = instance_object_id;
+#else
+    mat4 model_matrix = model;
+    fragment_object_id = material.x;
+#endif
+
+    gl_Position = projection * view * model_matrix * model_coefficients;
 
     // Como as variáveis acima  (tipo vec4) são vetores com 4 coeficientes,
     // também é possível acessar e modificar cada coeficiente de maneira
@@ -52,14 +94,21 @@ void main()
     // rasterizador para gerar atributos únicos para cada fragmento gerado.
 
     // Posição do vértice atual no sistema de coordenadas global (World).
-    position_world = model * model_coefficients;
+    position_world = model_matrix * model_coefficients;
 
     // Posição do vértice atual no sistema de coordenadas local do modelo.
     position_model = model_coefficients;
 
     // Normal do vértice atual no sistema de coordenadas global (World).
     // Veja slides 123-151 do documento Aula_07_Transformacoes_Geometricas_3D.pdf.
-    normal = inverse(transpose(model)) * normal_coefficients;
+    // As esferas instanciadas só sofrem rotação, translação e escala
+    // uniforme, então a própria matriz model transforma as normais
+    // corretamente (a menos da escala, removida pelo normalize() abaixo).
+#ifdef INSTANCED
+    normal = instance_model * normal_coefficients;
+#else
+    normal = normal_matrix * normal_coefficients;
+#endif
     normal.w = 0.0;
 
     // Coordenadas de textura obtidas do arquivo OBJ (se existirem!)
@@ -70,7 +119,7 @@ void main()
     vec4 n = normalize(normal);
 
     // Vetor que define o sentido da fonte de luz em relação ao ponto atual.
-    vec4 l = normalize(vec4(1.0,1.0,0.0,0.0));
+    vec4 l = gouraud_light_direction;
 
     // Equação de Iluminação
     lamber_gourad = max(0,dot(n,l));
@@ -1,6 +1,10 @@
 // Based on http://hamelot.io/visualization/opengl-text-without-any-external-libraries/
 //   and on https://github.com/rougier/freetype-gl
+#include <cstddef>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,14 +17,30 @@
 
 GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id); // Função definida em main.cpp
 
+// Funções definidas em glState.hpp (incluído por main.cpp)
+void GLState_UseProgram(GLuint program);
+void GLState_BindVertexArray(GLuint vertex_array);
+void GLState_BindBuffer(GLenum target, GLuint buffer);
+void GLState_SetEnabled(GLenum capability, bool enabled);
+void GLState_DepthFunc(GLenum func);
+void GLState_BlendFunc(GLenum src, GLenum dst);
+void GLState_PolygonMode(GLenum mode);
+void GLState_BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void GLState_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+void GLState_Uniform2f(GLint location, float x, float y);
+void GLState_DrawArrays(GLenum mode, GLint first, GLsizei count);
+
 const GLchar* const textvertexshader_source = ""
 "#version 330\n"
-"layout (location = 0) in vec4 position;\n"
+"layout (location = 0) in vec2 origin;\n"
+"layout (location = 1) in vec2 offset;\n"
+"layout (location = 2) in vec2 uv;\n"
+"uniform vec2 pixelSize;\n"
 "out vec2 texCoords;\n"
 "void main()\n"
 "{\n"
-    "gl_Position = vec4(position.xy, 0, 1);\n"
-    "texCoords = position.zw;\n"
+    "gl_Position = vec4(origin + offset * pixelSize, 0, 1);\n"
+    "texCoords = uv;\n"
 "}\n"
 "\0";
 
@@ -86,6 +106,45 @@ GLuint textVAO;
 GLuint textVBO;
 GLuint textprogram_id;
 GLuint texttexture_id;
+GLint  textpixelsize_uniform;
+
+// Coordenadas de textura de um texel totalmente opaco da fonte, usado para
+// desenhar retângulos sólidos (veja TextRendering_PrintBarGraph())
+float textsolid_s;
+float textsolid_t;
+
+// Glifo de cada caractere, indexado diretamente pelo código do caractere.
+// Preenchida em TextRendering_Init(); NULL para caracteres sem glifo.
+const texture_glyph_t* textglyphs[256];
+
+// Quadrilátero de um glifo, em pixels da fonte relativos ao início da string
+struct TextGlyphQuad
+{
+    float x0, y0, x1, y1;
+    float s0, t0, s1, t1;
+};
+
+// Vértice enviado à GPU: posição inicial da string em NDC, deslocamento em
+// pixels (convertido para NDC no vertex shader) e coordenadas de textura
+struct TextVertex
+{
+    float origin_x, origin_y;
+    float offset_x, offset_y;
+    float s, t;
+};
+
+// Layout das strings já impressas. Strings que não mudam de um quadro para
+// o outro (a maior parte do texto na tela) não são refeitas.
+std::unordered_map<std::string, std::vector<TextGlyphQuad> > textlayouts;
+const size_t textlayouts_max = 512;
+
+// Vértices de todo o texto do quadro, desenhados de uma vez por
+// TextRendering_Flush()
+std::vector<TextVertex> textvertices;
+
+// Tamanho da janela, consultado uma única vez por quadro
+int textwindow_width = 0;
+int textwindow_height = 0;
 
 void TextRendering_Init()
 {
@@ -115,8 +174,22 @@ void TextRendering_Init()
 
     GLuint texttex_uniform;
     texttex_uniform = glGetUniformLocation(textprogram_id, "tex");
+    textpixelsize_uniform = glGetUniformLocation(textprogram_id, "pixelSize");
     glCheckError();
 
+    size_t solid_texel = 0;
+    for (size_t i = 0; i < dejavufont.tex_width * dejavufont.tex_height; ++i)
+        if (dejavufont.tex_data[i] > dejavufont.tex_data[solid_texel])
+            solid_texel = i;
+    textsolid_s = (solid_texel % dejavufont.tex_width + 0.5f) / dejavufont.tex_width;
+    textsolid_t = (solid_texel / dejavufont.tex_width + 0.5f) / dejavufont.tex_height;
+
+    for (size_t i = 0; i < 256; ++i)
+        textglyphs[i] = NULL;
+    for (size_t j = 0; j < dejavufont.glyphs_count; ++j)
+        if (dejavufont.glyphs[j].codepoint < 256)
+            textglyphs[dejavufont.glyphs[j].codepoint] = &dejavufont.glyphs[j];
+
     GLuint textureunit = 31;
     glActiveTexture(GL_TEXTURE0 + textureunit);
     glBindTexture(GL_TEXTURE_2D, texttexture_id);
@@ -124,105 +197,185 @@ void TextRendering_Init()
     glBindSampler(textureunit, sampler);
     glCheckError();
 
-    glBindVertexArray(textVAO);
+    GLState_BindVertexArray(textVAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-    glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    GLState_BindBuffer(GL_ARRAY_BUFFER, textVBO);
+    GLState_BufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, origin_x));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, offset_x));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)offsetof(TextVertex, s));
     glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
     glCheckError();
 
-    glUseProgram(textprogram_id);
+    GLState_UseProgram(textprogram_id);
     glUniform1i(texttex_uniform, textureunit);
-    glUseProgram(0);
     glCheckError();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLState_BindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState_BindVertexArray(0);
     glCheckError();
 }
 
 float textscale = 1.5f;
 
-void TextRendering_PrintString(GLFWwindow* window, const std::string &str, float x, float y, float scale = 1.0f)
+void TextRendering_UpdateWindowSize(GLFWwindow* window)
 {
-    scale *= textscale;
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
-    float sx = scale / width;
-    float sy = scale / height;
+    if (textwindow_width == 0 || textwindow_height == 0)
+        glfwGetWindowSize(window, &textwindow_width, &textwindow_height);
+}
 
+// Computa o layout de uma string: um quadrilátero por glifo, em pixels da
+// fonte, a partir da posição (0,0)
+void TextRendering_LayoutString(const std::string &str, std::vector<TextGlyphQuad>* layout)
+{
+    float x = 0.0f;
     for (size_t i = 0; i < str.size(); i++)
     {
-        // Find the glyph for the character we are looking for
-        texture_glyph_t *glyph = 0;
-        for (size_t j = 0; j < dejavufont.glyphs_count; ++j)
-        {
-            if (dejavufont.glyphs[j].codepoint == (uint32_t)str[i])
-            {
-                glyph = &dejavufont.glyphs[j];
-                break;
-            }
-        }
+        const texture_glyph_t *glyph = textglyphs[(unsigned char)str[i]];
         if (!glyph) {
             continue;
         }
         x += glyph->kerning[0].kerning;
-        float x0 = (float) (x + glyph->offset_x * sx);
-        float y0 = (float) (y + glyph->offset_y * sy);
-        float x1 = (float) (x0 + glyph->width * sx);
-        float y1 = (float) (y0 - glyph->height * sy);
-
-        float s0 = glyph->s0 - 0.5f/dejavufont.tex_width;
-        float t0 = glyph->t0 - 0.5f/dejavufont.tex_height;
-        float s1 = glyph->s1 - 0.5f/dejavufont.tex_width;
-        float t1 = glyph->t1 - 0.5f/dejavufont.tex_height;
-
-        struct {float x, y, s, t;} data[6] = {
-            { x0, y0, s0, t0 },
-            { x0, y1, s0, t1 },
-            { x1, y1, s1, t1 },
-            { x0, y0, s0, t0 },
-            { x1, y1, s1, t1 },
-            { x1, y0, s1, t0 }
+
+        TextGlyphQuad quad;
+        quad.x0 = x + glyph->offset_x;
+        quad.y0 = (float) glyph->offset_y;
+        quad.x1 = quad.x0 + glyph->width;
+        quad.y1 = quad.y0 - glyph->height;
+
+        quad.s0 = glyph->s0 - 0.5f/dejavufont.tex_width;
+        quad.t0 = glyph->t0 - 0.5f/dejavufont.tex_height;
+        quad.s1 = glyph->s1 - 0.5f/dejavufont.tex_width;
+        quad.t1 = glyph->t1 - 0.5f/dejavufont.tex_height;
+
+        layout->push_back(quad);
+
+        x += glyph->advance_x;
+    }
+}
+
+// Adiciona a string ao texto do quadro. Nada é desenhado aqui; veja
+// TextRendering_Flush().
+void TextRendering_PrintString(GLFWwindow* window, const std::string &str, float x, float y, float scale = 1.0f)
+{
+    (void)window;
+    scale *= textscale;
+
+    std::unordered_map<std::string, std::vector<TextGlyphQuad> >::iterator it = textlayouts.find(str);
+    if (it == textlayouts.end())
+    {
+        // Strings que mudam a cada quadro (contadores, matrizes) iriam
+        // acumular layouts para sempre; descartamos todos de vez em quando.
+        if (textlayouts.size() >= textlayouts_max)
+            textlayouts.clear();
+
+        it = textlayouts.insert(std::make_pair(str, std::vector<TextGlyphQuad>())).first;
+        TextRendering_LayoutString(str, &it->second);
+    }
+
+    const std::vector<TextGlyphQuad>& layout = it->second;
+    for (size_t i = 0; i < layout.size(); i++)
+    {
+        const TextGlyphQuad& q = layout[i];
+        float x0 = q.x0 * scale, y0 = q.y0 * scale;
+        float x1 = q.x1 * scale, y1 = q.y1 * scale;
+
+        TextVertex data[6] = {
+            { x, y, x0, y0, q.s0, q.t0 },
+            { x, y, x0, y1, q.s0, q.t1 },
+            { x, y, x1, y1, q.s1, q.t1 },
+            { x, y, x0, y0, q.s0, q.t0 },
+            { x, y, x1, y1, q.s1, q.t1 },
+            { x, y, x1, y0, q.s1, q.t0 }
+        };
+        textvertices.insert(textvertices.end(), data, data + 6);
+    }
+}
+
+// Adiciona ao texto do quadro um gráfico de barras com "count" valores,
+// ocupando o retângulo de canto inferior esquerdo (x,y) e tamanho
+// width x height, em NDC. Cada barra tem altura proporcional a
+// values[i] / max_value (limitada a 1). É desenhado junto com o texto.
+void TextRendering_PrintBarGraph(GLFWwindow* window, const float* values, int count, float x, float y, float width, float height, float max_value)
+{
+    TextRendering_UpdateWindowSize(window);
+
+    // Os deslocamentos dos vértices são em pixels (veja o vertex shader)
+    float bar_width = width * textwindow_width / count;
+    float max_height = height * textwindow_height;
+    float s = textsolid_s, t = textsolid_t;
+
+    for (int i = 0; i < count; i++)
+    {
+        float fraction = std::min(std::max(values[i] / max_value, 0.0f), 1.0f);
+        float x0 = i * bar_width, x1 = x0 + bar_width;
+        float y0 = 0.0f, y1 = fraction * max_height;
+
+        TextVertex data[6] = {
+            { x, y, x0, y0, s, t },
+            { x, y, x1, y0, s, t },
+            { x, y, x1, y1, s, t },
+            { x, y, x0, y0, s, t },
+            { x, y, x1, y1, s, t },
+            { x, y, x0, y1, s, t }
         };
+        textvertices.insert(textvertices.end(), data, data + 6);
+    }
+}
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// Desenha todo o texto impresso no quadro com uma única chamada
+// glDrawArrays(). Deve ser chamada uma vez por quadro, antes de
+// glfwSwapBuffers().
+void TextRendering_Flush(GLFWwindow* window)
+{
+    TextRendering_UpdateWindowSize(window);
 
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        glDepthFunc(GL_ALWAYS);
-        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, 24 * sizeof(float), data);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (!textvertices.empty() && textwindow_width > 0 && textwindow_height > 0)
+    {
+        GLState_SetEnabled(GL_BLEND, true);
+        GLState_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        glUseProgram(textprogram_id);
-        glBindVertexArray(textVAO);
+        GLState_PolygonMode(GL_FILL);
+        GLState_DepthFunc(GL_ALWAYS);
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        // Realocamos o buffer inteiro ("orphaning") para não esperar a GPU
+        // terminar de ler o texto do quadro anterior.
+        GLsizeiptr size = textvertices.size() * sizeof(TextVertex);
+        GLState_BindBuffer(GL_ARRAY_BUFFER, textVBO);
+        GLState_BufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+        GLState_BufferSubData(GL_ARRAY_BUFFER, 0, size, textvertices.data());
 
-        glBindVertexArray(0);
-        glUseProgram(0);
-        glDepthFunc(GL_LESS);
+        GLState_UseProgram(textprogram_id);
+        GLState_Uniform2f(textpixelsize_uniform, 1.0f / textwindow_width, 1.0f / textwindow_height);
+        GLState_BindVertexArray(textVAO);
 
-        glDisable(GL_BLEND);
+        GLState_DrawArrays(GL_TRIANGLES, 0, textvertices.size());
 
-        x += (glyph->advance_x * sx);
+        // O texto é desenhado por último; o resto da cena espera o teste de
+        // profundidade normal e nenhuma transparência
+        GLState_DepthFunc(GL_LESS);
+        GLState_SetEnabled(GL_BLEND, false);
     }
+
+    textvertices.clear();
+
+    // O tamanho da janela é consultado de novo no próximo quadro
+    textwindow_width = 0;
+    textwindow_height = 0;
 }
 
 float TextRendering_LineHeight(GLFWwindow* window)
 {
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
-    return dejavufont.height / height * textscale;
+    TextRendering_UpdateWindowSize(window);
+    return dejavufont.height / textwindow_height * textscale;
 }
 
 float TextRendering_CharWidth(GLFWwindow* window)
 {
-    int width, height;
-    glfwGetWindowSize(window, &width, &height);
-    return dejavufont.glyphs[32].advance_x / width * textscale;
+    TextRendering_UpdateWindowSize(window);
+    return dejavufont.glyphs[32].advance_x / textwindow_width * textscale;
 }
 
 void TextRendering_PrintMatrix(GLFWwindow* window, glm::mat4 M, float x, float y, float scale = 1.0f)
@@ -0,0 +1,317 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+// Headers abaixo são específicos de C++
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Gravação de um "trace" no formato Chrome Trace Event (JSON), que pode ser
+// aberto em chrome://tracing ou em https://ui.perfetto.dev . Ativado com
+// "./main --trace arquivo.json" (veja main()).
+//
+// Cada thread guarda os seus eventos de início e fim ("B" e "E") em um
+// buffer circular próprio, sem travas: só a própria thread escreve e só a
+// thread de escrita lê. A thread de escrita esvazia os buffers
+// periodicamente no arquivo, de forma que gravar um evento custa apenas
+// copiar o nome e ler o relógio. Se um buffer encher antes de ser esvaziado,
+// os eventos novos são descartados (e contados). O descarte mantém os pares
+// "B"/"E": cada início gravado reserva espaço para o seu fim, e o fim de um
+// início descartado também é descartado.
+//
+// Uso: "TraceScope trace("nome", detalhe);" no início de um bloco gera um
+// evento que dura até o fim do bloco. Com o trace desligado, o custo é o de
+// testar um bool.
+
+const int TRACE_BUFFER_SIZE = 8192; // Eventos por thread
+const int TRACE_NAME_SIZE   = 96;
+
+struct TraceEvent
+{
+    char     name[TRACE_NAME_SIZE];
+    char     phase;     // 'B' ou 'E'
+    uint64_t timestamp; // Microssegundos desde Trace_Start()
+};
+
+struct TraceBuffer
+{
+    TraceEvent          events[TRACE_BUFFER_SIZE];
+    std::atomic<size_t> head;    // Eventos escritos pela thread dona do buffer
+    std::atomic<size_t> tail;    // Eventos lidos pela thread de escrita
+    size_t              dropped; // Eventos descartados por falta de espaço
+    size_t              open;         // Inícios gravados cujo fim ainda não veio
+    size_t              dropped_open; // Inícios descartados cujo fim ainda não veio
+    int                 thread_id;
+    char                thread_name[32];
+};
+
+struct TraceRecorder
+{
+    std::atomic<bool> enabled;
+    FILE*             file;
+    bool              first_event; // Para separar os eventos do JSON com vírgulas
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex                buffers_mutex;
+    std::vector<TraceBuffer*> buffers;
+
+    std::thread       writer;
+    std::atomic<bool> writer_running;
+};
+
+TraceRecorder g_Trace;
+
+// Buffer da thread atual (criado no seu primeiro evento)
+thread_local TraceBuffer* g_TraceThreadBuffer = NULL;
+
+TraceBuffer* Trace_ThreadBuffer()
+{
+    if ( g_TraceThreadBuffer == NULL )
+    {
+        TraceBuffer* buffer = new TraceBuffer;
+        buffer->head = 0;
+        buffer->tail = 0;
+        buffer->dropped = 0;
+        buffer->open = 0;
+        buffer->dropped_open = 0;
+        buffer->thread_name[0] = '\0';
+
+        std::lock_guard<std::mutex> lock(g_Trace.buffers_mutex);
+        buffer->thread_id = (int)g_Trace.buffers.size() + 1;
+        g_Trace.buffers.push_back(buffer);
+        g_TraceThreadBuffer = buffer;
+    }
+    return g_TraceThreadBuffer;
+}
+
+// Grava um evento "phase" na thread atual. "detail", se não for NULL, é
+// acrescentado ao nome (por exemplo, o nome do arquivo sendo carregado).
+void Trace_Event(char phase, const char* name, const char* detail)
+{
+    if ( !g_Trace.enabled )
+        return;
+
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - g_Trace.start).count();
+
+    TraceBuffer* buffer = Trace_ThreadBuffer();
+    size_t head = buffer->head.load(std::memory_order_relaxed);
+    size_t free_events = (size_t)TRACE_BUFFER_SIZE - (head - buffer->tail.load(std::memory_order_acquire));
+
+    // Os eventos de uma thread são aninhados, então um fim corresponde ao
+    // início mais recente ainda aberto: se ele foi descartado, descartamos
+    // este fim também. Um início só é gravado se ainda sobrar espaço para
+    // ele, para o seu fim e para os fins dos inícios já abertos.
+    if ( phase == 'B' )
+    {
+        if ( buffer->dropped_open > 0 || free_events < buffer->open + 2 )
+        {
+            buffer->dropped_open += 1;
+            buffer->dropped += 1;
+            return;
+        }
+        buffer->open += 1;
+    }
+    else
+    {
+        if ( buffer->dropped_open > 0 )
+        {
+            buffer->dropped_open -= 1;
+            buffer->dropped += 1;
+            return;
+        }
+        if ( free_events == 0 )
+        {
+            buffer->dropped += 1;
+            return;
+        }
+        if ( buffer->open > 0 )
+            buffer->open -= 1;
+    }
+
+    TraceEvent& event = buffer->events[head % TRACE_BUFFER_SIZE];
+    if ( detail != NULL )
+        snprintf(event.name, TRACE_NAME_SIZE, "%s %s", name, detail);
+    else
+        snprintf(event.name, TRACE_NAME_SIZE, "%s", name);
+    event.phase = phase;
+    event.timestamp = timestamp;
+
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace_Begin(const char* name, const char* detail = NULL)
+{
+    Trace_Event('B', name, detail);
+}
+
+void Trace_End(const char* name, const char* detail = NULL)
+{
+    Trace_Event('E', name, detail);
+}
+
+// Nome da thread atual, mostrado pelo visualizador
+void Trace_SetThreadName(const char* name)
+{
+    if ( !g_Trace.enabled )
+        return;
+
+    TraceBuffer* buffer = Trace_ThreadBuffer();
+    std::lock_guard<std::mutex> lock(g_Trace.buffers_mutex);
+    snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+}
+
+// Evento que começa na construção e termina na destruição do objeto
+struct TraceScope
+{
+    char name[TRACE_NAME_SIZE];
+
+    TraceScope(const char* name, const char* detail = NULL)
+    {
+        this->name[0] = '\0';
+        if ( !g_Trace.enabled )
+            return;
+        if ( detail != NULL )
+            snprintf(this->name, TRACE_NAME_SIZE, "%s %s", name, detail);
+        else
+            snprintf(this->name, TRACE_NAME_SIZE, "%s", name);
+        Trace_Begin(this->name);
+    }
+
+    ~TraceScope()
+    {
+        if ( this->name[0] != '\0' )
+            Trace_End(this->name);
+    }
+};
+
+// Escreve "text" como uma string JSON
+void Trace_WriteString(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (const char* c = text; *c != '\0'; ++c)
+    {
+        if ( *c == '"' || *c == '\\' )
+            fputc('\\', file);
+        if ( (unsigned char)*c >= 0x20 )
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+// Copia para o arquivo os eventos ainda não lidos de todos os buffers.
+// Chamada somente pela thread de escrita (ou depois que ela terminou).
+void Trace_Flush()
+{
+    std::vector<TraceBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(g_Trace.buffers_mutex);
+        buffers = g_Trace.buffers;
+    }
+
+    for (size_t b = 0; b < buffers.size(); ++b)
+    {
+        TraceBuffer* buffer = buffers[b];
+        size_t head = buffer->head.load(std::memory_order_acquire);
+        size_t tail = buffer->tail.load(std::memory_order_relaxed);
+
+        for (; tail != head; ++tail)
+        {
+            const TraceEvent& event = buffer->events[tail % TRACE_BUFFER_SIZE];
+            fprintf(g_Trace.file, "%s\n{\"name\":", g_Trace.first_event ? "" : ",");
+            Trace_WriteString(g_Trace.file, event.name);
+            fprintf(g_Trace.file, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%d}",
+                    event.phase, (unsigned long long)event.timestamp, buffer->thread_id);
+            g_Trace.first_event = false;
+        }
+
+        buffer->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void Trace_WriterThread()
+{
+    while ( g_Trace.writer_running.load() )
+    {
+        Trace_Flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+void Trace_Stop();
+
+// Começa a gravar o trace em "filename". Retorna false se o arquivo não
+// puder ser criado. Trace_Stop() é registrada com atexit(), para que o
+// arquivo seja completado mesmo se o programa terminar com std::exit().
+bool Trace_Start(const char* filename)
+{
+    g_Trace.file = fopen(filename, "w");
+    if ( g_Trace.file == NULL )
+        return false;
+
+    fprintf(g_Trace.file, "[");
+    g_Trace.first_event = true;
+    g_Trace.start = std::chrono::steady_clock::now();
+    g_Trace.enabled = true;
+
+    g_Trace.writer_running = true;
+    g_Trace.writer = std::thread(Trace_WriterThread);
+
+    static bool registered = false;
+    if ( !registered )
+        std::atexit(Trace_Stop);
+    registered = true;
+    return true;
+}
+
+// Para a gravação, escrevendo os eventos restantes e os nomes das threads,
+// e libera os buffers. Eventos gravados depois disso são ignorados. As
+// outras threads que gravam eventos já devem ter terminado (veja
+// AssetLoader_Stop()). Pode ser chamada mais de uma vez.
+void Trace_Stop()
+{
+    if ( !g_Trace.enabled )
+        return;
+
+    g_Trace.enabled = false;
+    g_Trace.writer_running = false;
+    g_Trace.writer.join();
+    Trace_Flush();
+
+    std::lock_guard<std::mutex> lock(g_Trace.buffers_mutex);
+    size_t dropped = 0;
+    for (size_t b = 0; b < g_Trace.buffers.size(); ++b)
+    {
+        TraceBuffer* buffer = g_Trace.buffers[b];
+        dropped += buffer->dropped;
+        if ( buffer->thread_name[0] == '\0' )
+            continue;
+
+        fprintf(g_Trace.file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                g_Trace.first_event ? "" : ",", buffer->thread_id);
+        Trace_WriteString(g_Trace.file, buffer->thread_name);
+        fprintf(g_Trace.file, "}}");
+        g_Trace.first_event = false;
+    }
+    fprintf(g_Trace.file, "\n]\n");
+    fclose(g_Trace.file);
+    g_Trace.file = NULL;
+
+    if ( dropped > 0 )
+        fprintf(stderr, "WARNING: trace buffers full, %d events dropped.\n", (int)dropped);
+
+    for (size_t b = 0; b < g_Trace.buffers.size(); ++b)
+        delete g_Trace.buffers[b];
+    g_Trace.buffers.clear();
+    g_TraceThreadBuffer = NULL;
+}
+
+#endif // _TRACE_H
+// vim: set spell spelllang=pt_br :